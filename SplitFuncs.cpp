@@ -1,5 +1,5 @@
 /* 
-GPiler - SlitFuncs.cpp
+GPiler - SplitFuncs.cpp
 Copyright (C) 2013 Jon Pry and Charles Cooper
 
 This program is free software; you can redistribute it and/or
@@ -21,236 +21,478 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "node.h"
 #include "codegen.h"
 #include "runtime.h"
+#include "profile.h"
+
+#include <cstdio>
+#include <set>
+
+//How the result of a statement relates to the elements it reads
+#define NATURAL 	0	//one output per input element, same kernel
+#define TAINTED 	1	//size changes, result lives in a new kernel after compaction
+#define UNNATURAL 	2	//written through a computed index, no size of its own
+
+//Every array variable belongs to a domain, the set of arrays that are walked with the same idx.
+//Each domain becomes one kernel
+class Domains {
+public:
+	string find(string name){
+		if(parent.find(name) == parent.end())
+			parent[name] = name;
+		while(parent[name] != name){
+			parent[name] = parent[parent[name]];
+			name = parent[name];
+		}
+		return name;
+	}
 
-#define NATURAL 	0
-#define TAINTED 	1
-#define UNNATURAL 	2
+	void join(string a, string b){
+		parent[find(a)] = find(b);
+	}
 
-int isNatural(NExpression *expr, NFunctionDeclaration *decl);
+	map<string,string> parent;
+};
 
-int isNatural(NIdentifier *id, NFunctionDeclaration *decl) {
+static NVariableDeclaration *find_var(NFunctionDeclaration *decl, string name){
 	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++){
-		NVariableDeclaration *vdec = *it;
-		if(vdec->id->name.compare(id->name) == 0){
-			return NATURAL;
-		}
+		if((*it)->id->name == name)
+			return *it;
+	}
+	for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++){
+		if((*it)->id->name == name)
+			return *it;
 	}
-
 	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
 		NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it);
-		if(vdec && vdec->id->name.compare(id->name) == 0){
-			return isNatural(vdec->assignmentExpr,decl)?UNNATURAL:NATURAL;	
-		}
+		if(vdec && vdec->id->name == name)
+			return vdec;
 	}
-	
-	return UNNATURAL;
+	return 0;
 }
 
-int isNatural(NExpression* expr, NFunctionDeclaration *decl){
-	NMap* map = dynamic_cast<NMap*>(expr);
-	if(map){
-		if(!map->isNatural())
-			return isNatural(map->input,decl)?UNNATURAL:TAINTED;
-		return isNatural(map->input,decl)?UNNATURAL:NATURAL;
+static bool isReturn(NFunctionDeclaration *decl, string name){
+	for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++){
+		if((*it)->id->name == name)
+			return true;
 	}
+	return false;
+}
 
-	NIdentifier *id = dynamic_cast<NIdentifier*>(expr);
-	if(id){
-		return isNatural(id,decl)?UNNATURAL:NATURAL;
+//Scalar arguments are the same for every element and belong to no domain. Pipeline temps are 
+//declared with their element type but are arrays all the same
+static bool isElementwise(NFunctionDeclaration *decl, string name){
+	NVariableDeclaration *var = find_var(decl,name);
+	if(!var)
+		return false;
+	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++){
+		if(*it == var)
+			return (*var->types->begin())->isArray;
 	}
+	return true;
+}
 
-	cout << "IsNatural failed2\n";
-	cout << *expr;
-	exit(-1);
-	return -1;
+int isNatural(NAssignment *assn){
+	if(assn->index)
+		return UNNATURAL;
+	NMap* map = dynamic_cast<NMap*>(assn->rhs);
+	if(map && !map->isNatural())
+		return TAINTED;
+	return NATURAL;
 }
 
+//The array whose elements drive a statement
+static string driver(NAssignment *assn){
+	NMap *map = dynamic_cast<NMap*>(assn->rhs);
+	if(map)
+		return map->input->name;
+	NArrayRef *ref = dynamic_cast<NArrayRef*>(assn->rhs);
+	if(ref)
+		return ref->index->name;
+	NZip *zip = dynamic_cast<NZip*>(assn->rhs);
+	if(zip)
+		return (*assn->lhs->begin())->name;
+	NIdentifier *id = dynamic_cast<NIdentifier*>(assn->rhs);
+	if(id)
+		return id->name;
+	return "";
+}
 
-void split_unnatural_rcv(NFunctionDeclaration *decl, string base_name, int num_splits, FunctionList *split_funcs){
-	ExpressionList naturals,taints,unnaturals;
-	AssignmentList assignments;
+static NVariableDeclaration *array_var(NVariableDeclaration *var, string name){
+	NVariableDeclaration *ret = (NVariableDeclaration*)var->clone();
+	ret->SetExpr(0);
+	ret->id->name = name;
+	(*ret->types->begin())->isArray = 1;
+	return ret;
+}
 
-	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
-		int natural=NATURAL;
-		NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it);
-		if(vdec){
-			natural = isNatural(vdec->assignmentExpr,decl);
+static void names_of(Node *stmt, set<string> &names){
+	IdList ids;
+	stmt->GetIdRefs(ids);
+	NAssignment *assn = dynamic_cast<NAssignment*>(stmt);
+	if(assn && assn->lhs)
+		ids.insert(ids.end(), assn->lhs->begin(), assn->lhs->end());
+	for(IdList::iterator it = ids.begin(); it != ids.end(); it++)
+		names.insert((*it)->name);
+}
+
+//Every kernel runs over its domain, the first array it takes as an argument sets the launch size
+static void set_launch_size(RuntimePlan *plan, NFunctionDeclaration *module){
+	for(VariableList::iterator it = module->arguments->begin(); it != module->arguments->end(); it++){
+		if((*(*it)->types->begin())->isArray){
+			plan->launchSize[module->id->name] = (*it)->id->name;
+			return;
 		}
+	}
+	cout << "No array to size " << module->id->name << "\n";
+	exit(-1);
+}
+
+//The domain a statement's work belongs to
+static string domain_of(Node *stmt, Domains &domains){
+	string name;
+	NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(stmt);
+	if(vdec)
+		name = vdec->id->name;
+	NAssignment *assn = dynamic_cast<NAssignment*>(stmt);
+	if(assn)
+		name = isNatural(assn) == NATURAL ? (*assn->lhs->begin())->name : driver(assn);
+	assert(vdec || assn);
+	return domains.find(name);
+}
+
+//Whether the stages after filter can run on every element of its input and have their results
+//compacted instead. Only when nothing else reads what they make and they don't change size again
+static bool maskable(NFunctionDeclaration *decl, NAssignment *filter, Domains &domains){
+	string dom = domains.find((*filter->lhs->begin())->name);
+	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++)
+		if(domains.find((*it)->id->name) == dom)
+			return false;
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		if(*it == filter)
+			continue;
 		NAssignment *assn = dynamic_cast<NAssignment*>(*it);
-		if(assn){
-			natural = isNatural(assn->rhs,decl);
-		}
-		assert(vdec || assn);
-		//Store tainted values, ignore UNNATURAL
-		if(natural==NATURAL)
-			naturals.push_back((NExpression*)*it);
-		else if(natural==TAINTED)
-			taints.push_back((NExpression*)*it);
-		else
-			unnaturals.push_back((NExpression*)*it);
-
-		if(assn && (natural != UNNATURAL)){
-			assignments.push_back(assn);
+		if(domain_of(*it,domains) == dom){
+			if(assn && isNatural(assn) != NATURAL)
+				return false;
+			continue;
 		}
+		set<string> names;
+		names_of(*it,names);
+		for(set<string>::iterator it2 = names.begin(); it2 != names.end(); it2++)
+			if(domains.find(*it2) == dom)
+				return false;
 	}
+	return true;
+}
 
-#if 0
-	cout << "Naturals\n";
+//Measured share of elements the k'th filter of decl keeps. Masked filters are recorded under the
+//compaction of their first result
+static double selectivity(NFunctionDeclaration *decl, int k){
+	char name[128];
+	sprintf(name,"%s.compact%d",decl->id->name.c_str(),k);
+	double kept = profile->Selectivity(name);
+	if(kept >= 0)
+		return kept;
+	sprintf(name,"%s.compact%d.0",decl->id->name.c_str(),k);
+	return profile->Selectivity(name);
+}
 
-	for(ExpressionList::iterator it=naturals.begin(); it!= naturals.end(); it++){
-		cout << **it << ";\n";
-	}
+struct Kernel {
+	NodeList stmts;
+	set<string> defs, uses;
+	NFunctionDeclaration *decl;
+};
 
-	cout << "Taints\n";
+//Splits decl at every size changing stage. Returns the plan, decl itself is left alone when no split is needed
+static RuntimePlan *split_unnatural(NFunctionDeclaration *decl, FunctionList *kernels){
+	Domains domains;
+	AssignmentList filters;
 
-	for(ExpressionList::iterator it=taints.begin(); it!= taints.end(); it++){
-		cout << **it << ";\n";
-	}
-#endif
-	//Add the current function to the list of splits
-	char func_name[128];
-	sprintf(func_name,"%s.%d",base_name.c_str(),num_splits);
-	decl->id->name = func_name;
-
-	split_funcs->push_back(decl);
-
-	//For every tainted value, create a new function with that value as an argument, add all of the unnatural assignments
-	//and try to do some recursion
-	for(ExpressionList::iterator it=taints.begin(); it!= taints.end(); it++){
-		VariableList *args = new VariableList();
-		NVariableDeclaration *input = dynamic_cast<NVariableDeclaration*>(*it);
-		assert(input);
-		input = (NVariableDeclaration*)input->clone();
-		input->SetExpr(0);
-	
-		args->push_back(input);
-		NBlock *block = new NBlock();
-		
-		for(ExpressionList::iterator it2 = unnaturals.begin(); it2 != unnaturals.end(); it2++){
-			block->add_child((*it2)->clone());
+	//Walk the statements joining arrays that share an index
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		NAssignment *assn = dynamic_cast<NAssignment*>(*it);
+		if(!assn)
+			continue;
+		string in = driver(assn);
+		NZip *zip = dynamic_cast<NZip*>(assn->rhs);
+		if(zip){
+			//Drive the zip from its first array
+			in = "";
+			for(IdList::iterator it2 = zip->src->begin(); it2 != zip->src->end(); it2++){
+				if(!isElementwise(decl,(*it2)->name))
+					continue;
+				if(in == "")
+					in = (*it2)->name;
+				domains.join(in,(*it2)->name);
+			}
 		}
+		if(in == "" || !isElementwise(decl,in))
+			continue;
 
-		
-		NFunctionDeclaration *new_func = new NFunctionDeclaration(0,new NIdentifier("foo"),args,block);
-
-		split_unnatural_rcv(new_func,base_name,num_splits+1,split_funcs);
+		switch(isNatural(assn)){
+			case NATURAL:
+				for(IdList::iterator it2 = assn->lhs->begin(); it2 != assn->lhs->end(); it2++)
+					domains.join((*it2)->name,in);
+				break;
+			case TAINTED:
+				filters.push_back(assn);
+				break;
+			case UNNATURAL:
+				domains.join(assn->index->name,in);
+				break;
+		}
 	}
 
-	//remove everything but taints and naturals from the current function
-	{
-		decl->block->children.clear();
-		for(ExpressionList::iterator it=naturals.begin(); it!= naturals.end(); it++){
-			decl->block->add_child(*it);
+	//Compacting costs a pass over the input and a kernel boundary. When the profile says a filter
+	//keeps most elements, the stages after it run on all of them in the filter's kernel and only
+	//the returns they produce are compacted
+	map<NAssignment*,set<string> > masked;
+	int count=0;
+	for(AssignmentList::iterator it = filters.begin(); it != filters.end(); it++, count++){
+		if(!profile || !maskable(decl,*it,domains))
+			continue;
+		double kept = selectivity(decl,count);
+		if(kept < PROFILE_MASKED)
+			continue;
+		string dom = domains.find((*(*it)->lhs->begin())->name);
+		set<string> &results = masked[*it];
+		for(NodeList::iterator it2 = decl->block->children.begin(); it2 != decl->block->children.end(); it2++){
+			NAssignment *assn = dynamic_cast<NAssignment*>(*it2);
+			if(!assn || *it2 == *it || domain_of(assn,domains) != dom)
+				continue;
+			for(IdList::iterator it3 = assn->lhs->begin(); it3 != assn->lhs->end(); it3++)
+				if(isReturn(decl,(*it3)->name))
+					results.insert((*it3)->name);
 		}
+		if(isReturn(decl,(*(*it)->lhs->begin())->name))
+			results.insert((*(*it)->lhs->begin())->name);
+		cout << "Masking filter " << count << " of " << decl->id->name << ", keeps " << (int)(kept * 100) << "%\n";
+	}
+	for(map<NAssignment*,set<string> >::iterator it = masked.begin(); it != masked.end(); it++)
+		domains.join((*it->first->lhs->begin())->name,driver(it->first));
 
-		for(ExpressionList::iterator it=taints.begin(); it!= taints.end(); it++){
-			decl->block->add_child(*it);
-		}
+	//Hand every statement to the kernel of its domain
+	map<string,Kernel> by_domain;
+	list<string> order;
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		string dom = domain_of(*it,domains);
+		if(by_domain.find(dom) == by_domain.end())
+			order.push_back(dom);
+		by_domain[dom].stmts.push_back(*it);
 	}
 
+	if(filters.empty() && order.size() < 2){
+		RuntimePlan *plan = new RuntimePlan(decl);
+		plan->order.push_back(decl);
+		for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++)
+			plan->writes[decl->id->name].push_back((*it)->id->name);
+		set_launch_size(plan,decl);
+		kernels->push_back(decl);
+		return plan;
+	}
 
-	// Zonk the return type and rebuild it
-	decl->ClearReturns();
-	{
-		for(ExpressionList::iterator it=taints.begin(); it!= taints.end(); it++){
-			NVariableDeclaration *input = dynamic_cast<NVariableDeclaration*>(*it);
-			assert(input);
-			NVariableDeclaration *new_var = (NVariableDeclaration*)input->clone();
-			new_var->SetExpr(0);
-			decl->AddReturn(new_var);
-
-			//Replace the declaration with an assignment
-			NAssignment *assn = new NAssignment(input->id,input->assignmentExpr);
-			for(NodeList::iterator it2=decl->block->children.begin(); it2!=decl->block->children.end(); it2++){
-				if((*it2)==input){
-//					cout << "Found\n";
-					it2 = decl->block->children.erase(it2);
-					decl->block->children.insert(it2,assn);
-					break;
-				}
-			} 
+	//A filter becomes a mask in the kernel that feeds it, the compaction step builds the real array
+	FunctionList compactions;
+	count=0;
+	for(AssignmentList::iterator it = filters.begin(); it != filters.end(); it++){
+		NAssignment *assn = *it;
+		NMap *map = (NMap*)assn->rhs;
+		NIdentifier *out = *assn->lhs->begin();
+		string in = map->input->name, mask = out->name + ".pred";
+		Kernel &kern = by_domain[domains.find(in)];
+
+		NVariableDeclaration *mask_dec = new NVariableDeclaration(new TypeList{new NType("bool",0)},new NIdentifier(mask));
+		NodeList::iterator at;
+		for(at = kern.stmts.begin(); at != kern.stmts.end(); at++){
+			if(*at == assn){
+				kern.stmts.insert(at,mask_dec);
+				break;
+			}
 		}
 
-		for(AssignmentList::iterator it=assignments.begin(); it!= assignments.end(); it++){
-			NAssignment* assn = *it;
-			//TODO: fubar that we use (NIdentifier*)assn->rhs
-			NType* type = typeOf(decl,(NIdentifier*)assn->rhs,1);
-			type->isArray=1;
-			NVariableDeclaration *ret = new NVariableDeclaration(type,assn->lhs);
-			decl->AddReturn(ret);
+		char name[128];
+		if(masked.find(assn) != masked.end()){
+			//Every element goes on as is, the results are made in full and compacted at the end
+			kern.stmts.insert(++at,new NAssignment(new IdList{new NIdentifier(out->name)},new NIdentifier(in)));
+			out->name = mask;
+			set<string> &results = masked[assn];
+			int part=0;
+			for(NodeList::iterator it2 = kern.stmts.begin(); it2 != kern.stmts.end(); it2++){
+				NAssignment *result = dynamic_cast<NAssignment*>(*it2);
+				if(!result)
+					continue;
+				for(IdList::iterator it3 = result->lhs->begin(); it3 != result->lhs->end(); it3++){
+					NIdentifier *id = *it3;
+					if(!results.count(id->name))
+						continue;
+					NVariableDeclaration *ret = find_var(decl,id->name);
+					NVariableDeclaration *full = (NVariableDeclaration*)ret->clone();
+					full->id->name = id->name + ".full";
+					(*full->types->begin())->isArray = 0;
+					kern.stmts.insert(it2,full);
+
+					sprintf(name,"%s.compact%d.%d",decl->id->name.c_str(),count,part++);
+					compactions.push_back(new NFunctionDeclaration(new VariableList{array_var(ret,id->name)}, new NIdentifier(name),
+							new VariableList{array_var(full,full->id->name), array_var(mask_dec,mask)}, new NBlock()));
+					id->name = full->id->name;
+				}
+			}
+			count++;
+			continue;
 		}
-	}	
-}
 
-void split_unnatural(NFunctionDeclaration *decl, FunctionList *split_funcs){
-	//TODO: this function assumes that all input arrays can be of different size
-	//Maps of multiple inputs and such things may put restrictions on that allowing
-	//more code to be combined into modules
+		sprintf(name,"%s.compact%d",decl->id->name.c_str(),count++);
+		NVariableDeclaration *out_dec = find_var(decl,out->name);
+		NFunctionDeclaration *compact = new NFunctionDeclaration(new VariableList{array_var(out_dec,out->name)}, new NIdentifier(name),
+						new VariableList{array_var(find_var(decl,in),in), array_var(mask_dec,mask)}, new NBlock());
+		compactions.push_back(compact);
 
-	for(VariableList::iterator it=decl->arguments->begin(); it!=decl->arguments->end(); it++){
-		NFunctionDeclaration *new_decl = (NFunctionDeclaration*)decl->clone();
-		//cout << *new_decl;
+		//The filtered array comes in as an argument of its own kernel
+		Kernel &next = by_domain[domains.find(out->name)];
+		next.stmts.remove(out_dec);
+		out->name = mask;
+	}
 
-		new_decl->ClearArguments();
-		new_decl->AddArgument(*it);
+	for(map<string,Kernel>::iterator it = by_domain.begin(); it != by_domain.end(); it++){
+		Kernel &kern = it->second;
+		for(NodeList::iterator it2 = kern.stmts.begin(); it2 != kern.stmts.end(); it2++){
+			names_of(*it2,kern.uses);
+			NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it2);
+			if(vdec)
+				kern.defs.insert(vdec->id->name);
+		}
+	}
 
-		split_unnatural_rcv(new_decl,decl->id->name,split_funcs->size(),split_funcs);
+	//Locals some other step reads leave their kernel through a return. Map results can't be written 
+	//straight into a return so they are copied out under a new name at the end of the kernel
+	map<string,string> exported;
+	for(map<string,Kernel>::iterator it = by_domain.begin(); it != by_domain.end(); it++){
+		set<string> wanted;
+		for(map<string,Kernel>::iterator it2 = by_domain.begin(); it2 != by_domain.end(); it2++){
+			if(it2 == it)
+				continue;
+			for(set<string>::iterator it3 = it2->second.uses.begin(); it3 != it2->second.uses.end(); it3++)
+				if(it->second.defs.count(*it3))
+					wanted.insert(*it3);
+		}
+		for(FunctionList::iterator it2 = compactions.begin(); it2 != compactions.end(); it2++){
+			for(VariableList::iterator it3 = (*it2)->arguments->begin(); it3 != (*it2)->arguments->end(); it3++)
+				if(it->second.defs.count((*it3)->id->name))
+					wanted.insert((*it3)->id->name);
+		}
+		for(set<string>::iterator it2 = wanted.begin(); it2 != wanted.end(); it2++){
+			string name = *it2 + ".out";
+			exported[*it2] = name;
+			it->second.stmts.push_back(new NAssignment(new IdList{new NIdentifier(name)},new NIdentifier(*it2)));
+		}
 	}
-}
 
-//TODO: we need a way to do this stuff that isn't specific to filter, probably through better support of multiple returns
-void expand_filter(NFunctionDeclaration *decl){
-	//Code assume that filter will be stuck in an NAssignment, which is true at time of writing
-	for(NodeList::iterator it = decl->block->children.begin(); it!=decl->block->children.end(); it++){
-		NAssignment *assn = dynamic_cast<NAssignment*>(*it);
-		if(!assn)
-			continue;
-		NMap* map = dynamic_cast<NMap*>(assn->rhs);
-		if(!map)
-			continue;
-		if(map->name->name.compare("filter")!=0)
-			continue;
+	//Build the kernel functions
+	count=0;
+	FunctionList modules;
+	for(list<string>::iterator it = order.begin(); it != order.end(); it++){
+		Kernel &kern = by_domain[*it];
+		NBlock *block = new NBlock();
+		VariableList *args = new VariableList(), *rets = new VariableList();
+		set<string> seen;
+
+		for(NodeList::iterator it2 = kern.stmts.begin(); it2 != kern.stmts.end(); it2++){
+			//Reads of another kernel's locals go to the exported copy
+			IdList ids;
+			(*it2)->GetIdRefs(ids);
+			for(IdList::iterator it3 = ids.begin(); it3 != ids.end(); it3++){
+				if(!kern.defs.count((*it3)->name) && exported.find((*it3)->name) != exported.end())
+					(*it3)->name = exported[(*it3)->name];
+			}
+			block->add_child(*it2);
+		}
+
+		set<string> names;
+		for(NodeList::iterator it2 = block->children.begin(); it2 != block->children.end(); it2++)
+			names_of(*it2,names);
+
+		for(set<string>::iterator it2 = names.begin(); it2 != names.end(); it2++){
+			string name = *it2;
+			if(kern.defs.count(name))
+				continue;
+			NVariableDeclaration *var = find_var(decl,name);
+			if(isReturn(decl,name)){
+				rets->push_back((NVariableDeclaration*)var->clone());
+				continue;
+			}
+			if(var){
+				//Locals of decl arrive whole from the step that built them
+				if(isElementwise(decl,name) && !(*var->types->begin())->isArray)
+					args->push_back(array_var(var,name));
+				else
+					args->push_back((NVariableDeclaration*)var->clone());
+				continue;
+			}
+			//One of the names made up above
+			for(map<string,string>::iterator it3 = exported.begin(); it3 != exported.end(); it3++){
+				if(it3->second == name){
+					NVariableDeclaration *src = find_var(decl,it3->first);
+					if(!src){
+						for(FunctionList::iterator it4 = compactions.begin(); it4 != compactions.end(); it4++)
+							for(VariableList::iterator it5 = (*it4)->arguments->begin(); it5 != (*it4)->arguments->end(); it5++)
+								if((*it5)->id->name == it3->first)
+									src = *it5;
+					}
+					assert(src);
+					if(kern.defs.count(it3->first))
+						rets->push_back(array_var(src,name));
+					else
+						args->push_back(array_var(src,name));
+				}
+			}
+		}
 
-		//Found it
-		char new_name[128];
-		sprintf(new_name, "%s.pred", assn->lhs->name.c_str());
-		assn->rhs = map->input;
-		NAssignment *new_assn = new NAssignment(new NIdentifier(new_name),map);
-		decl->block->children.insert(it,new_assn);
+		char name[128];
+		sprintf(name,"%s.%d",decl->id->name.c_str(),count++);
+		kern.decl = new NFunctionDeclaration(rets,new NIdentifier(name),args,block);
+		kernels->push_back(kern.decl);
+		modules.push_back(kern.decl);
+	}
 
-		NVariableDeclaration *new_decl = new NVariableDeclaration(new NType("bool",0), new NIdentifier(new_name));
-		decl->AddReturn(new_decl);
+	//Compactions read the exported copies too
+	for(FunctionList::iterator it = compactions.begin(); it != compactions.end(); it++){
+		for(VariableList::iterator it2 = (*it)->arguments->begin(); it2 != (*it)->arguments->end(); it2++){
+			if(exported.find((*it2)->id->name) != exported.end())
+				(*it2)->id->name = exported[(*it2)->id->name];
+		}
+		modules.push_back(*it);
 	}
+
+	RuntimePlan *plan = generate_runtime(decl,&modules);
+	for(FunctionList::iterator it = compactions.begin(); it != compactions.end(); it++)
+		plan->compactions.insert(*it);
+
+	for(FunctionList::iterator it = modules.begin(); it != modules.end(); it++)
+		set_launch_size(plan,*it);
+	return plan;
 }
 
 //this function requires conversion to strict SSA first, only elements are assignment for return and vardec's
 void split_unnatural(NBlock *pb){
 	NodeList::iterator it;
-	NodeList kernels;
-	for(it = pb->children.begin(); it != pb->children.end(); it++){
+	for(it = pb->children.begin(); it != pb->children.end(); ){
 		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*> (*it);
-		if(decl && !decl->isGenerated){
-			kernels.push_back(decl);
+		if(!decl || decl->isGenerated || decl->isScalar()){
+			it++;
+			continue;
 		}
-	}
 
-	for(it = kernels.begin(); it != kernels.end(); it++){
-		NFunctionDeclaration *decl =(NFunctionDeclaration*) (*it);
-		//TODO: for now we just copy the thing so the constructed runtime doesn't end up
-		//in programBlock until we are ready for it
-		decl = (NFunctionDeclaration*)decl->clone();
-		NFunctionDeclaration *cpy = (NFunctionDeclaration*)decl->clone();
-		FunctionList split_funcs;
-		split_unnatural(cpy,&split_funcs);
-
-		for(FunctionList::iterator it2 = split_funcs.begin(); it2!=split_funcs.end(); it2++){
-			//Some per function subpasses to do here
-			expand_filter(*it2);
-			cout << **it2;
+		FunctionList kernels;
+		RuntimePlan *plan = split_unnatural(decl,&kernels);
+		runtimePlans.push_back(plan);
+		plan->print();
+
+		if(kernels.size() == 1 && kernels.front() == decl){
+			it++;
+			continue;
 		}
 
-		generate_runtime(decl,&split_funcs);
-		cout << *decl;
+		for(FunctionList::iterator it2 = kernels.begin(); it2 != kernels.end(); it2++)
+			pb->add_child(it,*it2);
+		it = pb->children.erase(it);
 	}
 }
-
@@ -20,7 +20,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "node.h"
 #include "codegen.h"
 #include "parser.hpp"
+#include "profile.h"
 
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/Transforms/IPO.h"
 
 using namespace std;
@@ -32,6 +35,7 @@ void CodeGenContext::generateCode(NBlock& root)
 
 	root.declGen(*this); /* declare all functions */
 	root.codeGen(*this); /* emit bytecode for the toplevel block */
+	generate_launchers(*this);
 
 	/* Print the bytecode in a human-readable format
 	to see if our program compiled properly
@@ -54,26 +58,11 @@ GenericValue CodeGenContext::runCode() {
 }
 
 /* Returns an LLVM type based on the identifier */
+static Type *typeOf(GType type);
+
 static Type *typeOf(const NType* type)
 {
-	Type* ret=0;
-	if (type->name.compare("int") == 0 || type->name.compare("int32") == 0) {
-		ret = Type::getInt32Ty(getGlobalContext());
-	}else if (type->name.compare("int64") == 0) {
-		ret = Type::getInt64Ty(getGlobalContext());
-	}else if (type->name.compare("double") == 0) {
-		ret = Type::getDoubleTy(getGlobalContext());
-	}else if (type->name.compare("float") == 0) {
-		ret = Type::getFloatTy(getGlobalContext());
-	}else if (type->name.compare("int16") == 0) {
-		ret = Type::getInt16Ty(getGlobalContext());
-	}else if (type->name.compare("int8") == 0) {
-		ret = Type::getInt8Ty(getGlobalContext());
-	}else if (type->name.compare("bool") == 0) {
-		ret = Type::getInt1Ty(getGlobalContext());
-	}else if (type->name.compare("void") == 0) {
-		ret = Type::getVoidTy(getGlobalContext());
-	} else cout << "Error unknown type: " << type->name << "\n";
+	Type* ret = typeOf(*((Node*)type)->GetType().begin());
 
 	if(type->isArray){
 		ret = PointerType::get(ret,1);//1 is global address space
@@ -86,7 +75,7 @@ static Type *typeOf(const NType* type)
 	return ret;
 }
 
-static Type *typeOf(const NVariableDeclaration *decl){
+Type *typeOf(const NVariableDeclaration *decl){
 	if(!decl)
 		return Type::getVoidTy(getGlobalContext());
 	return typeOf(*decl->types->begin());
@@ -98,18 +87,15 @@ static Type *typeOf(GType type)
 	Type* ret=0;
 	if (type.type == BOOL_TYPE){
 		ret = Type::getInt1Ty(getGlobalContext());
-	}else if (type.type == INT_TYPE && type.length==32) {
-		ret = Type::getInt32Ty(getGlobalContext());
-	}else if (type.type == INT_TYPE && type.length==64) {
-		ret = Type::getInt64Ty(getGlobalContext());
+	}else if (type.type == INT_TYPE || type.type == UINT_TYPE) {
+		//Signedness lives in the instructions, not the type
+		ret = Type::getIntNTy(getGlobalContext(), type.length);
 	}else if (type.type == FLOAT_TYPE && type.length==64) {
 		ret = Type::getDoubleTy(getGlobalContext());
 	}else if (type.type == FLOAT_TYPE && type.length==32) {
 		ret = Type::getFloatTy(getGlobalContext());
-	}else if (type.type == INT_TYPE && type.length==16) {
-		ret = Type::getInt16Ty(getGlobalContext());
-	}else if (type.type == INT_TYPE && type.length==8) {
-		ret = Type::getInt8Ty(getGlobalContext());
+	}else if (type.type == FLOAT_TYPE && type.length==16) {
+		ret = Type::getHalfTy(getGlobalContext());
 	}else if (type.type == VOID_TYPE) {
 		ret = Type::getVoidTy(getGlobalContext());
 	} else {
@@ -119,6 +105,52 @@ static Type *typeOf(GType type)
 	return ret;
 }
 
+//Numeric conversion between any two of the language's types. Bools and unsigned integers widen
+//with zeros, anything becomes a bool by comparing against zero. Constants stay constants
+static Value *convert(Value *val, GType from, GType to, BasicBlock *block){
+	Type *type = typeOf(to);
+	if(val->getType() == type)
+		return val;
+	Constant *c = dyn_cast<Constant>(val);
+	bool fromSigned = from.type == INT_TYPE;
+	if(to.type == BOOL_TYPE){
+		if(from.type == FLOAT_TYPE){
+			Constant *zero = ConstantFP::get(val->getType(), 0);
+			if(c)
+				return ConstantExpr::getFCmp(CmpInst::Predicate::FCMP_UNE, c, zero);
+			return new FCmpInst(*block, CmpInst::Predicate::FCMP_UNE, val, zero, "");
+		}
+		Constant *zero = Constant::getNullValue(val->getType());
+		if(c)
+			return ConstantExpr::getICmp(CmpInst::Predicate::ICMP_NE, c, zero);
+		return new ICmpInst(*block, CmpInst::Predicate::ICMP_NE, val, zero, "");
+	}
+
+	Instruction::CastOps op;
+	if(from.type == FLOAT_TYPE && to.type == FLOAT_TYPE)
+		op = from.length < to.length ? Instruction::FPExt : Instruction::FPTrunc;
+	else if(to.type == FLOAT_TYPE)
+		op = fromSigned ? Instruction::SIToFP : Instruction::UIToFP;
+	else if(from.type == FLOAT_TYPE)
+		op = to.type == UINT_TYPE ? Instruction::FPToUI : Instruction::FPToSI;
+	else if(from.length < to.length)
+		op = fromSigned ? Instruction::SExt : Instruction::ZExt;
+	else
+		op = Instruction::Trunc;
+	if(c)
+		return ConstantExpr::getCast(op, c, type);
+	return CastInst::Create(op, val, type, "", block);
+}
+
+//The language type of an LLVM value type, for when only the callee's signature is at hand
+static GType typeOf(Type *type){
+	if(type->isIntegerTy(1))
+		return GType(BOOL_TYPE,1,0);
+	if(type->isIntegerTy())
+		return GType(INT_TYPE,type->getIntegerBitWidth(),0);
+	return GType(FLOAT_TYPE,type->getPrimitiveSizeInBits(),0);
+}
+
 /* -- Code Generation -- */
 
 Value* NInteger::codeGen(CodeGenContext& context)
@@ -133,19 +165,32 @@ Value* NDouble::codeGen(CodeGenContext& context)
 	return ConstantFP::get(Type::getDoubleTy(getGlobalContext()), value);
 }
 
+static bool declared(const string &name, CodeGenContext& context){
+	return context.registers().count(name) || context.locals().find(name) != context.locals().end();
+}
+
+//Current value of a local, straight from its register or loaded from its stack slot
+static Value *valueOf(const string &name, CodeGenContext& context){
+	if(!context.registers().count(name))
+		return new LoadInst(context.locals()[name], "", false, context.currentBlock());
+	if(context.values().find(name) == context.values().end())
+		return UndefValue::get(typeOf(*context.localTypes()[name].begin()));
+	return context.values()[name];
+}
+
 Value* NIdentifier::codeGen(CodeGenContext& context)
 {
 	std::cout << "Creating identifier reference: " << name << endl;
-	if (context.locals().find(name) == context.locals().end()) {
+	if (!declared(name,context)) {
 		std::cerr << "undeclared variable " << name << endl;
 		return NULL;
 	}
-	return new LoadInst(context.locals()[name], "", false, context.currentBlock());
+	return valueOf(name,context);
 }
 
 Value* NRef::codeGen(CodeGenContext& context){
 	cout << "Creating address reference\n";
-	if(context.locals().find(exp->name) == context.locals().end()){
+	if(!declared(exp->name,context)){
 		cout << "Error\n";
 	}
 	GType type = *exp->GetType(context.localTypes()).begin();
@@ -154,22 +199,80 @@ Value* NRef::codeGen(CodeGenContext& context){
 	return context.locals()[exp->name];
 }
 
+//Writes val to a local. Outputs of the function are stored through their pointer, registers just
+//take val as their new value
+static Value *assign(const string &name, Value *val, CodeGenContext& context){
+	GType type = *context.localTypes()[name].begin();
+	if(type.isPointer){
+		cout << "Indirect assignment\n";
+		return new StoreInst(val, valueOf(name,context), false, context.currentBlock());
+	}
+	if(context.registers().count(name)){
+		if(isa<Instruction>(val) && !val->hasName())
+			val->setName(name);
+		context.values()[name] = val;
+		return val;
+	}
+	return new StoreInst(val, context.locals()[name], false, context.currentBlock());
+}
+
+//Outputs a call has beyond the parameters of the callee. Those are the leading &var arguments
+//rewrite_triads added, the callee returns them instead
+static int outputsOf(NMethodCall *call, Function *function){
+	if(!function)
+		return 0;
+	return call->arguments->size() - function->arg_size();
+}
+
 Value* NMethodCall::codeGen(CodeGenContext& context)
 {
 	Function *function = context.module->getFunction(id->name.c_str());
 	if (function == NULL) {
-		std::cerr << "no such function " << id->name << endl;	
+		cout << "Call to unknown function " << id->name << "\n";
+		exit(-1);
 	}
 	std::vector<Value*> args;
+	std::vector<NRef*> outputs;
 	NodeList::const_iterator it;
+	Function::arg_iterator AI = function->arg_begin();
+	int n = outputsOf(this,function);
 	for (it = arguments->begin(); it != arguments->end(); it++) {
-		args.push_back((**it).codeGen(context));
+		if(n-- > 0){
+			outputs.push_back((NRef*)*it);
+			continue;
+		}
+		Value *arg = (**it).codeGen(context);
+		//Scalars take the type of the parameter
+		if(arg->getType() != AI->getType() && !AI->getType()->isPointerTy())
+			arg = convert(arg, *(*it)->GetType(context.localTypes()).begin(), typeOf(AI->getType()), context.currentBlock());
+		args.push_back(arg);
+		AI++;
 	}
 	CallInst *call = CallInst::Create(function, makeArrayRef(args), "", context.currentBlock());
+	//Calls from the kernels that do most of the work are worth inlining
+	if(profile && profile->Hot(context.currentBlock()->getParent()->getName()))
+		function->addFnAttr(Attribute::InlineHint);
+
+	for(unsigned i=0; i < outputs.size(); i++){
+		Value *val = call;
+		if(outputs.size() > 1)
+			val = ExtractValueInst::Create(call, ArrayRef<unsigned>(i), "", context.currentBlock());
+		GType to = *outputs[i]->exp->GetType(context.localTypes()).begin();
+		to.isPointer = 0;
+		assign(outputs[i]->exp->name, convert(val, typeOf(val->getType()), to, context.currentBlock()), context);
+	}
 	std::cout << "Creating method call: " << id->name << endl;
 	return call;
 }
 
+Value* NCast::codeGen(CodeGenContext& context)
+{
+	std::cout << "Creating cast to " << type->name << endl;
+	GType from = *exp->GetType(context.localTypes()).begin();
+	Value *val = exp->codeGen(context);
+	return convert(val, from, *GetType(context.localTypes()).begin(), context.currentBlock());
+}
+
 int isCmp(int op){
 	//TODO: more comparison
 	switch(op){
@@ -183,22 +286,17 @@ int isCmp(int op){
 	}
 }
 
+//Both operands converted to the type they meet at
 void Promote(Value **lhc, Value** rhc, Node *lhs, Node *rhs,CodeGenContext& context){
 	GType ltype = *lhs->GetType(context.localTypes()).begin();
 	GType rtype = *rhs->GetType(context.localTypes()).begin();
+	GType type = *promoteType(GTypeList{ltype},GTypeList{rtype}).begin();
 
+	//Operands may end in a block other than the one they started in, a gather checks its index
 	*lhc = lhs->codeGen(context);
+	*lhc = convert(*lhc,ltype,type,context.currentBlock());
 	*rhc = rhs->codeGen(context);
-
-	if(ltype.type == FLOAT_TYPE || rtype.type == FLOAT_TYPE){
-		if(rtype.type != FLOAT_TYPE){
-			*rhc = new SIToFPInst(*rhc,typeOf(ltype),"", context.currentBlock());
-		}
-
-		if(ltype.type != FLOAT_TYPE){
-			*lhc = new SIToFPInst(*lhc,typeOf(rtype),"", context.currentBlock());
-		}
-	}
+	*rhc = convert(*rhc,rtype,type,context.currentBlock());
 }
 
 Value* NBinaryOperator::codeGen(CodeGenContext& context)
@@ -209,13 +307,12 @@ Value* NBinaryOperator::codeGen(CodeGenContext& context)
 
 	Value *lhc, *rhc;
 
-	GType ltype = *lhs->GetType(context.localTypes()).begin();
-	GType rtype = *rhs->GetType(context.localTypes()).begin();
+	GType type = *promoteType(lhs->GetType(context.localTypes()),rhs->GetType(context.localTypes())).begin();
+	bool isUnsigned = type.type == UINT_TYPE || type.type == BOOL_TYPE;
 
 	Promote(&lhc,&rhc,lhs,rhs,context);
 
-	//TODO: argument promotion
-	if(ltype.type == FLOAT_TYPE || rtype.type == FLOAT_TYPE){
+	if(type.type == FLOAT_TYPE){
 		switch (op) {
 			case TPLUS: instr = Instruction::FAdd; break;
 			case TMINUS: instr = Instruction::FSub; break;
@@ -241,15 +338,15 @@ Value* NBinaryOperator::codeGen(CodeGenContext& context)
 			case TPLUS: instr = Instruction::Add; break;
 			case TMINUS: instr = Instruction::Sub; break;
 			case TMUL: instr = Instruction::Mul; break;
-			case TDIV: instr = Instruction::SDiv; break;
+			case TDIV: instr = isUnsigned ? Instruction::UDiv : Instruction::SDiv; break;
 			case TOR: instr = Instruction::Or; break;
 			case TAND: instr = Instruction::And; break;
 			case TLSL: instr = Instruction::Shl; break;
 			case TLSR: instr = Instruction::LShr; break;
-			case TCGT: pred = CmpInst::Predicate::ICMP_SGT; break;
-			case TCLT: pred = CmpInst::Predicate::ICMP_SLT; break;
-			case TCGE: pred = CmpInst::Predicate::ICMP_SGE; break;
-			case TCLE: pred = CmpInst::Predicate::ICMP_SLE; break;
+			case TCGT: pred = isUnsigned ? CmpInst::Predicate::ICMP_UGT : CmpInst::Predicate::ICMP_SGT; break;
+			case TCLT: pred = isUnsigned ? CmpInst::Predicate::ICMP_ULT : CmpInst::Predicate::ICMP_SLT; break;
+			case TCGE: pred = isUnsigned ? CmpInst::Predicate::ICMP_UGE : CmpInst::Predicate::ICMP_SGE; break;
+			case TCLE: pred = isUnsigned ? CmpInst::Predicate::ICMP_ULE : CmpInst::Predicate::ICMP_SLE; break;
 			case TCEQ: pred = CmpInst::Predicate::ICMP_EQ; break;
 			case TCNE: pred = CmpInst::Predicate::ICMP_NE; break;
 			default: cout << "Unknown op\n"; return 0;
@@ -263,44 +360,264 @@ Value* NBinaryOperator::codeGen(CodeGenContext& context)
 	}
 }
 
-Value* GetIntZero(){
-	return ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0, true);
+Value* NUnaryOperator::codeGen(CodeGenContext& context)
+{
+	std::cout << "Creating unary operation " << op << endl;
+	GType from = *exp->GetType(context.localTypes()).begin();
+	GType type = *GetType(context.localTypes()).begin();
+	Value *val = exp->codeGen(context);
+	val = convert(val, from, type, context.currentBlock());
+	if(type.type == FLOAT_TYPE)
+		return BinaryOperator::CreateFNeg(val, "", context.currentBlock());
+	return BinaryOperator::CreateNeg(val, "", context.currentBlock());
+}
+
+static Value *truth(Node *pred, CodeGenContext& context){
+	GType ptype = *pred->GetType(context.localTypes()).begin();
+	Value *val = pred->codeGen(context);
+	return convert(val, ptype, GType(BOOL_TYPE,1,0), context.currentBlock());
+}
+
+//One arm of a branching select, converted like Promote does. Leaves the current block jumping to done
+static Value *selectArm(Node *arm, GType to, BasicBlock *block, BasicBlock *done, BasicBlock **end, CodeGenContext& context){
+	context.setCurrentBlock(block);
+	GType type = *arm->GetType(context.localTypes()).begin();
+	Value *val = arm->codeGen(context);
+	val = convert(val, type, to, context.currentBlock());
+	//Nested selects may have moved on to a block of their own
+	*end = context.currentBlock();
+	BranchInst::Create(done, *end);
+	return val;
+}
+
+//Rough cycle counts, only good enough to tell an arm worth branching around from one that isn't
+#define COST_OP		1
+#define COST_DIV	20
+#define COST_LOAD	4
+//Work a branch has to skip on average to pay for itself, mispredictions included
+#define BRANCH_COST	12
+
+static int cost(Node *node){
+	NBinaryOperator *binop = dynamic_cast<NBinaryOperator*>(node);
+	NUnaryOperator *unary = dynamic_cast<NUnaryOperator*>(node);
+	NSelect *select = dynamic_cast<NSelect*>(node);
+	NArrayRef *ref = dynamic_cast<NArrayRef*>(node);
+	if(binop)
+		return cost(binop->lhs) + cost(binop->rhs) + (binop->op == TDIV ? COST_DIV : COST_OP);
+	if(unary)
+		return cost(unary->exp) + COST_OP;
+	if(select)
+		return cost(select->pred) + COST_OP + max(cost(select->yes), cost(select->no));
+	if(ref)
+		return COST_LOAD;
+	if(dynamic_cast<NIdentifier*>(node) || dynamic_cast<NInteger*>(node) || dynamic_cast<NDouble*>(node))
+		return 0;
+	return COST_OP;
 }
 
-Value* GetFloatZero(){
-	return ConstantFP::get(Type::getDoubleTy(getGlobalContext()), 0);
+//Whether to compute only the arm that is taken instead of both of them
+static bool branches(NSelect *select, double bias){
+	//When the profile says nearly every element goes one way, the other arm is hardly ever computed
+	if(bias >= 0 && (bias >= PROFILE_BIASED || bias <= 1 - PROFILE_BIASED))
+		return true;
+#ifdef FOR_NV
+	//Lanes of a warp that disagree run both arms anyway, so only a biased select gains from a branch
+	return false;
+#else
+	//Otherwise each element skips one of the arms, without a profile assume either one as often
+	double yes = bias >= 0 ? bias : 0.5;
+	return yes * cost(select->no) + (1 - yes) * cost(select->yes) > BRANCH_COST;
+#endif
 }
 
 Value* NSelect::codeGen(CodeGenContext& context)
 {
 	std::cout << "Creating if operation " << endl;
+
+	double bias = profile ? profile->Bias(context.selectIds[this]) : -1;
+	if(branches(this,bias)){
+		GType type = *GetType(context.localTypes()).begin();
+		Value *predv = truth(pred,context);
+
+		Function *func = context.currentBlock()->getParent();
+		BasicBlock *yesBlock = BasicBlock::Create(getGlobalContext(), "select.yes", func);
+		BasicBlock *noBlock = BasicBlock::Create(getGlobalContext(), "select.no", func);
+		BasicBlock *done = BasicBlock::Create(getGlobalContext(), "select.done", func);
+		BranchInst *br = BranchInst::Create(yesBlock, noBlock, predv, context.currentBlock());
+		if(bias >= 0){
+			MDBuilder md(getGlobalContext());
+			br->setMetadata(LLVMContext::MD_prof, md.createBranchWeights((uint32_t)(1 + bias * 1000), (uint32_t)(1 + (1 - bias) * 1000)));
+		}
+
+		BasicBlock *yesEnd, *noEnd;
+		Value *lhc = selectArm(yes,type,yesBlock,done,&yesEnd,context);
+		Value *rhc = selectArm(no,type,noBlock,done,&noEnd,context);
+
+		context.setCurrentBlock(done);
+		PHINode *phi = PHINode::Create(lhc->getType(), 2, "", done);
+		phi->addIncoming(lhc, yesEnd);
+		phi->addIncoming(rhc, noEnd);
+		return phi;
+	}
 	
 	Value *lhc, *rhc;
 
 	Promote(&lhc,&rhc,yes,no,context);
-
-	GType ptype = *pred->GetType(context.localTypes()).begin();
-	Value* predv = pred->codeGen(context);
-	if(ptype.type == INT_TYPE){
-		predv = new ICmpInst(*context.currentBlock(),CmpInst::Predicate::ICMP_NE,predv,GetIntZero());
-	}
-	if(ptype.type == FLOAT_TYPE){
-		predv = new FCmpInst(*context.currentBlock(),CmpInst::Predicate::FCMP_ONE,predv,GetFloatZero());
-	}	
+	Value* predv = truth(pred,context);
 	
 	return SelectInst::Create(predv, lhc, rhc, "", context.currentBlock());
 }
 
+//block as a scope of its own starting at start, tail generated at its end. Leaves the block it
+//finishes in jumping to next, returns that jump
+static BranchInst *scoped(NBlock *block, BasicBlock *start, BasicBlock *next, Node *tail, CodeGenContext& context){
+	context.pushBlock(start);
+	block->codeGen(context);
+	if(tail)
+		tail->codeGen(context);
+	BranchInst *jump = BranchInst::Create(next, context.currentBlock());
+	context.popBlock();
+	return jump;
+}
+
+//Self referencing llvm.loop node with the vector width asked for and the number of the hint, so the
+//loop can still be found once it has been inlined and optimized
+static MDNode *loopId(int hint, int vectorize){
+	LLVMContext &ctx = getGlobalContext();
+	vector<Value*> ops;
+	MDNode *temp = MDNode::getTemporary(ctx, ArrayRef<Value*>());
+	ops.push_back(temp);
+	Value *tag[] = { MDString::get(ctx, "gpl.loop"), ConstantInt::get(Type::getInt32Ty(ctx), hint) };
+	ops.push_back(MDNode::get(ctx, tag));
+	if(vectorize){
+		Value *width[] = { MDString::get(ctx, "llvm.vectorizer.width"), ConstantInt::get(Type::getInt32Ty(ctx), vectorize) };
+		ops.push_back(MDNode::get(ctx, width));
+	}
+	MDNode *id = MDNode::get(ctx, ops);
+	id->replaceOperandWith(0, id);
+	MDNode::deleteTemporary(temp);
+	return id;
+}
+
+Value* NIf::codeGen(CodeGenContext& context)
+{
+	std::cout << "Creating if statement" << endl;
+	Value *condv = truth(cond,context);
+
+	Function *func = context.currentBlock()->getParent();
+	BasicBlock *thenBlock = BasicBlock::Create(getGlobalContext(), "if.then", func);
+	BasicBlock *elseBlock = otherwise ? BasicBlock::Create(getGlobalContext(), "if.else", func) : 0;
+	BasicBlock *done = BasicBlock::Create(getGlobalContext(), "if.done", func);
+	BranchInst::Create(thenBlock, elseBlock ? elseBlock : done, condv, context.currentBlock());
+
+	scoped(then, thenBlock, done, 0, context);
+	if(otherwise)
+		scoped(otherwise, elseBlock, done, 0, context);
+	context.setCurrentBlock(done);
+	return 0;
+}
+
+Value* NLoop::codeGen(CodeGenContext& context)
+{
+	std::cout << "Creating for loop" << endl;
+	//The counter is only visible inside the loop
+	context.pushBlock(context.currentBlock());
+	init->codeGen(context);
+
+	Function *func = context.currentBlock()->getParent();
+	BasicBlock *test = BasicBlock::Create(getGlobalContext(), "for.test", func);
+	BasicBlock *body = BasicBlock::Create(getGlobalContext(), "for.body", func);
+	BasicBlock *done = BasicBlock::Create(getGlobalContext(), "for.done", func);
+	BranchInst::Create(test, context.currentBlock());
+
+	context.setCurrentBlock(test);
+	Value *condv = truth(cond,context);
+	BranchInst::Create(body, done, condv, context.currentBlock());
+	//unroll(n) puts n copies of the body in each trip, all but the last followed by a test of their own.
+	//Those fold away when the trip count is known
+	for(int i=1; i < unroll; i++){
+		BasicBlock *next = BasicBlock::Create(getGlobalContext(), "for.test", func, done);
+		scoped(block, body, next, step, context);
+		body = BasicBlock::Create(getGlobalContext(), "for.body", func, done);
+		context.setCurrentBlock(next);
+		condv = truth(cond,context);
+		BranchInst::Create(body, done, condv, context.currentBlock());
+	}
+	BranchInst *latch = scoped(block, body, test, step, context);
+	if(unroll || vectorize){
+		context.loopHints.push_back(LoopHint(func->getName(), unroll, vectorize));
+		latch->setMetadata("llvm.loop", loopId(context.loopHints.size() - 1, vectorize));
+	}
+
+	context.popBlock();
+	context.setCurrentBlock(done);
+	return 0;
+}
+
+//Says for every hinted loop whether it was honored. The unrolling is done above so always happens, a
+//loop the vectorizer took is marked by it with a width of 1 so it is not vectorized twice. Call once
+//the module has been optimized
+void report_loop_hints(CodeGenContext& context){
+	vector<int> seen(context.loopHints.size()), vectorized(context.loopHints.size());
+	for(Module::iterator F = context.module->begin(); F != context.module->end(); F++){
+		for(Function::iterator B = F->begin(); B != F->end(); B++){
+			MDNode *id = B->getTerminator() ? B->getTerminator()->getMetadata("llvm.loop") : 0;
+			if(!id)
+				continue;
+			int hint = -1, done = 0;
+			for(unsigned i=1; i < id->getNumOperands(); i++){
+				MDNode *op = dyn_cast<MDNode>(id->getOperand(i));
+				MDString *name = op && op->getNumOperands() == 2 ? dyn_cast<MDString>(op->getOperand(0)) : 0;
+				ConstantInt *val = name ? dyn_cast<ConstantInt>(op->getOperand(1)) : 0;
+				if(!val)
+					continue;
+				if(name->getString() == "gpl.loop")
+					hint = val->getZExtValue();
+				if(name->getString() == "llvm.vectorizer.width" && val->getZExtValue() == 1)
+					done = 1;
+			}
+			if(hint < 0 || hint >= (int)seen.size())
+				continue;
+			seen[hint] = 1;
+			vectorized[hint] |= done;
+		}
+	}
+
+	for(unsigned i=0; i < context.loopHints.size(); i++){
+		LoopHint &hint = context.loopHints[i];
+		cout << "Loop " << i << " in " << hint.function << ":";
+		if(hint.unroll)
+			cout << " unrolled " << hint.unroll << " times";
+		if(hint.vectorize > 1 && !seen[i])
+			cout << " no loop left to vectorize " << hint.vectorize << " wide";
+		else if(hint.vectorize > 1 && vectorized[i])
+			cout << " vectorized " << hint.vectorize << " wide";
+		else if(hint.vectorize > 1)
+			cout << " NOT vectorized " << hint.vectorize << " wide";
+		else if(hint.vectorize)
+			cout << " kept scalar";
+		cout << "\n";
+	}
+}
+
+//rhs converted to the type of whatever it is assigned to
+static Value *assigned(Node *rhs, GType to, CodeGenContext& context){
+	GType from = *rhs->GetType(context.localTypes()).begin();
+	to.isArray = to.isPointer = 0;
+	Value *val = rhs->codeGen(context);
+	return convert(val, from, to, context.currentBlock());
+}
+
 Value* NAssignment::codeGen(CodeGenContext& context)
 {
 	//TODO: this is probably all wrong to, but we must see how the tree is transformed
 	if(array){
-		return array->store(context,rhs->codeGen(context));
+		return array->store(context,assigned(rhs,*array->GetType(context.localTypes()).begin(),context));
 	}
 	NIdentifier *id = *(lhs->begin());
 	std::cout << "Creating assignment for " << id->name << endl;
 
-	if (context.locals().find(id->name) == context.locals().end()) {
+	if (!declared(id->name,context)) {
 		std::cerr << "undeclared variable " << id->name << endl;
 		exit(-1);
 		return NULL;
@@ -309,14 +626,8 @@ Value* NAssignment::codeGen(CodeGenContext& context)
 		cout << "No returns!\n";
 		exit(-1);
 	}
-	Value* dst;
-	if((*(context.localTypes()[id->name]).begin()).isPointer){
-		cout << "Indirect assignment\n";
-		dst = new LoadInst(context.locals()[id->name], "", false, context.currentBlock());
-	}else{
-		dst = context.locals()[id->name];
-	}
-	return new StoreInst(rhs->codeGen(context), dst, false, context.currentBlock());
+	GType type = *context.localTypes()[id->name].begin();
+	return assign(id->name, assigned(rhs,type,context), context);
 }
 
 Value* NBlock::codeGen(CodeGenContext& context)
@@ -341,12 +652,23 @@ Value* NBlock::declGen(CodeGenContext& context)
 	return last;
 }
 
+//Stack slot for a local that can't be a register
+static Value *slot(const string &name, Type *type, CodeGenContext& context){
+	//Allocas stay in the entry block, where mem2reg looks for them, even once selects have branched
+	BasicBlock &entry = context.currentBlock()->getParent()->getEntryBlock();
+	Value *alloc = entry.empty() ? new AllocaInst(type, name.c_str(), &entry) :
+				new AllocaInst(type, name.c_str(), entry.begin());
+	context.locals()[name] = alloc;
+	return alloc;
+}
+
 Value* NVariableDeclaration::codeGen(CodeGenContext& context)
 {
 	std::cout << "Creating variable declaration " << (*types->begin())->name << " " << id->name << endl;
-	AllocaInst *alloc = new AllocaInst(typeOf(*types->begin()), id->name.c_str(), context.currentBlock());
-	context.locals()[id->name] = alloc;
 	context.localTypes()[id->name] = GetType(context.localTypes());
+	Value *alloc = 0;
+	if(!context.registers().count(id->name))
+		alloc = slot(id->name, typeOf(*types->begin()), context);
 	//cout << context.locals()[id->name]->type.length;
 	if (assignmentExpr != NULL) {
 		IdList *idlist = new IdList();
@@ -357,32 +679,95 @@ Value* NVariableDeclaration::codeGen(CodeGenContext& context)
 	return alloc;
 }
 
+//Address of array[index]. When both are arguments, as they are for every access a kernel makes at
+//idx, the pointer is computed once at the end of the entry block and shared by all the accesses
+//Gathers and scatters stop the program on an index outside the array instead of touching memory past
+//it. The length is the argument add_bounds gave the kernel. There is nothing to report to on the device,
+//the kernel traps
+static void checkIndex(NArrayRef *ref, Value *idx, CodeGenContext& context){
+	LLVMContext &ctx = getGlobalContext();
+	string bound = ref->name + ".size";
+	GType from = *ref->index->GetType(context.localTypes()).begin();
+	GType wide(INT_TYPE,64,0);
+	Value *size = convert(valueOf(bound,context), *context.localTypes()[bound].begin(), wide, context.currentBlock());
+	//Compared at 64 bits, where negative indices come out huge unsigned
+	idx = convert(idx, from, wide, context.currentBlock());
+	Value *bad = new ICmpInst(*context.currentBlock(), CmpInst::Predicate::ICMP_UGE, idx, size, "");
+
+	Function *func = context.currentBlock()->getParent();
+	BasicBlock *fail = BasicBlock::Create(ctx, "index.bad", func);
+	BasicBlock *ok = BasicBlock::Create(ctx, "index.ok", func);
+	BranchInst *br = BranchInst::Create(fail, ok, bad, context.currentBlock());
+	MDBuilder md(ctx);
+	br->setMetadata(LLVMContext::MD_prof, md.createBranchWeights(1, 1000000));
+#ifdef FOR_NV
+	CallInst::Create(Intrinsic::getDeclaration(context.module, Intrinsic::trap), "", fail);
+#else
+	Type *i64 = typeOf(wide);
+	Function *error = context.module->getFunction("gpl_index_error");
+	if(!error){
+		vector<Type*> types{Type::getInt8PtrTy(ctx), i64, i64};
+		error = Function::Create(FunctionType::get(Type::getVoidTy(ctx), makeArrayRef(types), false),
+					GlobalValue::ExternalLinkage, "gpl_index_error", context.module);
+		error->setDoesNotReturn();
+	}
+	Constant *data = ConstantDataArray::getString(ctx, ref->name);
+	GlobalVariable *var = new GlobalVariable(*context.module, data->getType(), true, GlobalValue::PrivateLinkage, data, ".str");
+	Constant *zero = ConstantInt::get(Type::getInt32Ty(ctx), 0);
+	Constant *first[] = {zero, zero};
+	vector<Value*> args{ConstantExpr::getGetElementPtr(var, first), idx, size};
+	CallInst::Create(error, makeArrayRef(args), "", fail);
+#endif
+	new UnreachableInst(ctx, fail);
+	context.setCurrentBlock(ok);
+}
+
+static Value *element(NArrayRef *ref, CodeGenContext& context){
+	string key = ref->name + "[" + ref->index->name + "]";
+	if(context.elements().find(key) != context.elements().end())
+		return context.elements()[key];
+
+	Value* idx = valueOf(ref->index->name,context);
+	Value* ptr = valueOf(ref->name,context);
+	//Checked every time, never shared
+	if(ref->index->name != "idx" && declared(ref->name + ".size",context)){
+		checkIndex(ref,idx,context);
+		return GetElementPtrInst::Create(ptr, ArrayRef<Value*>(idx), "", context.currentBlock());
+	}
+	if(!isa<Argument>(idx) || !isa<Argument>(ptr))
+		return GetElementPtrInst::Create(ptr, ArrayRef<Value*>(idx), "", context.currentBlock());
+
+	BasicBlock &entry = context.currentBlock()->getParent()->getEntryBlock();
+	Value *gep = entry.getTerminator() ? GetElementPtrInst::Create(ptr, ArrayRef<Value*>(idx), key, entry.getTerminator()) :
+				GetElementPtrInst::Create(ptr, ArrayRef<Value*>(idx), key, &entry);
+	context.elements()[key] = gep;
+	return gep;
+}
+
+//Takes every array node stores an element of out of names
+static void stored_arrays(Node *node, set<string> &names){
+	NAssignment *assn = dynamic_cast<NAssignment*>(node);
+	if(assn && assn->array)
+		names.erase(assn->array->name);
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		stored_arrays(*it,names);
+}
+
 Value* NArrayRef::codeGen(CodeGenContext& context)
 {
 	std::cout << "Creating array reference " << name << " " << index->name << endl;
-
-	/*std::map<std::string, Value*>::iterator it;
-	for(it = context.locals().begin(); it!= context.locals().end(); it++){
-		std::cout << (*it).first << " " << (*it).second << "\n";
-	}*/
-
-	Value* idx = new LoadInst(context.locals()[index->name], "", false, context.currentBlock());
-	Value* ptr = new LoadInst(context.locals()[name], "", false, context.currentBlock());
-	Value* gep = GetElementPtrInst::Create(ptr, ArrayRef<Value*>(idx), "", context.currentBlock());
-	//cout << "Generated\n";
-//	Value* ld1 = new LoadInst(gep, "", false, context.currentBlock());
-	return new LoadInst(gep, "", false, context.currentBlock());
+	Value *ptr = element(this,context);
+	LoadInst *load = new LoadInst(ptr, "", false, context.currentBlock());
+	//Nothing writes an input while the kernel reading it runs, so it reads the same wherever it is loaded
+	if(context.invariants.count(name))
+		load->setMetadata("invariant.load", MDNode::get(getGlobalContext(), ArrayRef<Value*>()));
+	return load;
 }
 
 Value* NArrayRef::store(CodeGenContext& context, Value* rhs){
 	std::cout << "Creating array store " << name << " " << index->name << endl;
-
-	Value* idx = new LoadInst(context.locals()[index->name], "", false, context.currentBlock());
-	Value* ptr = new LoadInst(context.locals()[name], "", false, context.currentBlock());
-	Value* gep = GetElementPtrInst::Create(ptr, ArrayRef<Value*>(idx), "", context.currentBlock());
-	//cout << "Generated\n";
-//	Value* ld1 = new LoadInst(gep, "", false, context.currentBlock());
-	return new StoreInst(rhs,gep, "", false, context.currentBlock());
+	Value *ptr = element(this,context);
+	return new StoreInst(rhs, ptr, "", false, context.currentBlock());
 }
 
 void addKernelMetadata(llvm::Function *F) {
@@ -401,51 +786,185 @@ void addKernelMetadata(llvm::Function *F) {
   // Append metadata to nvvm.annotations
   MD->addOperand(llvm::MDNode::get(Ctx, MDVals));
 }
+
+//rewrite_arrays turned the returns into leading pointer arguments. Scalar functions hand them back
+//as their return value instead, one value or a struct of all of them, so they stay in registers.
+//Kernels keep the pointers, the launchers store through those
+static int outputsOf(NFunctionDeclaration *decl){
+	if(!decl->isScalar())
+		return 0;
+	int n=0;
+	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end() && (*(*it)->types->begin())->isPointer; it++)
+		n++;
+	return n;
+}
+
+//Type of an output as a value rather than the pointer it is declared as
+static GType valueType(NVariableDeclaration *var){
+	GType type = *((Node*)*var->types->begin())->GetType().begin();
+	type.isPointer = 0;
+	return type;
+}
  
 Value* NFunctionDeclaration::declGen(CodeGenContext& context){
-	vector<Type*> argTypes;
+	vector<Type*> argTypes, retTypes;
 	VariableList::const_iterator it;
-	for (it = arguments->begin(); it != arguments->end(); it++) {
-		argTypes.push_back(typeOf(*(*it)->types->begin()));
+	int outputs = outputsOf(this), n=0;
+	for (it = arguments->begin(); it != arguments->end(); it++, n++) {
+		if(n < outputs)
+			retTypes.push_back(typeOf(valueType(*it)));
+		else
+			argTypes.push_back(typeOf(*(*it)->types->begin()));
 	}
 
-	FunctionType *ftype = FunctionType::get(typeOf(returns->front()), makeArrayRef(argTypes), false);
+	Type *ret = Type::getVoidTy(getGlobalContext());
+	if(retTypes.size() == 1)
+		ret = retTypes[0];
+	else if(retTypes.size() > 1)
+		ret = StructType::get(getGlobalContext(), makeArrayRef(retTypes));
+
+	FunctionType *ftype = FunctionType::get(ret, makeArrayRef(argTypes), false);
 	Function *function = Function::Create(ftype, (isGenerated||isScalar())?GlobalValue::InternalLinkage:GlobalValue::ExternalLinkage, id->name.c_str(), context.module);
 	addKernelMetadata(function);
 
+	//Pipeline buffers are distinct allocations and the outputs of a function are distinct locals of its
+	//caller, so no two pointers overlap and none of them outlives the call
+	int i=1;
+	n=0;
+	for (it = arguments->begin(); it != arguments->end(); it++, n++) {
+		if(n < outputs)
+			continue;
+		NType *type = *(*it)->types->begin();
+		if(type->isArray || type->isPointer){
+			function->addAttribute(i, Attribute::NoAlias);
+			function->addAttribute(i, Attribute::NoCapture);
+		}
+		i++;
+	}
+
 	return function;
 }
 
+static void addressed(Node *node, set<string> &names){
+	NRef *ref = dynamic_cast<NRef*>(node);
+	if(ref)
+		names.insert(ref->exp->name);
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		addressed(*it, names);
+}
+
+//to_ssa leaves most locals assigned once, those need no stack slot as long as their address is never
+//taken. Pointers to the outputs are never assigned themselves, only stored through. Outputs a call
+//returns count as assignments, their address is never really taken
+static void find_registers(NFunctionDeclaration *decl, CodeGenContext& context){
+	map<string,int> assigned;
+	set<string> pointers, refs;
+	int outputs = outputsOf(decl), n=0;
+	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++, n++){
+		if(n < outputs){
+			assigned[(*it)->id->name] = 0;
+			continue;
+		}
+		assigned[(*it)->id->name] = 1;
+		if((*(*it)->types->begin())->isPointer)
+			pointers.insert((*it)->id->name);
+	}
+	//Whatever an if or for assigns needs a slot, mem2reg builds the phis
+	set<string> mutated;
+	mutated_names(decl->block,mutated);
+	for(set<string>::iterator it = mutated.begin(); it != mutated.end(); it++)
+		assigned[*it] += 2;
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it);
+		NAssignment *assn = dynamic_cast<NAssignment*>(*it);
+		NMethodCall *call = dynamic_cast<NMethodCall*>(*it);
+		if(vdec)
+			assigned[vdec->id->name] += vdec->assignmentExpr ? 1 : 0;
+		if(assn && !assn->array){
+			for(IdList::iterator it2 = assn->lhs->begin(); it2 != assn->lhs->end(); it2++)
+				assigned[(*it2)->name]++;
+		}
+		if(call){
+			int returned = outputsOf(call, context.module->getFunction(call->id->name));
+			for(NodeList::iterator it2 = call->arguments->begin(); it2 != call->arguments->end(); it2++){
+				if(returned-- > 0)
+					assigned[((NRef*)*it2)->exp->name]++;
+				else
+					addressed(*it2, refs);
+			}
+			continue;
+		}
+		addressed(*it, refs);
+	}
+	for(map<string,int>::iterator it = assigned.begin(); it != assigned.end(); it++){
+		if(pointers.count(it->first) || (it->second <= 1 && !refs.count(it->first)))
+			context.registers().insert(it->first);
+	}
+}
+
 Value* NFunctionDeclaration::codeGen(CodeGenContext& context)
 {
 	VariableList::const_iterator it;
 	Function *function = context.module->getFunction(id->name.c_str());
 	if (function == NULL) {
-		std::cerr << "no such function " << id->name << endl;	
+		cout << "No prototype generated for function " << id->name << "\n";
+		exit(-1);
 	}
 
 	BasicBlock *bblock = BasicBlock::Create(getGlobalContext(), "entry", function, 0);
 	context.pushBlock(bblock);
+	find_registers(this,context);
+	context.selectIds.clear();
+	number_selects(block,id->name,context.selectIds);
+	context.invariants.clear();
+	for(it = arguments->begin(); it != arguments->end(); it++){
+		if((*(*it)->types->begin())->isArray)
+			context.invariants.insert((*it)->id->name);
+	}
+	stored_arrays(block,context.invariants);
+	if(profile && profile->Cold(id->name))
+		function->addFnAttr(Attribute::Cold);
 
 	if(id->name == "main")
 		context.mainFunction = function;
 
   	// Set names for all arguments.
 	Function::arg_iterator AI;
-  	for (AI = function->arg_begin(), it = arguments->begin(); it != arguments->end(); ++AI, ++it) {
+	int outputs = outputsOf(this), n=0;
+  	for (AI = function->arg_begin(), it = arguments->begin(); it != arguments->end(); ++it, n++) {
 		const char* name = (*it)->id->name.c_str();
+		//Returned rather than passed, these are plain locals until the ret
+		if(n < outputs){
+			context.localTypes()[name] = GTypeList{valueType(*it)};
+			if(!context.registers().count(name))
+				slot(name, typeOf(valueType(*it)), context);
+			continue;
+		}
     		AI->setName(name);
 
     	// Add arguments to variable symbol table.
     	//		context.locals()[(*it)->id.name] = AI;
 
+		if(context.registers().count(name)){
+			context.localTypes()[name] = ((Node*)*it)->GetType(context.localTypes());
+			context.values()[name] = AI++;
+			continue;
+		}
 		(*it)->codeGen(context);
-		new StoreInst((Value*)AI, context.locals()[ (*it)->id->name], false, context.currentBlock());
+		new StoreInst((Value*)AI++, context.locals()[ (*it)->id->name], false, context.currentBlock());
   	}
 
 	block->codeGen(context);
-	if(returns->empty())
-		ReturnInst::Create(getGlobalContext(), bblock);
+	if(outputs == 1)
+		ReturnInst::Create(getGlobalContext(), valueOf(arguments->front()->id->name,context), context.currentBlock());
+	else if(outputs > 1){
+		Value *ret = UndefValue::get(function->getReturnType());
+		n=0;
+		for(it = arguments->begin(); n < outputs; it++, n++)
+			ret = InsertValueInst::Create(ret, valueOf((*it)->id->name,context), ArrayRef<unsigned>(n), "", context.currentBlock());
+		ReturnInst::Create(getGlobalContext(), ret, context.currentBlock());
+	}else
+		ReturnInst::Create(getGlobalContext(), context.currentBlock());
 
 	context.popBlock();
 	std::cout << "Creating function: " << id->name << endl;
@@ -18,6 +18,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 #include <stack>
+#include <set>
 #include <typeinfo>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Function.h>
@@ -42,27 +43,46 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 using namespace llvm;
 
+//FOR_NV compiles kernels for the GPU, otherwise they are for the host CPU. Set from the Makefile
+
 GTypeList GetType(NBlock *pb, Node *exp);
 TypeList typeOf(NFunctionDeclaration *decl, NIdentifier *var, int allowArray);
 TypeList typeOf(NFunctionDeclaration *decl, IdList vars, int allowArray);
 TypeList typeOf(string name, NBlock* pb);
 TypeList ntypesOf(GTypeList in, int allowArray);
+Type *typeOf(const NVariableDeclaration *decl);
 
 
 class NBlock;
+class RuntimePlan;
 
 class CodeGenBlock {
 public:
+	//A scope nested in parent sees everything declared there so far. What it declares itself is gone
+	//once it is popped
 	CodeGenBlock(CodeGenBlock *parent){
 		if(parent){
 			locals = parent->locals;
 			localTypes = parent->localTypes;
+			registers = parent->registers;
+			values = parent->values;
+			elements = parent->elements;
 		}
     	}
 
     	BasicBlock *block;
     	std::map<std::string, Value*> locals;
     	std::map<std::string, GTypeList> localTypes;
+    	std::set<std::string> registers; //locals held as SSA values, everything else gets a stack slot
+    	std::map<std::string, Value*> values; //current value of each register
+    	std::map<std::string, Value*> elements; //element pointers computed in the entry block, by array[index]
+};
+
+//What a for statement asked the optimizer for, so it can be told afterwards whether it happened
+struct LoopHint {
+	LoopHint(std::string function, int unroll, int vectorize) : function(function), unroll(unroll), vectorize(vectorize) {}
+	std::string function;
+	int unroll, vectorize;
 };
 
 class CodeGenContext {
@@ -71,7 +91,20 @@ class CodeGenContext {
 public:
     	Function *mainFunction;
     	Module *module;
-    	CodeGenContext() { module = new Module("main", getGlobalContext()); }
+    	Module *hostModule; //launchers, the same as module unless kernels run on a device
+    	std::vector<Function*> entryPoints; //what stays visible once everything is linked
+    	std::map<RuntimePlan*, Function*> launchers;
+    	std::map<NSelect*, std::string> selectIds; //profile names of the selects in the function being generated
+    	std::set<std::string> invariants; //array arguments the function being generated never stores to
+    	std::vector<LoopHint> loopHints; //by the number tagged onto the loop metadata
+    	CodeGenContext() { 
+		module = new Module("main", getGlobalContext()); 
+#ifdef FOR_NV
+		hostModule = new Module("host", getGlobalContext());
+#else
+		hostModule = module;
+#endif
+	}
 	~CodeGenContext() { 
 		while(!blocks.empty()){
 			CodeGenBlock *top = blocks.top();
@@ -85,7 +118,15 @@ public:
     	GenericValue runCode();
     	std::map<std::string, Value*>& locals() { return blocks.top()->locals; }
     	std::map<std::string, GTypeList>& localTypes() { return blocks.top()->localTypes; }
+    	std::set<std::string>& registers() { return blocks.top()->registers; }
+    	std::map<std::string, Value*>& values() { return blocks.top()->values; }
+    	std::map<std::string, Value*>& elements() { return blocks.top()->elements; }
     	BasicBlock *currentBlock() { return blocks.top()->block; }
+    	void setCurrentBlock(BasicBlock *block) { blocks.top()->block = block; }
     	void pushBlock(BasicBlock *block) { blocks.push(new CodeGenBlock(blocks.empty()?0:blocks.top())); blocks.top()->block = block; }
     	void popBlock() { CodeGenBlock *top = blocks.top(); blocks.pop(); delete top; }
 };
+
+void generate_launchers(CodeGenContext& context);
+void link_modules(CodeGenContext& context, std::vector<std::string>& files);
+void report_loop_hints(CodeGenContext& context);
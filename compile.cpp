@@ -35,43 +35,57 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
-#define FOR_NV
-
 #ifdef FOR_NV
 	#define TRIPLE "nvptx64-unknown-unknown"
 	#define MARCH "nvptx64"
+	#define MCPU "sm_20"
+	#define OUTPUT "out.ptx"
+	#define RELOC Reloc::Default
 #else
-#if 0
+	//Host assembly, linked with cpu/libgplrt.a into whatever calls the launchers. Position independent
+	//so it goes into a PIE or a shared library as well
 	#define TRIPLE "x86_64-unknown-linux-gnu"
 	#define MARCH "x86-64"
-#else
-	#define TRIPLE "cpp"
-	#define MARCH "cpp"
-#endif
+	#define MCPU ""
+	#define OUTPUT "out.s"
+	#define RELOC Reloc::PIC_
 #endif
 
+//Levels as given to -O, size is -Os. Rough trade-offs:
+//  O0  verify only, nothing is inlined. Fastest build, only for checking codegen
+//  O1  cheap scalar cleanup, no unrolling and a conservative inliner. Most of the runtime win for map chains
+//  O2  full function pipeline plus vectorization
+//  O3  as O2 with a larger inline budget and argument promotion, mostly helps long pipelines and deep calls.
+//      The default, everything was built at O3 before the level could be picked
+//  Os  O2 with a small inline budget and no unrolling, smallest ptx
 void AddOptimizationPasses(PassManagerBase &MPM, FunctionPassManager &FPM, unsigned OptLevel, unsigned SizeLevel) {
-    PassManagerBuilder Builder;
-    FPM.add(createVerifierPass());
-    Builder.OptLevel = OptLevel;
-    Builder.SizeLevel = SizeLevel;
-
-    Builder.Inliner = createAlwaysInlinerPass();
-    Builder.DisableUnrollLoops = OptLevel == 0;
-    Builder.populateFunctionPassManager(FPM);
-    Builder.populateModulePassManager(MPM);
-
+	PassManagerBuilder Builder;
+	FPM.add(createVerifierPass());
+	Builder.OptLevel = OptLevel;
+	Builder.SizeLevel = SizeLevel;
+
+	if(OptLevel == 0)
+		Builder.Inliner = createAlwaysInlinerPass();
+	else if(SizeLevel)
+		Builder.Inliner = createFunctionInliningPass(75);
+	else
+		Builder.Inliner = createFunctionInliningPass(OptLevel > 2 ? 275 : 225);
+	Builder.DisableUnrollLoops = OptLevel < 2 || SizeLevel;
+	Builder.LoopVectorize = OptLevel > 1 && !SizeLevel;
+	Builder.SLPVectorize = OptLevel > 1 && !SizeLevel;
+	Builder.populateFunctionPassManager(FPM);
+	Builder.populateModulePassManager(MPM);
 }
 
-static void AddStandardCompilePasses(PassManagerBase &PM) {
-    PM.add(createVerifierPass()); // Verify that input is correc
-    PassManagerBuilder Builder;
-    Builder.Inliner = createFunctionInliningPass();
-    Builder.OptLevel = 3;
-    Builder.populateModulePassManager(PM);
+//Runs the function passes over every definition in mod
+void RunFunctionPasses(Module &mod, FunctionPassManager &FPM){
+	FPM.doInitialization();
+	for (Module::iterator F = mod.begin(), E = mod.end(); F != E; ++F)
+		FPM.run(*F);
+	FPM.doFinalization();
 }
 
-void compile(Module &mod){
+void compile(Module &mod, int optLevel, int sizeLevel){
 	InitializeAllTargets();
   	InitializeAllTargetMCs();
   	InitializeAllAsmPrinters();
@@ -124,7 +138,7 @@ void compile(Module &mod){
     	if (Type != Triple::UnknownArch)
       		TheTriple.setArch(Type); 
 
-	std::string mcpu = "sm_20";
+	std::string mcpu = MCPU;
 	std::string FeaturesStr = "";
 
 
@@ -149,8 +163,9 @@ void compile(Module &mod){
 	std::auto_ptr<TargetMachine>
     		target(TheTarget->createTargetMachine(TheTriple.getTriple(),
                                           mcpu, FeaturesStr,
-                                          Options, Reloc::Default, CodeModel::Default,
-						CodeGenOpt::Aggressive));
+                                          Options, RELOC, CodeModel::Default,
+						optLevel == 0 ? CodeGenOpt::None : optLevel == 1 ? CodeGenOpt::Less :
+						optLevel == 2 ? CodeGenOpt::Default : CodeGenOpt::Aggressive));
 
  	assert(target.get() && "Could not allocate target machine!");
   	TargetMachine &Target = *target.get();
@@ -169,19 +184,10 @@ void compile(Module &mod){
   	}else
     		PM.add(new DataLayout(&mod));
 
-	AddStandardCompilePasses(PM);
-	PM.add( createFunctionInliningPass(275));
-
-   	FPM.doInitialization();
-    	for (Module::iterator F = mod.begin(), E = mod.end(); F != E; ++F)
-        	FPM.run(*F);
-    	FPM.doFinalization();
-
-
-    	AddOptimizationPasses(PM, FPM, 3, 0);
-    	PM.add(createVerifierPass());
-
-
+	//One pipeline for the requested level, function passes first so the module passes see clean IR
+	AddOptimizationPasses(PM, FPM, optLevel, sizeLevel);
+	PM.add(createVerifierPass());
+	RunFunctionPasses(mod, FPM);
 
 	// Override default to generate verbose assembly.
   	Target.setAsmVerbosityDefault(true);
@@ -191,7 +197,7 @@ void compile(Module &mod){
 
     		// Ask the target to add backend passes as necessary.
 		std::string error;
- 		tool_output_file *Out = new tool_output_file("out.ptx", error);
+ 		tool_output_file *Out = new tool_output_file(OUTPUT, error);
 		formatted_raw_ostream FOS(Out->os());
     		if (Target.addPassesToEmitFile(PM, FOS, FileType, false)) {
       				cout << ": target does not support generation of this file type!\n";
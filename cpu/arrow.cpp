@@ -0,0 +1,254 @@
+/* 
+GPiler - arrow.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+#include "arrow.h"
+
+using namespace std;
+
+static void *aligned_alloc64(size_t bytes){
+	void *p = 0;
+	//Arrow wants buffer sizes padded to the alignment as well
+	bytes = (bytes + ARROW_ALIGNMENT - 1) & ~(size_t)(ARROW_ALIGNMENT - 1);
+	if(posix_memalign(&p, ARROW_ALIGNMENT, bytes ? bytes : ARROW_ALIGNMENT)){
+		cout << "Out of memory allocating Arrow buffer\n";
+		exit(-1);
+	}
+	return p;
+}
+
+static inline bool get_bit(const uint8_t *bits, int64_t i){
+	return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+size_t ArrowBatch::ElemSize(const char *format){
+	if(!format || !format[0] || format[1]){
+		cout << "Only primitive Arrow columns are supported\n";
+		exit(-1);
+	}
+	switch(format[0]){
+		case 'c': case 'C': return 1;
+		case 's': case 'S': case 'e': return 2;
+		case 'i': case 'I': case 'f': return 4;
+		case 'l': case 'L': case 'g': return 8;
+		default:
+			cout << "Unsupported Arrow format: " << format << "\n";
+			exit(-1);
+	}
+	return 0;
+}
+
+ArrowBatch::~ArrowBatch(){
+	for(size_t i=0; i < inputs.size(); i++){
+		free(inputs[i].owned);
+		if(inputs[i].array.release)
+			inputs[i].array.release(&inputs[i].array);
+		if(inputs[i].schema.release)
+			inputs[i].schema.release(&inputs[i].schema);
+	}
+	for(size_t i=0; i < outputs.size(); i++)
+		free(outputs[i].owned);
+	free(validity);
+}
+
+void ArrowBatch::AddInput(struct ArrowArray *array, struct ArrowSchema *schema){
+	if(!array->release || !schema->release){
+		cout << "Arrow input was already released\n";
+		exit(-1);
+	}
+	Column col;
+	col.format = schema->format;
+	col.elemSize = ElemSize(schema->format);
+	col.owned = 0;
+	col.bitOffset = array->offset;
+	//A null_count of -1 means unknown, and the bitmap may be left out when nothing is null
+	col.validity = array->buffers[0] && array->null_count != 0 ? (const uint8_t*)array->buffers[0] : 0;
+
+	if(inputs.size() && (size_t)array->length != length){
+		cout << "Arrow columns have different lengths\n";
+		exit(-1);
+	}
+	length = array->length;
+
+	const char *values = (const char*)array->buffers[1] + array->offset * col.elemSize;
+	if((uintptr_t)values % ARROW_ALIGNMENT){
+		//Producers are supposed to align, but a sliced array can still start mid buffer
+		col.owned = aligned_alloc64(length * col.elemSize);
+		memcpy(col.owned, values, length * col.elemSize);
+		col.values = col.owned;
+	}else
+		col.values = (void*)values;
+
+	//Moved in, the caller's copies no longer own anything
+	col.array = *array;
+	col.schema = *schema;
+	array->release = 0;
+	schema->release = 0;
+	inputs.push_back(col);
+}
+
+void ArrowBatch::AddOutput(const char *format){
+	Column col;
+	col.format = format;
+	col.elemSize = ElemSize(format);
+	col.values = 0;
+	col.validity = 0;
+	col.bitOffset = 0;
+	col.owned = 0;
+	memset(&col.array, 0, sizeof(col.array));
+	memset(&col.schema, 0, sizeof(col.schema));
+	outputs.push_back(col);
+}
+
+//AND of every input validity bitmap, or 0 when nothing is null
+uint8_t *ArrowBatch::CombinedValidity(){
+	uint8_t *ret = 0;
+	size_t bytes = (length + 7) / 8;
+	for(size_t i=0; i < inputs.size(); i++){
+		const Column &col = inputs[i];
+		if(!col.validity)
+			continue;
+		if(!ret){
+			ret = (uint8_t*)aligned_alloc64(bytes);
+			memset(ret, 0xff, bytes);
+		}
+		if(col.bitOffset % 8 == 0){
+			const uint8_t *src = col.validity + col.bitOffset / 8;
+			for(size_t j=0; j < bytes; j++)
+				ret[j] &= src[j];
+		}else{
+			for(size_t j=0; j < length; j++){
+				if(!get_bit(col.validity, col.bitOffset + j))
+					ret[j >> 3] &= ~(1 << (j & 7));
+			}
+		}
+	}
+	return ret;
+}
+
+size_t ArrowBatch::Run(ChunkKernel kernel, void *user, int nullMode){
+	uint8_t *valid = CombinedValidity();
+
+	vector<void*> ins, outs;
+	size_t n = length;
+	if(valid && nullMode == ARROW_DROP_NULLS){
+		//Same thing filter does, compact the valid rows before the pipeline sees them
+		n = 0;
+		for(size_t j=0; j < length; j++)
+			n += get_bit(valid, j);
+		for(size_t i=0; i < inputs.size(); i++){
+			Column &col = inputs[i];
+			char *dst = (char*)aligned_alloc64(n * col.elemSize);
+			size_t k = 0;
+			for(size_t j=0; j < length; j++){
+				if(get_bit(valid, j))
+					memcpy(dst + (k++) * col.elemSize, (char*)col.values + j * col.elemSize, col.elemSize);
+			}
+			free(col.owned);
+			col.owned = dst;
+			col.values = dst;
+			col.validity = 0;
+		}
+		free(valid);
+		valid = 0;
+	}
+
+	for(size_t i=0; i < inputs.size(); i++)
+		ins.push_back(inputs[i].values);
+	for(size_t i=0; i < outputs.size(); i++){
+		free(outputs[i].owned);
+		outputs[i].owned = aligned_alloc64(n * outputs[i].elemSize);
+		outputs[i].values = outputs[i].owned;
+		outs.push_back(outputs[i].values);
+	}
+
+	rows = kernel(outs.data(), ins.data(), n, user);
+
+	if(valid && rows != n){
+		cout << "Pipeline filters rows, null rows can't be kept. Use ARROW_DROP_NULLS\n";
+		exit(-1);
+	}
+	free(validity);
+	validity = valid;
+	return rows;
+}
+
+struct ExportedColumn {
+	const void *buffers[2];
+};
+
+static void release_array(struct ArrowArray *array){
+	ExportedColumn *exp = (ExportedColumn*)array->private_data;
+	free((void*)exp->buffers[0]);
+	free((void*)exp->buffers[1]);
+	delete exp;
+	array->release = 0;
+}
+
+static void release_schema(struct ArrowSchema *schema){
+	schema->release = 0;
+}
+
+void ArrowBatch::ExportOutput(int i, struct ArrowArray *array, struct ArrowSchema *schema){
+	Column &col = outputs[i];
+	if(!col.owned){
+		cout << "Arrow output " << i << " was not computed or already exported\n";
+		exit(-1);
+	}
+
+	ExportedColumn *exp = new ExportedColumn();
+	exp->buffers[0] = 0;
+	exp->buffers[1] = col.owned;
+	col.owned = 0;
+
+	int64_t nulls = 0;
+	if(validity){
+		//Every output gets its own copy of the bitmap since each is released on its own
+		size_t bytes = (rows + 7) / 8;
+		uint8_t *bits = (uint8_t*)aligned_alloc64(bytes);
+		memcpy(bits, validity, bytes);
+		exp->buffers[0] = bits;
+		for(size_t j=0; j < rows; j++)
+			nulls += !get_bit(bits, j);
+	}
+
+	array->length = rows;
+	array->null_count = nulls;
+	array->offset = 0;
+	array->n_buffers = 2;
+	array->n_children = 0;
+	array->buffers = exp->buffers;
+	array->children = 0;
+	array->dictionary = 0;
+	array->release = release_array;
+	array->private_data = exp;
+
+	schema->format = col.format;
+	schema->name = "";
+	schema->metadata = 0;
+	schema->flags = ARROW_FLAG_NULLABLE;
+	schema->n_children = 0;
+	schema->children = 0;
+	schema->dictionary = 0;
+	schema->release = release_schema;
+	schema->private_data = 0;
+}
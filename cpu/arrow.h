@@ -0,0 +1,113 @@
+/* 
+GPiler - arrow.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef GPL_ARROW_H
+#define GPL_ARROW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "stream.h"
+
+//Arrow C data interface. The layout is fixed by the Arrow spec so we don't need the library,
+//the guard lets it coexist with arrow/c/abi.h
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	const char* format;
+	const char* name;
+	const char* metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema** children;
+	struct ArrowSchema* dictionary;
+	void (*release)(struct ArrowSchema*);
+	void* private_data;
+};
+
+struct ArrowArray {
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void** buffers;
+	struct ArrowArray** children;
+	struct ArrowArray* dictionary;
+	void (*release)(struct ArrowArray*);
+	void* private_data;
+};
+
+#endif
+
+#define ARROW_ALIGNMENT	64
+
+//What a null input slot means for the pipeline
+#define ARROW_KEEP_NULLS	0	//compute every slot, outputs carry the combined validity bitmap
+#define ARROW_DROP_NULLS	1	//null rows are filtered out, outputs are dense
+
+//Runs a chunk kernel over one Arrow record batch. Inputs are used in place whenever their
+//values buffer is 64 byte aligned, outputs are always allocated 64 byte aligned
+class ArrowBatch {
+public:
+	ArrowBatch() : length(0), validity(0), rows(0) {}
+	~ArrowBatch();
+
+	//Primitive columns only, signed "c", "s", "i", "l", unsigned "C", "S", "I", "L" or
+	//floating point "e", "f", "g". The pipeline's types have to match, nothing is converted.
+	//The batch takes both over the Arrow way: the caller's structs are marked released and the
+	//batch calls their release callbacks when it is destroyed
+	void AddInput(struct ArrowArray *array, struct ArrowSchema *schema);
+	void AddOutput(const char *format);
+
+	//kernel is the <target>_chunk the compiler generates, inputs and outputs in declaration order.
+	//Returns the number of rows in each output
+	size_t Run(ChunkKernel kernel, void *user, int nullMode);
+
+	//Hand output i over to the caller, who releases it the Arrow way
+	void ExportOutput(int i, struct ArrowArray *array, struct ArrowSchema *schema);
+
+private:
+	struct Column {
+		const char *format;
+		size_t elemSize;
+		void *values;
+		const uint8_t *validity;
+		int64_t bitOffset;
+		void *owned;	//scratch we allocated, if any
+		struct ArrowArray array;	//imported input, released with the batch
+		struct ArrowSchema schema;
+	};
+
+	static size_t ElemSize(const char *format);
+	uint8_t *CombinedValidity();
+
+	size_t length;
+	std::vector<Column> inputs, outputs;
+	uint8_t *validity;
+	size_t rows;
+};
+
+#endif
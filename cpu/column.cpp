@@ -0,0 +1,165 @@
+/* 
+GPiler - column.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "column.h"
+
+using namespace std;
+
+static size_t page_size(){
+	return sysconf(_SC_PAGESIZE);
+}
+
+//Bools are 1 bit, anything else a whole number of bytes
+static bool valid_length(int length){
+	return length == 1 || (length > 0 && length % 8 == 0);
+}
+
+void MappedColumn::Map(int hints){
+	int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	if(hints & COLUMN_POPULATE)
+		flags |= MAP_POPULATE;
+#endif
+	void *p = mmap(0, size, writable?(PROT_READ|PROT_WRITE):PROT_READ, flags, fd, 0);
+	if(p == MAP_FAILED){
+		cout << "Column mmap failed: " << strerror(errno) << "\n";
+		exit(-1);
+	}
+	base = (char*)p;
+
+	if(hints & COLUMN_SEQUENTIAL)
+		madvise(base, size, MADV_SEQUENTIAL);
+	if(hints & COLUMN_RANDOM)
+		madvise(base, size, MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+	//Only a hint, file backed mappings get huge pages where the filesystem supports them
+	if(hints & COLUMN_HUGE)
+		madvise(base, size, MADV_HUGEPAGE);
+#endif
+}
+
+MappedColumn* MappedColumn::Open(const char *path, int type, int length, int hints){
+	MappedColumn *col = new MappedColumn();
+	col->fd = open(path, O_RDONLY);
+	if(col->fd < 0){
+		cout << "Can't open column " << path << ": " << strerror(errno) << "\n";
+		exit(-1);
+	}
+	struct stat st;
+	fstat(col->fd, &st);
+	if((size_t)st.st_size < sizeof(ColumnHeader)){
+		cout << "Not a column: " << path << "\n";
+		exit(-1);
+	}
+	col->size = st.st_size;
+
+	//Checked before anything is mapped or advised
+	ColumnHeader header;
+	if(pread(col->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)){
+		cout << "Can't read column " << path << ": " << strerror(errno) << "\n";
+		exit(-1);
+	}
+	ColumnHeader *h = &header;
+	if(h->magic != COLUMN_MAGIC){
+		cout << "Not a column: " << path << "\n";
+		exit(-1);
+	}
+	if(!valid_length(h->length)){
+		cout << "Column " << path << " has elements of " << h->length << " bits\n";
+		exit(-1);
+	}
+	if(h->type != type || h->length != length){
+		cout << "Column " << path << " has type " << h->type << ", " << h->length << " expected " << type << ", " << length << "\n";
+		exit(-1);
+	}
+	//Kernels get the mapped values as is, they have to start on a page like Create puts them
+	if(h->offset % page_size()){
+		cout << "Column " << path << " has its data at " << h->offset << ", not on a page boundary\n";
+		exit(-1);
+	}
+	//Divided rather than multiplied, a corrupt count could wrap around the product
+	if(h->offset > col->size || h->count > (col->size - h->offset) / column_bytes(h->length)){
+		cout << "Column " << path << " is truncated\n";
+		exit(-1);
+	}
+	col->Map(hints);
+	return col;
+}
+
+MappedColumn* MappedColumn::Create(const char *path, int type, int length, size_t count, int hints){
+	if(!valid_length(length)){
+		cout << "Can't create column " << path << " with elements of " << length << " bits\n";
+		exit(-1);
+	}
+	MappedColumn *col = new MappedColumn();
+	col->writable = true;
+	col->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(col->fd < 0){
+		cout << "Can't create column " << path << ": " << strerror(errno) << "\n";
+		exit(-1);
+	}
+	size_t offset = page_size();
+	col->size = offset + count * column_bytes(length);
+	if(ftruncate(col->fd, col->size)){
+		cout << "Can't size column " << path << ": " << strerror(errno) << "\n";
+		exit(-1);
+	}
+	col->Map(hints);
+
+	ColumnHeader *h = col->header();
+	h->magic = COLUMN_MAGIC;
+	h->type = type;
+	h->length = length;
+	h->count = count;
+	h->offset = offset;
+	return col;
+}
+
+void MappedColumn::Truncate(size_t count){
+	if(!writable || count > Count()){
+		cout << "Columns can only shrink, and only when created writable\n";
+		exit(-1);
+	}
+	header()->count = count;
+	//The tail past the new end stays mapped but is never touched again
+	size_t new_size = header()->offset + count * ElemSize();
+	if(ftruncate(fd, new_size)){
+		cout << "Can't truncate column: " << strerror(errno) << "\n";
+		exit(-1);
+	}
+}
+
+MappedColumn::~MappedColumn(){
+	if(base){
+		if(writable)
+			msync(base, size, MS_ASYNC);
+		munmap(base, size);
+	}
+	if(fd >= 0)
+		close(fd);
+}
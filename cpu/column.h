@@ -0,0 +1,81 @@
+/* 
+GPiler - column.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef GPL_COLUMN_H
+#define GPL_COLUMN_H
+
+#include <cstddef>
+#include <cstdint>
+
+//Element kinds, same numbering as GType in the compiler
+#define COLUMN_INT	1
+#define COLUMN_FLOAT	2
+#define COLUMN_BOOL	3
+#define COLUMN_UINT	5
+
+//Access hints
+#define COLUMN_SEQUENTIAL	1	//streamed front to back, the usual map case
+#define COLUMN_RANDOM		2	//read through gather
+#define COLUMN_HUGE		4	//ask for transparent huge pages
+#define COLUMN_POPULATE		8	//fault everything in up front
+
+#define COLUMN_MAGIC	0x434c5047	//"GPLC"
+
+//On disk a column is this header followed by the raw array starting on a page boundary,
+//so the mapped values can be handed to a kernel as is
+struct ColumnHeader {
+	uint32_t magic;
+	uint16_t type;
+	uint16_t length;	//bits per element
+	uint64_t count;
+	uint64_t offset;	//of the first element from the start of the file
+};
+
+//Bytes per element of length bits, the compiler's elemBytes rule: a bool takes a whole byte
+static inline size_t column_bytes(int length){
+	return length < 8 ? 1 : length / 8;
+}
+
+class MappedColumn {
+public:
+	//Map an existing column read only. Exits if the file is not a column of the given type
+	static MappedColumn* Open(const char *path, int type, int length, int hints);
+	//Create a writable column with room for count elements
+	static MappedColumn* Create(const char *path, int type, int length, size_t count, int hints);
+	~MappedColumn();
+
+	void *Data() { return base + header()->offset; }
+	size_t Count() { return header()->count; }
+	size_t ElemSize() { return column_bytes(header()->length); }
+
+	//Outputs are created at the size of the input, shrink them once a filter has run
+	void Truncate(size_t count);
+
+private:
+	MappedColumn() : fd(-1), base(0), size(0), writable(false) {}
+	ColumnHeader *header() { return (ColumnHeader*)base; }
+	void Map(int hints);
+
+	int fd;
+	char *base;
+	size_t size;
+	bool writable;
+};
+
+#endif
@@ -0,0 +1,231 @@
+/* 
+GPiler - launch.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "launch.h"
+#include "pool.h"
+
+using namespace std;
+
+//Below this many elements handing out work costs more than doing it
+#define INLINE_ELEMS 16384
+//Smallest chunk worth a trip through the queue
+#define MIN_CHUNK 4096
+//Chunks per worker, enough that a slow one doesn't hold up the rest
+#define CHUNKS_PER_THREAD 4
+//Gathers and scatters touching fewer pages than this stay in cache whatever order they run in
+#define BUCKET_MIN_PAGES 512
+#define PAGE_SHIFT 12
+
+static ThreadPool *pool(){
+	static ThreadPool *instance = new ThreadPool();
+	return instance;
+}
+
+//Chunk size splitting n elements over the pool
+static int64_t chunk_size(ThreadPool *workers, int64_t n){
+	int64_t chunk = (n + workers->Size()*CHUNKS_PER_THREAD - 1) / (workers->Size()*CHUNKS_PER_THREAD);
+	return chunk < MIN_CHUNK ? MIN_CHUNK : chunk;
+}
+
+struct Compaction {
+	void *out;
+	const void *in;
+	const bool *mask;
+	const int64_t *n;
+	int32_t elemBytes;
+	int64_t *count;
+};
+
+struct Graph {
+	Graph(ThreadPool *workers, int64_t most) : tasks(workers, chunk_size(workers, most), most), most(most) {}
+	TaskGraph tasks;
+	std::vector<Compaction*> compactions;
+	std::vector<int64_t*> orders;
+	int64_t most;
+};
+
+//A compaction is a task of one element, nothing can use its output before all of it is there
+static const int64_t one = 1;
+
+void *gpl_alloc(int64_t bytes){
+	void *ret;
+	if(posix_memalign(&ret,64,bytes ? bytes : 1))
+		return 0;
+	return ret;
+}
+
+void gpl_free(void *ptr){
+	free(ptr);
+}
+
+int64_t gpl_compact(void *out, const void *in, const bool *mask, int64_t n, int32_t elemBytes){
+	char *dst = (char*)out;
+	const char *src = (const char*)in;
+	int64_t count=0;
+	for(int64_t i=0; i < n; i++){
+		if(!mask[i])
+			continue;
+		if(dst != src || count != i)
+			memcpy(dst + (size_t)count*elemBytes, src + (size_t)i*elemBytes, elemBytes);
+		count++;
+	}
+	return count;
+}
+
+void gpl_launch(LaunchRange range, void *args, int64_t n){
+	if(n <= 0)
+		return;
+	ThreadPool *workers = pool();
+	if(n <= INLINE_ELEMS || workers->Size() < 2){
+		range(0,n,args);
+		return;
+	}
+
+	int64_t chunk = chunk_size(workers, n);
+	int chunks = (n + chunk - 1) / chunk;
+
+	//These live on this stack frame, a worker may only touch them while holding lock. Otherwise
+	//the wait below could see the last chunk done and return while that worker is still notifying
+	int remaining = chunks;
+	mutex lock;
+	condition_variable cv;
+	for(int i=0; i < chunks; i++){
+		int64_t begin = i*chunk, end = begin + chunk < n ? begin + chunk : n;
+		workers->Submit([=,&remaining,&lock,&cv]{
+			range(begin,end,args);
+			lock_guard<mutex> l(lock);
+			if(--remaining == 0)
+				cv.notify_all();
+		});
+	}
+	unique_lock<mutex> l(lock);
+	cv.wait(l, [&]{ return remaining == 0; });
+}
+
+static void compact_range(int64_t begin, int64_t end, void *args){
+	Compaction *c = (Compaction*)args;
+	*c->count = gpl_compact(c->out, c->in, c->mask, *c->n, c->elemBytes);
+}
+
+void *gpl_graph(int64_t most){
+	return new Graph(pool(), most);
+}
+
+int32_t gpl_graph_kernel(void *graph, LaunchRange range, void *args, const int64_t *n){
+	return ((Graph*)graph)->tasks.AddTask(range, args, n);
+}
+
+int32_t gpl_graph_compact(void *graph, void *out, const void *in, const bool *mask, const int64_t *n, int32_t elemBytes, int64_t *count){
+	Graph *g = (Graph*)graph;
+	Compaction *c = new Compaction();
+	c->out = out;
+	c->in = in;
+	c->mask = mask;
+	c->n = n;
+	c->elemBytes = elemBytes;
+	c->count = count;
+	g->compactions.push_back(c);
+	return g->tasks.AddTask(compact_range, c, &one);
+}
+
+static int64_t read_index(const char *index, int64_t i, int32_t bytes, int32_t isUnsigned){
+	switch(bytes){
+		case 1: return isUnsigned ? (int64_t)((const uint8_t*)index)[i] : ((const int8_t*)index)[i];
+		case 2: return isUnsigned ? (int64_t)((const uint16_t*)index)[i] : ((const int16_t*)index)[i];
+		case 4: return isUnsigned ? (int64_t)((const uint32_t*)index)[i] : ((const int32_t*)index)[i];
+	}
+	return ((const int64_t*)index)[i];
+}
+
+//A counting sort of [0,n) by page. Negative indices go with the first page, the kernel reports them.
+//With more pages than elements neighbouring pages share a bucket
+const int64_t *gpl_graph_bucket(void *graph, const void *index, int32_t indexBytes, int32_t isUnsigned, int64_t n, int32_t elemBytes){
+	if(n <= INLINE_ELEMS)
+		return 0;
+	const char *col = (const char*)index;
+	vector<int64_t> pages(n);
+	int64_t lo = INT64_MAX, hi = 0;
+	for(int64_t i=0; i < n; i++){
+		int64_t at = read_index(col, i, indexBytes, isUnsigned);
+		pages[i] = at < 0 ? 0 : (int64_t)(((uint64_t)at * elemBytes) >> PAGE_SHIFT);
+		lo = pages[i] < lo ? pages[i] : lo;
+		hi = pages[i] > hi ? pages[i] : hi;
+	}
+	int64_t span = hi - lo + 1;
+	if(span < BUCKET_MIN_PAGES)
+		return 0;
+	int64_t per = (span + n - 1) / n, buckets = (span + per - 1) / per;
+
+	vector<int64_t> start(buckets + 1, 0);
+	for(int64_t i=0; i < n; i++)
+		start[(pages[i] - lo) / per + 1]++;
+	for(int64_t b=0; b < buckets; b++)
+		start[b + 1] += start[b];
+	int64_t *order = (int64_t*)gpl_alloc(n * sizeof(int64_t));
+	if(!order)
+		return 0;
+	for(int64_t i=0; i < n; i++)
+		order[start[(pages[i] - lo) / per]++] = i;
+	((Graph*)graph)->orders.push_back(order);
+	return order;
+}
+
+void gpl_graph_chunk_dep(void *graph, int32_t after, int32_t before){
+	((Graph*)graph)->tasks.AddChunkDep(after, before);
+}
+
+void gpl_graph_dep(void *graph, int32_t after, int32_t before){
+	((Graph*)graph)->tasks.AddDep(after, before);
+}
+
+void gpl_graph_run(void *graph){
+	Graph *g = (Graph*)graph;
+	if(g->most <= INLINE_ELEMS || pool()->Size() < 2)
+		g->tasks.RunInOrder();
+	else
+		g->tasks.Run();
+	for(size_t i=0; i < g->compactions.size(); i++)
+		delete g->compactions[i];
+	for(size_t i=0; i < g->orders.size(); i++)
+		gpl_free(g->orders[i]);
+	delete g;
+}
+
+int64_t gpl_chunk_count(const int64_t *counts, int32_t n){
+	for(int32_t i=1; i < n; i++){
+		if(counts[i] != counts[0]){
+			cout << "Outputs of a chunk have different lengths, " << counts[0] << " and " << counts[i] << "\n";
+			exit(-1);
+		}
+	}
+	return n ? counts[0] : 0;
+}
+
+void gpl_index_error(const char *array, int64_t index, int64_t size){
+	cout << "Index " << index << " is outside " << array << ", which has " << size << " elements\n";
+	exit(-1);
+}
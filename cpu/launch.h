@@ -0,0 +1,69 @@
+/* 
+GPiler - launch.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef GPL_LAUNCH_H
+#define GPL_LAUNCH_H
+
+#include <cstddef>
+#include <stdint.h>
+
+//Entry points called by the launchers the compiler generates. Element counts are int64 whichever width
+//the compiler picked for idx, launchers widen theirs on the way in
+extern "C" {
+
+//Runs elements [begin,end) of one kernel, args is the kernel's arguments packed in a struct
+typedef void (*LaunchRange)(int64_t begin, int64_t end, void *args);
+
+void *gpl_alloc(int64_t bytes);
+void gpl_free(void *ptr);
+
+//Copies the elements of in whose mask is set to the front of out, returns how many there were
+int64_t gpl_compact(void *out, const void *in, const bool *mask, int64_t n, int32_t elemBytes);
+
+//Splits n elements over the thread pool and waits for all of them
+void gpl_launch(LaunchRange range, void *args, int64_t n);
+
+//The kernels of one function queued with the data they pass between each other, then run together.
+//Counts are read through pointers once a task's producers are done, so one can be the count a
+//compaction queued earlier works out. most bounds every count. Tasks are numbered as they are added
+void *gpl_graph(int64_t most);
+int32_t gpl_graph_kernel(void *graph, LaunchRange range, void *args, const int64_t *n);
+int32_t gpl_graph_compact(void *graph, void *out, const void *in, const bool *mask, const int64_t *n, int32_t elemBytes, int64_t *count);
+//Order to run n elements of a kernel in, grouped by the page of the array they gather from or scatter
+//to and in idx order within a page. index is the input column the kernel indexes that array with, one
+//of indexBytes bytes per element, and the array has elemBytes per element. 0 when idx order is as good,
+//otherwise the graph owns it
+const int64_t *gpl_graph_bucket(void *graph, const void *index, int32_t indexBytes, int32_t isUnsigned, int64_t n, int32_t elemBytes);
+//after reads element i of what before wrote at element i
+void gpl_graph_chunk_dep(void *graph, int32_t after, int32_t before);
+//after needs everything before did
+void gpl_graph_dep(void *graph, int32_t after, int32_t before);
+//Runs the graph, waits for it and frees it
+void gpl_graph_run(void *graph);
+
+//Length of every output of one chunk, see <target>_chunk. They have to agree, rows are written out whole
+int64_t gpl_chunk_count(const int64_t *counts, int32_t n);
+
+//Called by a kernel gathering from or scattering to an element past the end of array, stops the program
+void gpl_index_error(const char *array, int64_t index, int64_t size);
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+/* 
+GPiler - pool.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <iostream>
+#include <cstdlib>
+
+#include "pool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned threads) : stopping(false) {
+	if(!threads)
+		threads = thread::hardware_concurrency();
+	if(!threads)
+		threads = 1;
+	for(unsigned i=0; i < threads; i++)
+		workers.push_back(thread(&ThreadPool::Worker, this));
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		lock_guard<mutex> l(lock);
+		stopping = true;
+	}
+	cv.notify_all();
+	for(size_t i=0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void ThreadPool::Submit(function<void()> work){
+	{
+		lock_guard<mutex> l(lock);
+		queue.push_back(work);
+	}
+	cv.notify_one();
+}
+
+void ThreadPool::Worker(){
+	while(1){
+		function<void()> work;
+		{
+			unique_lock<mutex> l(lock);
+			cv.wait(l, [&]{ return stopping || !queue.empty(); });
+			if(queue.empty())
+				return;
+			work = queue.front();
+			queue.pop_front();
+		}
+		work();
+	}
+}
+
+TaskGraph::~TaskGraph(){
+	for(size_t i=0; i < tasks.size(); i++){
+		delete [] tasks[i]->pending;
+		delete [] tasks[i]->launched;
+		delete tasks[i];
+	}
+}
+
+int TaskGraph::AddTask(RangeKernel kernel, void *user, const int64_t *n){
+	Task *task = new Task();
+	task->kernel = kernel;
+	task->user = user;
+	task->size = n;
+	task->n = 0;
+	task->nchunks = 0;
+	task->nchunkDeps = 0;
+	task->ndeps = 0;
+	task->pending = 0;
+	task->launched = 0;
+	tasks.push_back(task);
+	return tasks.size() - 1;
+}
+
+//Chunk i of one task only lines up with chunk i of another when both run over the same count
+void TaskGraph::AddChunkDep(int after, int before){
+	if(tasks[after]->size != tasks[before]->size){
+		cout << "Chunked dependency between kernels of different size\n";
+		exit(-1);
+	}
+	tasks[before]->chunkUsers.push_back(after);
+	tasks[after]->nchunkDeps++;
+}
+
+void TaskGraph::AddDep(int after, int before){
+	tasks[before]->users.push_back(after);
+	tasks[after]->ndeps++;
+}
+
+//Everything the size of t depends on is done. An empty task still gets one chunk so its users hear of it
+void TaskGraph::Start(int t){
+	Task *task = tasks[t];
+	task->n = *task->size;
+	if(task->n > maxElems){
+		cout << "Task of " << task->n << " elements in a graph sized for " << maxElems << "\n";
+		exit(-1);
+	}
+	task->nchunks = task->n > 0 ? (task->n + chunkElems - 1) / chunkElems : 1;
+	task->remaining = task->nchunks;
+	task->ready = true;
+}
+
+//A chunk may become ready from two directions at once, only the first one gets to run it
+void TaskGraph::Launch(int t, size_t chunk){
+	Task *task = tasks[t];
+	if(task->launched[chunk].exchange(true))
+		return;
+	pool->Submit([this, t, chunk]{ Execute(t, chunk); });
+}
+
+void TaskGraph::Execute(int t, size_t chunk){
+	Task *task = tasks[t];
+	int64_t begin = chunk * chunkElems;
+	int64_t end = begin + (int64_t)chunkElems < task->n ? begin + chunkElems : task->n;
+	if(begin < end)
+		task->kernel(begin, end, task->user);
+
+	for(size_t i=0; i < task->chunkUsers.size(); i++){
+		int u = task->chunkUsers[i];
+		Task *user = tasks[u];
+		if(--user->pending[chunk] == 0 && user->ready)
+			Launch(u, chunk);
+	}
+
+	if(--task->remaining == 0){
+		for(size_t i=0; i < task->users.size(); i++){
+			int u = task->users[i];
+			Task *user = tasks[u];
+			if(--user->barriers == 0){
+				Start(u);
+				for(size_t c=0; c < user->nchunks; c++){
+					if(user->pending[c] == 0)
+						Launch(u, c);
+				}
+			}
+		}
+		//Run returns as soon as it sees running reach 0 and the graph may go with it, so the count
+		//only changes under lock and nothing here touches the graph after that
+		lock_guard<mutex> l(lock);
+		if(--running == 0)
+			cv.notify_all();
+	}
+}
+
+void TaskGraph::Run(){
+	if(tasks.empty())
+		return;
+
+	//Every chunk counter is there from the start, a producer may finish a chunk before its user is sized
+	size_t most = maxElems > 0 ? (maxElems + chunkElems - 1) / chunkElems : 1;
+	for(size_t i=0; i < tasks.size(); i++){
+		Task *task = tasks[i];
+		delete [] task->pending;
+		delete [] task->launched;
+		task->pending = new atomic<int>[most];
+		task->launched = new atomic<bool>[most];
+		for(size_t c=0; c < most; c++){
+			task->pending[c] = task->nchunkDeps;
+			task->launched[c] = false;
+		}
+		task->barriers = task->ndeps;
+		task->ready = false;
+	}
+	running = tasks.size();
+
+	//Size everything that can start before launching anything, then hand out what has no producer
+	for(size_t i=0; i < tasks.size(); i++){
+		if(!tasks[i]->ndeps)
+			Start(i);
+	}
+	for(size_t i=0; i < tasks.size(); i++){
+		if(tasks[i]->ndeps || tasks[i]->nchunkDeps)
+			continue;
+		for(size_t c=0; c < tasks[i]->nchunks; c++)
+			Launch(i, c);
+	}
+
+	unique_lock<mutex> l(lock);
+	cv.wait(l, [&]{ return running == 0; });
+}
+
+void TaskGraph::RunInOrder(){
+	for(size_t i=0; i < tasks.size(); i++){
+		int64_t n = *tasks[i]->size;
+		if(n > 0)
+			tasks[i]->kernel(0, n, tasks[i]->user);
+	}
+}
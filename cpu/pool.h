@@ -0,0 +1,104 @@
+/* 
+GPiler - pool.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef GPL_POOL_H
+#define GPL_POOL_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+class ThreadPool {
+public:
+	//0 threads means one per hardware thread
+	ThreadPool(unsigned threads = 0);
+	~ThreadPool();
+
+	void Submit(std::function<void()> work);
+	unsigned Size() { return workers.size(); }
+
+private:
+	void Worker();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > queue;
+	bool stopping;
+	std::mutex lock;
+	std::condition_variable cv;
+};
+
+//Runs elements [begin,end) of one kernel
+typedef void (*RangeKernel)(int64_t begin, int64_t end, void *user);
+
+//Kernels of one function and the data dependencies between them. Tasks nothing connects run 
+//side by side, a task that consumes another's output element for element starts on a chunk as 
+//soon as the producer has finished that chunk. A task's size is read through a pointer once all its
+//full dependencies are done, so it can be a count one of them works out. No size exceeds maxElems
+class TaskGraph {
+public:
+	TaskGraph(ThreadPool *pool, size_t chunkElems, int64_t maxElems) : pool(pool), chunkElems(chunkElems), maxElems(maxElems) {}
+	~TaskGraph();
+
+	int AddTask(RangeKernel kernel, void *user, const int64_t *n);
+	//after reads element i of what before wrote at element i, both must have the same size
+	void AddChunkDep(int after, int before);
+	//after needs all of before, e.g. it runs over the compacted output of a filter
+	void AddDep(int after, int before);
+
+	void Run();
+	//Tasks are added in an order their dependencies allow, this runs them one after another on the
+	//calling thread, for when there is too little work to be worth handing out
+	void RunInOrder();
+
+private:
+	struct Task {
+		RangeKernel kernel;
+		void *user;
+		const int64_t *size;
+		int64_t n;
+		size_t nchunks;
+		std::vector<int> chunkUsers, users;
+		int nchunkDeps, ndeps;
+		std::atomic<int> barriers, remaining;
+		std::atomic<bool> ready; //sized, chunks may start as their producers finish
+		std::atomic<int> *pending;
+		std::atomic<bool> *launched;
+	};
+
+	void Start(int task);
+	void Launch(int task, size_t chunk);
+	void Execute(int task, size_t chunk);
+
+	ThreadPool *pool;
+	size_t chunkElems;
+	int64_t maxElems;
+	std::vector<Task*> tasks;
+
+	int running; //tasks not finished yet, guarded by lock
+	std::mutex lock;
+	std::condition_variable cv;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/* 
+GPiler - stream.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "stream.h"
+
+using namespace std;
+
+size_t FdSource::Read(void *dst, size_t n){
+	//Pipes hand out short reads, keep going until the chunk is full or the writer is gone
+	size_t want = n * elemSize, got = 0;
+	while(got < want){
+		ssize_t r = read(fd, (char*)dst + got, want - got);
+		if(r < 0){
+			if(errno == EINTR)
+				continue;
+			cout << "Stream read failed: " << strerror(errno) << "\n";
+			exit(-1);
+		}
+		if(r == 0)
+			break;
+		got += r;
+	}
+	if(got % elemSize){
+		cout << "Stream ended in the middle of an element\n";
+		exit(-1);
+	}
+	return got / elemSize;
+}
+
+size_t MemorySource::Read(void *dst, size_t n){
+	if(n > count - pos)
+		n = count - pos;
+	const char *src = base + pos * elemSize;
+	memcpy(dst, src, n * elemSize);
+	pos += n;
+
+	//Let the kernel start paging in what we will want next time around
+	uintptr_t next = (uintptr_t)(base + pos * elemSize) & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+	size_t left = (count - pos) * elemSize;
+	if(left)
+		madvise((void*)next, left < n * elemSize ? left : n * elemSize, MADV_WILLNEED);
+	return n;
+}
+
+void FdSink::Write(const void *src, size_t n){
+	size_t want = n * elemSize, put = 0;
+	while(put < want){
+		ssize_t r = write(fd, (const char*)src + put, want - put);
+		if(r < 0){
+			if(errno == EINTR)
+				continue;
+			cout << "Stream write failed: " << strerror(errno) << "\n";
+			exit(-1);
+		}
+		put += r;
+	}
+}
+
+StreamRunner::~StreamRunner(){
+	for(int i=0; i < 2; i++){
+		for(size_t j=0; j < chunks[i].columns.size(); j++)
+			free(chunks[i].columns[j]);
+	}
+}
+
+void StreamRunner::Fill(Chunk &chunk){
+	chunk.count = 0;
+	for(size_t i=0; i < inputs.size(); i++){
+		size_t got = inputs[i]->Read(chunk.columns[i], chunkElems);
+		if(i && got != chunk.count){
+			cout << "Input streams have different lengths\n";
+			exit(-1);
+		}
+		chunk.count = got;
+	}
+}
+
+//Producer side of the double buffer
+void StreamRunner::Prefetch(){
+	for(int slot = 0; ; slot ^= 1){
+		Chunk &chunk = chunks[slot];
+		{
+			unique_lock<mutex> l(lock);
+			cv.wait(l, [&]{ return !chunk.ready; });
+		}
+		Fill(chunk);
+		{
+			lock_guard<mutex> l(lock);
+			chunk.ready = true;
+		}
+		cv.notify_all();
+		if(!chunk.count)
+			return;
+	}
+}
+
+size_t StreamRunner::Run(ChunkKernel kernel, void *user){
+	for(int i=0; i < 2; i++){
+		chunks[i].ready = false;
+		chunks[i].count = 0;
+		if(chunks[i].columns.empty()){
+			for(size_t j=0; j < inputs.size(); j++)
+				chunks[i].columns.push_back(malloc(chunkElems * inputs[j]->elemSize));
+		}
+	}
+
+	vector<void*> outs;
+	for(size_t j=0; j < outputs.size(); j++)
+		outs.push_back(malloc(chunkElems * outputs[j]->elemSize));
+
+	thread producer(&StreamRunner::Prefetch, this);
+
+	size_t total = 0;
+	for(int slot = 0; ; slot ^= 1){
+		Chunk &chunk = chunks[slot];
+		{
+			unique_lock<mutex> l(lock);
+			cv.wait(l, [&]{ return chunk.ready; });
+		}
+		if(!chunk.count)
+			break;
+
+		size_t produced = kernel(outs.data(), chunk.columns.data(), chunk.count, user);
+		for(size_t j=0; j < outputs.size(); j++)
+			outputs[j]->Write(outs[j], produced);
+		total += chunk.count;
+
+		{
+			lock_guard<mutex> l(lock);
+			chunk.ready = false;
+		}
+		cv.notify_all();
+	}
+
+	producer.join();
+	for(size_t j=0; j < outs.size(); j++)
+		free(outs[j]);
+	return total;
+}
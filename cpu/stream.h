@@ -0,0 +1,113 @@
+/* 
+GPiler - stream.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef GPL_STREAM_H
+#define GPL_STREAM_H
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Hands out consecutive elements of one input column
+class StreamSource {
+public:
+	StreamSource(size_t elemSize) : elemSize(elemSize) {}
+	virtual ~StreamSource() {}
+	//Copy up to n elements into dst, returns the number copied. 0 means end of stream
+	virtual size_t Read(void *dst, size_t n) = 0;
+
+	size_t elemSize;
+};
+
+//Reads from a file descriptor, which covers both files and pipes
+class FdSource : public StreamSource {
+public:
+	FdSource(int fd, size_t elemSize) : StreamSource(elemSize), fd(fd) {}
+	size_t Read(void *dst, size_t n);
+
+	int fd;
+};
+
+//Reads from a region already in memory, usually an mmap'ed file
+class MemorySource : public StreamSource {
+public:
+	MemorySource(const void *base, size_t count, size_t elemSize) : StreamSource(elemSize), base((const char*)base), count(count), pos(0) {}
+	size_t Read(void *dst, size_t n);
+
+	const char *base;
+	size_t count, pos;
+};
+
+class StreamSink {
+public:
+	StreamSink(size_t elemSize) : elemSize(elemSize) {}
+	virtual ~StreamSink() {}
+	virtual void Write(const void *src, size_t n) = 0;
+
+	size_t elemSize;
+};
+
+class FdSink : public StreamSink {
+public:
+	FdSink(int fd, size_t elemSize) : StreamSink(elemSize), fd(fd) {}
+	void Write(const void *src, size_t n);
+
+	int fd;
+};
+
+//Runs the compiled pipeline over one chunk. outs and ins hold one pointer per column in declaration 
+//order. Returns the number of elements produced in every output, which is smaller than n after a filter.
+//The compiler generates one of these for every pipeline, <target>_chunk, see launcher.cpp
+typedef size_t (*ChunkKernel)(void **outs, void **ins, size_t n, void *user);
+
+//Pushes the sources through a kernel chunk by chunk. While one chunk is computed the next one is 
+//read in the background, so memory use is bounded by two input chunks and one output chunk
+class StreamRunner {
+public:
+	StreamRunner(size_t chunkElems) : chunkElems(chunkElems) {}
+	~StreamRunner();
+
+	void AddInput(StreamSource *src) { inputs.push_back(src); }
+	void AddOutput(StreamSink *sink) { outputs.push_back(sink); }
+
+	//Returns the number of input elements consumed
+	size_t Run(ChunkKernel kernel, void *user);
+
+private:
+	struct Chunk {
+		std::vector<void*> columns;
+		size_t count;
+		bool ready;
+	};
+
+	void Prefetch();
+	void Fill(Chunk &chunk);
+
+	size_t chunkElems;
+	std::vector<StreamSource*> inputs;
+	std::vector<StreamSink*> outputs;
+
+	Chunk chunks[2];
+	std::mutex lock;
+	std::condition_variable cv;
+};
+
+#endif
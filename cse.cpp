@@ -0,0 +1,281 @@
+/* 
+GPiler - cse.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "node.h"
+#include "codegen.h"
+
+#include <cstdio>
+#include <sstream>
+
+using namespace std;
+
+//Builtins like echo have effects, anything defined in the program is pure unless it calls one
+static bool pure(Node *node, NBlock *pb, map<string,int> &known){
+	NMethodCall *call = dynamic_cast<NMethodCall*>(node);
+	if(call){
+		string name = call->id->name;
+		if(known.find(name) == known.end()){
+			known[name] = 1; //recursion settles on pure
+			NFunctionDeclaration *callee = 0;
+			for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); it++){
+				NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+				if(decl && decl->id->name == name)
+					callee = decl;
+			}
+			known[name] = callee && pure(callee->block,pb,known);
+		}
+		if(!known[name])
+			return false;
+	}
+	//Scatters write through an index
+	if(dynamic_cast<NIndexMap*>(node))
+		return false;
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		if(!pure(*it,pb,known))
+			return false;
+	return true;
+}
+
+static map<string,GTypeList> locals_of(NFunctionDeclaration *decl){
+	map<string,GTypeList> locals;
+	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++)
+		locals[(*it)->id->name] = ((Node*)*it)->GetType();
+	for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++)
+		locals[(*it)->id->name] = ((Node*)*it)->GetType();
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it);
+		if(vdec)
+			locals[vdec->id->name] = ((Node*)vdec)->GetType();
+	}
+	return locals;
+}
+
+//Whether computing node somewhere the source didn't could fault. Integer division traps on zero,
+//element loads are bounds checked, and calls carry whatever their callee does
+static bool traps(Node *node, map<string,GTypeList> &locals, NBlock *pb, map<string,int> &known){
+	NBinaryOperator *binary = dynamic_cast<NBinaryOperator*>(node);
+	NMethodCall *call = dynamic_cast<NMethodCall*>(node);
+	if(binary && binary->op == TDIV){
+		//Names declared inside an if or for aren't in locals, those count as integers
+		GTypeList ltype = binary->lhs->GetType(locals), rtype = binary->rhs->GetType(locals);
+		if(ltype.empty() || rtype.empty() || promoteType(ltype,rtype).begin()->type != FLOAT_TYPE)
+			return true;
+	}
+	if(dynamic_cast<NArrayRef*>(node))
+		return true;
+	if(call){
+		string name = call->id->name;
+		if(known.find(name) == known.end()){
+			known[name] = 0; //recursion settles on not trapping
+			for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); it++){
+				NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+				if(decl && decl->id->name == name){
+					map<string,GTypeList> callee = locals_of(decl);
+					known[name] = traps(decl->block,callee,pb,known);
+				}
+			}
+		}
+		if(known[name])
+			return true;
+	}
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		if(traps(*it,locals,pb,known))
+			return true;
+	return false;
+}
+
+//Whether node reads any of names
+static bool reads(Node *node, set<string> &names){
+	IdList ids;
+	node->GetIdRefs(ids);
+	for(IdList::iterator it = ids.begin(); it != ids.end(); it++)
+		if(names.count((*it)->name))
+			return true;
+	return false;
+}
+
+//Equal text means equal value once every name is assigned exactly once
+static string key(Node *node){
+	ostringstream os;
+	os << *node;
+	return os.str();
+}
+
+struct Occurrence {
+	Node *node, *parent;
+	NodeList::iterator stmt;
+	bool conditional; //in an arm of a select, only computed for some elements
+};
+
+//Collects the operators and selects inside an expression. Map bodies are a scope of their own
+static void operands(Node *node, Node *parent, NodeList::iterator stmt, bool conditional, map<string,list<Occurrence> > &found){
+	NBinaryOperator *binary = dynamic_cast<NBinaryOperator*>(node);
+	NUnaryOperator *unary = dynamic_cast<NUnaryOperator*>(node);
+	NSelect *select = dynamic_cast<NSelect*>(node);
+	NMethodCall *call = dynamic_cast<NMethodCall*>(node);
+	if(binary || unary || select){
+		Occurrence occ = {node, parent, stmt, conditional};
+		found[key(node)].push_back(occ);
+	}
+	if(binary){
+		operands(binary->lhs,node,stmt,conditional,found);
+		operands(binary->rhs,node,stmt,conditional,found);
+	}
+	if(unary)
+		operands(unary->exp,node,stmt,conditional,found);
+	if(select){
+		operands(select->pred,node,stmt,conditional,found);
+		operands(select->yes,node,stmt,true,found);
+		operands(select->no,node,stmt,true,found);
+	}
+	if(call){
+		for(NodeList::iterator it = call->arguments->begin(); it != call->arguments->end(); it++)
+			operands(*it,node,stmt,conditional,found);
+	}
+}
+
+static void replace(Node *parent, Node *old, Node *node){
+	NBinaryOperator *binary = dynamic_cast<NBinaryOperator*>(parent);
+	NUnaryOperator *unary = dynamic_cast<NUnaryOperator*>(parent);
+	NSelect *select = dynamic_cast<NSelect*>(parent);
+	NMethodCall *call = dynamic_cast<NMethodCall*>(parent);
+	NAssignment *assn = dynamic_cast<NAssignment*>(parent);
+	if(binary)
+		binary->ReplaceOperand(old,node);
+	if(unary)
+		unary->ReplaceOperand(old,node);
+	if(select)
+		select->ReplaceOperand(old,node);
+	if(call){
+		for(NodeList::iterator it = call->arguments->begin(); it != call->arguments->end(); it++)
+			if(*it == old)
+				call->ReplaceArgument(it,node);
+	}
+	if(assn)
+		assn->SetExpr(node);
+}
+
+//A later assignment computing the same thing as an earlier one is dropped along with its
+//declaration, readers move over to the earlier result
+static bool merge_statements(NFunctionDeclaration *decl, NBlock *pb, map<string,int> &pure_calls, set<string> &mutated){
+	map<string,NAssignment*> seen;
+	map<string,NVariableDeclaration*> decls;
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it);
+		if(vdec)
+			decls[vdec->id->name] = vdec;
+	}
+
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		NAssignment *assn = dynamic_cast<NAssignment*>(*it);
+		if(!assn || !assn->lhs || assn->index || assn->array || !pure(assn->rhs,pb,pure_calls) || reads(assn->rhs,mutated))
+			continue;
+		bool local = true;
+		for(IdList::iterator it2 = assn->lhs->begin(); it2 != assn->lhs->end(); it2++)
+			local = local && decls.find((*it2)->name) != decls.end() && !mutated.count((*it2)->name);
+		if(!local)
+			continue;
+
+		string k = key(assn->rhs);
+		if(seen.find(k) == seen.end() || seen[k]->lhs->size() != assn->lhs->size()){
+			seen[k] = assn;
+			continue;
+		}
+
+		map<string,string> rename;
+		IdList::iterator from = assn->lhs->begin();
+		for(IdList::iterator to = seen[k]->lhs->begin(); to != seen[k]->lhs->end(); to++, from++)
+			rename[(*from)->name] = (*to)->name;
+		for(NodeList::iterator it2 = decl->block->children.begin(); it2 != decl->block->children.end(); it2++){
+			IdList ids;
+			(*it2)->GetIdRefs(ids);
+			for(IdList::iterator it3 = ids.begin(); it3 != ids.end(); it3++)
+				if(rename.find((*it3)->name) != rename.end())
+					(*it3)->name = rename[(*it3)->name];
+		}
+		for(map<string,string>::iterator it2 = rename.begin(); it2 != rename.end(); it2++)
+			decl->block->children.remove(decls[it2->first]);
+		decl->block->children.erase(it);
+		return true;
+	}
+	return false;
+}
+
+//The biggest expression that appears more than once is computed into a new local right before
+//the first statement using it. One that only shows up in select arms is computed for every element
+//once hoisted, so that has to be safe when the arm isn't taken
+static bool merge_expressions(NFunctionDeclaration *decl, NBlock *pb, map<string,int> &pure_calls, map<string,int> &trapping,
+		set<string> &mutated, int *count){
+	map<string,list<Occurrence> > found;
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		NAssignment *assn = dynamic_cast<NAssignment*>(*it);
+		NMethodCall *call = dynamic_cast<NMethodCall*>(*it);
+		if(assn && !dynamic_cast<NMap*>(assn->rhs))
+			operands(assn->rhs,assn,it,false,found);
+		if(call)
+			operands(call,0,it,false,found);
+	}
+
+	map<string,GTypeList> locals = locals_of(decl);
+	string best;
+	for(map<string,list<Occurrence> >::iterator it = found.begin(); it != found.end(); it++){
+		if(it->second.size() < 2 || it->first.size() <= best.size() || !pure(it->second.front().node,pb,pure_calls) ||
+				reads(it->second.front().node,mutated))
+			continue;
+		bool always = false;
+		for(list<Occurrence>::iterator it2 = it->second.begin(); it2 != it->second.end(); it2++)
+			always = always || !it2->conditional;
+		if(always || !traps(it->second.front().node,locals,pb,trapping))
+			best = it->first;
+	}
+	if(best == "")
+		return false;
+
+	list<Occurrence> &occs = found[best];
+	Node *expr = occs.front().node;
+	char name[64];
+	sprintf(name,"cse.%d",(*count)++);
+	NVariableDeclaration *vdec = new NVariableDeclaration(new TypeList(ntypesOf(expr->GetType(locals),0)), new NIdentifier(name));
+	NAssignment *assn = new NAssignment(new IdList{new NIdentifier(name)}, expr->clone());
+	decl->block->add_child(occs.front().stmt,vdec);
+	decl->block->add_child(occs.front().stmt,assn);
+
+	for(list<Occurrence>::iterator it = occs.begin(); it != occs.end(); it++)
+		replace(it->parent,it->node,new NIdentifier(name));
+	return true;
+}
+
+//Value numbering over the SSA form. Every name is assigned once and everything but builtins
+//is pure, so equal expressions are equal values. Names an if or for assigns are the exception,
+//nothing reading those is merged. Pipeline stage bodies skip to_ssa but only ever assign each
+//of their returns once, so they get the same treatment
+void value_number(NBlock *pb){
+	map<string,int> pure_calls;
+	map<string,int> trapping;
+	int count=0;
+	for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); it++){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(!decl || !decl->returns)
+			continue;
+		set<string> mutated;
+		mutated_names(decl->block,mutated);
+		while(merge_statements(decl,pb,pure_calls,mutated));
+		while(merge_expressions(decl,pb,pure_calls,trapping,mutated,&count));
+	}
+}
@@ -1,12 +1,6 @@
 #!/bin/sh
-rm -R -f example1.devcode
-nvcc example1.cu -arch=sm_20 --ptx
-nvcc example1.cu -arch=sm_20 -ext=all -dir=example1.devcode -o example1
-javac glink.java
-java glink > compiled.ptx
-
-_dfiles="./example1.devcode/*"
-for f in $_dfiles
-do
-        cp compiled.ptx $f
-done
+# The compiler links the kernels with their grid stride entries itself. out.ptx is the device code,
+# out.host.bc holds the launchers which only need to be turned into an object for the host
+../parser ../inputs/example2.gpl || exit 1
+llc-3.4 -filetype=obj out.host.bc -o host.o
+nvcc example1.cu gplrt.cu host.o -arch=sm_20 -lcuda -o example1
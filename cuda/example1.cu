@@ -19,52 +19,40 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  
 #include <stdio.h>
 #include <cuda.h>
+#include "gplrt.h"
 
-//Place holder function so we can redirect the call during link 
-__device__  __noinline__ void mapitfoo(int N, double *out, int *in){
-	out[N] = in[N] * in[N];
-}
-
-// Kernel that executes on the CUDA device
-__global__ void square_array(int N, double *out, int *in)
-{
-  for(int i=0; i<N; i+=blockDim.x*gridDim.x){
-  	int idx = i + blockIdx.x * blockDim.x + threadIdx.x;
-	if (idx<N)
-		mapitfoo(idx,out,in);
-  }
-}
+//Launcher generated from inputs/example2.gpl, it runs the kernels in out.ptx
+extern "C" void mapit_launch(int *out, int *out_size, int *in, int in_size);
  
 // main routine that executes on the host
 int main(void)
 {
   int *in_h, *in_d;
-  double *out_h, *out_d;  // Pointer to host & device arrays
+  int *out_h, *out_d;  // Pointer to host & device arrays
   const int N = 20;  // Number of elements in arrays
+  int out_n;
 
 
   size_t size = N * sizeof(int);
   in_h = (int *)malloc(size);        // Allocate array on host
-  out_h = (double *)malloc(size*2);        // Allocate array on host
+  out_h = (int *)malloc(size);        // Allocate array on host
 
   cudaMalloc((void **) &in_d, size);   // Allocate array on device
-  cudaMalloc((void **) &out_d, size*2);   // Allocate array on device
+  cudaMalloc((void **) &out_d, size);   // Allocate array on device
 
 
   // Initialize host array and copy it to CUDA device
   for (int i=0; i<N; i++) in_h[i] = i;
   cudaMemcpy(in_d, in_h, size, cudaMemcpyHostToDevice);
 
-  // Do calculation on device:
-  int block_size = 1024; //TODO: get this number from device info
-  int n_blocks = 1; //TODO: determine number of SM's
-  square_array <<< n_blocks, block_size >>> (N, out_d, in_d);
+  // Do calculation on device, the launcher picks the geometry
+  mapit_launch(out_d, &out_n, in_d, N);
   // Retrieve result from device and store it in host array
 
-  cudaMemcpy(out_h, out_d, sizeof(double)*N, cudaMemcpyDeviceToHost);
+  cudaMemcpy(out_h, out_d, sizeof(int)*out_n, cudaMemcpyDeviceToHost);
   
   // Print results
-  for (int i=0; i<N; i++) printf("%d %d %f\n", i, in_h[i], out_h[i]);
+  for (int i=0; i<out_n; i++) printf("%d %d %d\n", i, in_h[i], out_h[i]);
   // Cleanup
   free(in_h); 
   free(out_h);
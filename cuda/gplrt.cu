@@ -0,0 +1,99 @@
+/* 
+GPiler - gplrt.cu
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cuda.h>
+#include <cuda_runtime.h>
+#include <thrust/copy.h>
+#include <thrust/device_ptr.h>
+
+#include "gplrt.h"
+
+#define PTX_FILE "out.ptx"
+//Threads per block when there is enough work, a multiple of the warp size
+#define BLOCK_THREADS 256
+#define WARP 32
+
+static void check(CUresult res, const char *what){
+	if(res != CUDA_SUCCESS){
+		printf("%s failed: %d\n", what, res);
+		exit(-1);
+	}
+}
+
+void *gpl_alloc(int64_t bytes){
+	void *ret;
+	if(cudaMalloc(&ret, bytes ? bytes : 1) != cudaSuccess)
+		return 0;
+	return ret;
+}
+
+void gpl_free(void *ptr){
+	cudaFree(ptr);
+}
+
+template<typename T> static int64_t compact(void *out, const void *in, const bool *mask, int64_t n){
+	thrust::device_ptr<const T> src((const T*)in);
+	thrust::device_ptr<const bool> stencil(mask);
+	thrust::device_ptr<T> dst((T*)out);
+	return thrust::copy_if(src, src + n, stencil, dst, thrust::identity<bool>()) - dst;
+}
+
+int64_t gpl_compact(void *out, const void *in, const bool *mask, int64_t n, int32_t elemBytes){
+	switch(elemBytes){
+		case 1: return compact<uint8_t>(out,in,mask,n);
+		case 2: return compact<uint16_t>(out,in,mask,n);
+		case 4: return compact<uint32_t>(out,in,mask,n);
+		case 8: return compact<uint64_t>(out,in,mask,n);
+	}
+	printf("Can't compact %d byte elements\n", elemBytes);
+	exit(-1);
+}
+
+//Enough blocks to fill every SM, more only make the grid stride loop shorter
+void gpl_geometry(int64_t n, int *blocks, int *threads){
+	int dev, sms, per_sm;
+	cudaGetDevice(&dev);
+	cudaDeviceGetAttribute(&sms, cudaDevAttrMultiProcessorCount, dev);
+	cudaDeviceGetAttribute(&per_sm, cudaDevAttrMaxThreadsPerMultiProcessor, dev);
+
+	*threads = BLOCK_THREADS;
+	if(n < BLOCK_THREADS)
+		*threads = n > 0 ? (n + WARP - 1) / WARP * WARP : WARP;
+	int most = sms * (per_sm / *threads);
+	int64_t want = (n + *threads - 1) / *threads;
+	*blocks = want > most ? most : want < 1 ? 1 : want;
+}
+
+void gpl_launch_device(const char *entry, void **params, int32_t nparams, int64_t n){
+	static CUmodule module = 0;
+	if(!module){
+		cudaFree(0); //make sure the runtime has set up a context
+		check(cuModuleLoad(&module, PTX_FILE), "cuModuleLoad");
+	}
+	CUfunction func;
+	check(cuModuleGetFunction(&func, module, entry), entry);
+
+	int blocks, threads;
+	gpl_geometry(n, &blocks, &threads);
+	check(cuLaunchKernel(func, blocks, 1, 1, threads, 1, 1, 0, 0, params, 0), "cuLaunchKernel");
+	check(cuCtxSynchronize(), "cuCtxSynchronize");
+}
@@ -0,0 +1,42 @@
+/* 
+GPiler - gplrt.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef GPL_GPLRT_H
+#define GPL_GPLRT_H
+
+#include <stdint.h>
+
+//Device side of the entry points the generated host launcher calls, see cpu/launch.h for the CPU ones
+extern "C" {
+
+void *gpl_alloc(int64_t bytes);
+void gpl_free(void *ptr);
+int64_t gpl_compact(void *out, const void *in, const bool *mask, int64_t n, int32_t elemBytes);
+
+//Launches the grid stride entry point called entry from the compiled ptx. params points at each 
+//argument, the first is always the element count n in the width the compiler picked for idx
+void gpl_launch_device(const char *entry, void **params, int32_t nparams, int64_t n);
+
+//Launch geometry for n elements on the current device
+void gpl_geometry(int64_t n, int *blocks, int *threads);
+
+}
+
+#endif
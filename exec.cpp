@@ -0,0 +1,236 @@
+/* 
+GPiler - exec.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "node.h"
+#include "codegen.h"
+#include "exec.h"
+#include "cpu/launch.h"
+
+#include <cstdio>
+
+using namespace std;
+
+void AddOptimizationPasses(PassManagerBase &MPM, FunctionPassManager &FPM, unsigned OptLevel, unsigned SizeLevel);
+void RunFunctionPasses(Module &mod, FunctionPassManager &FPM);
+
+Executor::Executor(NBlock *program, vector<string> &linkFiles, int mode, long promoteAfter, int optLevel, int sizeLevel, Profile *record) :
+		program(program), linkFiles(linkFiles), mode(mode), promoteAfter(promoteAfter), optLevel(optLevel), sizeLevel(sizeLevel), interp(program,record), context(0), engine(0) {
+#ifdef FOR_NV
+	//Kernels are compiled for the device, there is nothing the host JIT could run
+	if(mode != EXEC_INTERP)
+		cout << "JIT unavailable when compiling for the GPU, build with make TARGET=cpu. Interpreting everything\n";
+	this->mode = EXEC_INTERP;
+#endif
+}
+
+Executor::~Executor(){
+	for(unsigned i=0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+//void <launcher>_packed(i8** params), one C signature that can call any launcher
+static Function *packedLauncher(Module *mod, Function *launcher){
+	LLVMContext &ctx = getGlobalContext();
+	Type *i8p = Type::getInt8PtrTy(ctx);
+	Function *func = Function::Create(FunctionType::get(Type::getVoidTy(ctx), PointerType::get(i8p,0), false),
+				GlobalValue::ExternalLinkage, launcher->getName() + "_packed", mod);
+	BasicBlock *block = BasicBlock::Create(ctx, "entry", func);
+
+	Value *params = func->arg_begin();
+	vector<Value*> args;
+	int i=0;
+	for(Function::arg_iterator it = launcher->arg_begin(); it != launcher->arg_end(); it++, i++){
+		Value *gep = GetElementPtrInst::Create(params, ConstantInt::get(Type::getInt32Ty(ctx), i), "", block);
+		Value *ptr = new BitCastInst(new LoadInst(gep, "", false, block), PointerType::get(it->getType(),0), "", block);
+		args.push_back(new LoadInst(ptr, "", false, block));
+	}
+	CallInst::Create(launcher, makeArrayRef(args), "", block);
+	ReturnInst::Create(ctx, block);
+	return func;
+}
+
+static void mapRuntime(ExecutionEngine *engine, Module *mod, const char *name, void *addr){
+	Function *func = mod->getFunction(name);
+	if(func)
+		engine->addGlobalMapping(func, addr);
+}
+
+//Fresh codegen of the whole program, with a packed wrapper around every launcher. Codegen moves nodes
+//around as it goes, it gets a copy of its own so this can go on while the interpreter is running
+CodeGenContext *Executor::Build(map<RuntimePlan*,Function*> &packed){
+	CodeGenContext *ctx = new CodeGenContext();
+	NBlock *copy = (NBlock*)program->clone();
+	ctx->generateCode(*copy);
+	link_modules(*ctx, linkFiles);
+	for(map<RuntimePlan*,Function*>::iterator it = ctx->launchers.begin(); it != ctx->launchers.end(); it++)
+		packed[it->first] = packedLauncher(ctx->module, it->second);
+	return ctx;
+}
+
+//Optimizes mod and hands it to the JIT, starting that up the first time
+void Executor::Load(Module *mod){
+	PassManager pm;
+	FunctionPassManager fpm(mod);
+	AddOptimizationPasses(pm, fpm, optLevel, sizeLevel);
+	RunFunctionPasses(*mod, fpm);
+	pm.run(*mod);
+
+	if(!engine){
+		InitializeNativeTarget();
+		string error;
+		engine = EngineBuilder(mod).setEngineKind(EngineKind::JIT).setErrorStr(&error).create();
+		if(!engine){
+			cout << "Can't start the JIT: " << error << "\n";
+			exit(-1);
+		}
+		//Workers from the pool call straight into kernels, nothing may be left to compile lazily
+		engine->DisableLazyCompilation(true);
+	}else
+		engine->addModule(mod);
+
+	//The runtime is linked into the compiler itself
+	mapRuntime(engine, mod, "gpl_alloc", (void*)gpl_alloc);
+	mapRuntime(engine, mod, "gpl_free", (void*)gpl_free);
+	mapRuntime(engine, mod, "gpl_compact", (void*)gpl_compact);
+	mapRuntime(engine, mod, "gpl_launch", (void*)gpl_launch);
+	mapRuntime(engine, mod, "gpl_graph", (void*)gpl_graph);
+	mapRuntime(engine, mod, "gpl_graph_kernel", (void*)gpl_graph_kernel);
+	mapRuntime(engine, mod, "gpl_graph_compact", (void*)gpl_graph_compact);
+	mapRuntime(engine, mod, "gpl_graph_chunk_dep", (void*)gpl_graph_chunk_dep);
+	mapRuntime(engine, mod, "gpl_graph_dep", (void*)gpl_graph_dep);
+	mapRuntime(engine, mod, "gpl_graph_run", (void*)gpl_graph_run);
+	mapRuntime(engine, mod, "gpl_chunk_count", (void*)gpl_chunk_count);
+	mapRuntime(engine, mod, "gpl_index_error", (void*)gpl_index_error);
+}
+
+//Builds the module every promotion uses the first time one is needed. Called with lock held
+void Executor::Generate(){
+	if(context)
+		return;
+	context = Build(wrappers);
+	Load(context->module);
+	report_loop_hints(*context);
+}
+
+static Constant *constantOf(Type *type, Cell val){
+	if(type->isFloatingPointTy())
+		return ConstantFP::get(type, val.d);
+	return ConstantInt::get(type, val.i, true);
+}
+
+//Every use of a scalar input in values becomes the constant, both in the launcher and in each kernel
+//it is handed to. The arguments themselves stay so the launcher keeps its signature
+static void substitute(CodeGenContext *ctx, RuntimePlan *plan, map<string,Cell> &values){
+	Function::arg_iterator AI = ctx->launchers[plan]->arg_begin();
+	for(unsigned i=0; i < plan->outputs.size(); i++){
+		AI++;
+		AI++;
+	}
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++){
+		bool array = (*(*it)->types->begin())->isArray;
+		if(!array && values.find((*it)->id->name) != values.end())
+			AI->replaceAllUsesWith(constantOf(AI->getType(), values[(*it)->id->name]));
+		AI++;
+		if(array)
+			AI++;
+	}
+
+	for(FunctionList::iterator it = plan->order.begin(); it != plan->order.end(); it++){
+		if(plan->compactions.count(*it))
+			continue;
+		Function *kernel = ctx->module->getFunction((*it)->id->name);
+		Function::arg_iterator KI = kernel->arg_begin();
+		for(VariableList::iterator it2 = (*it)->arguments->begin(); it2 != (*it)->arguments->end(); it2++, KI++){
+			if(!(*(*it2)->types->begin())->isArray && values.find((*it2)->id->name) != values.end())
+				KI->replaceAllUsesWith(constantOf(KI->getType(), values[(*it2)->id->name]));
+		}
+	}
+}
+
+//Every specialization is loaded into the same engine as the plain module and the ones before it. Its
+//kernels and launchers get suffix so none of them is mistaken for another module's of the same name
+static void uniqueNames(Module *mod, string suffix){
+	for(Module::iterator it = mod->begin(); it != mod->end(); it++){
+		if(!it->isDeclaration())
+			it->setName(it->getName() + suffix);
+	}
+	for(Module::global_iterator it = mod->global_begin(); it != mod->global_end(); it++){
+		if(!it->isDeclaration() && !it->hasLocalLinkage())
+			it->setName(it->getName() + suffix);
+	}
+}
+
+PackedLauncher Executor::Specialize(RuntimePlan *plan, map<string,Cell> &values){
+	if(mode == EXEC_INTERP)
+		return 0;
+	lock_guard<mutex> l(lock);
+
+	//Values are keyed by their bits so no two doubles share a specialization
+	string key = plan->target->id->name;
+	for(map<string,Cell>::iterator it = values.begin(); it != values.end(); it++){
+		char val[64];
+		sprintf(val, ":%llx", it->second.i);
+		key += " " + it->first + val;
+	}
+	if(specialized.find(key) != specialized.end())
+		return specialized[key];
+
+	//Each specialization is a codegen of its own, the constants can then go straight into the kernels
+	map<RuntimePlan*,Function*> packed;
+	CodeGenContext *ctx = Build(packed);
+	substitute(ctx, plan, values);
+	char suffix[32];
+	sprintf(suffix, ".s%u", (unsigned)specialized.size());
+	uniqueNames(ctx->module, suffix);
+	Load(ctx->module);
+	report_loop_hints(*ctx);
+	specialized[key] = (PackedLauncher)engine->getPointerToFunction(packed[plan]);
+	cout << "Specialized " << key << "\n";
+	return specialized[key];
+}
+
+void Executor::Promote(RuntimePlan *plan, Pipeline *pipe){
+	lock_guard<mutex> l(lock);
+	Generate();
+	if(wrappers.find(plan) == wrappers.end()){
+		cout << "No launcher for " << plan->target->id->name << "\n";
+		exit(-1);
+	}
+	pipe->native = (PackedLauncher)engine->getPointerToFunction(wrappers[plan]);
+	cout << "Promoted " << plan->target->id->name << " to native code\n";
+}
+
+void Executor::Run(RuntimePlan *plan, void **params){
+	Pipeline &pipe = pipes[plan];
+	if(mode == EXEC_JIT && !pipe.native)
+		Promote(plan, &pipe);
+
+	PackedLauncher native = pipe.native;
+	if(native){
+		native(params);
+		return;
+	}
+
+	interp.Run(plan, params);
+	pipe.elements += Interpreter::Elements(plan, params);
+	if(mode == EXEC_ADAPTIVE && !pipe.promoting && pipe.elements >= promoteAfter){
+		pipe.promoting = true;
+		workers.push_back(thread(&Executor::Promote, this, plan, &pipe));
+	}
+}
@@ -0,0 +1,87 @@
+/* 
+GPiler - exec.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef GPL_EXEC_H
+#define GPL_EXEC_H
+
+#include "interp.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+#define EXEC_INTERP	0	//never compile
+#define EXEC_JIT	1	//compile before the first call
+#define EXEC_ADAPTIVE	2	//interpret, compile in the background once a pipeline gets hot
+
+//Elements a pipeline has to go through in the interpreter before it is worth compiling
+#define DEFAULT_PROMOTE	100000
+
+class CodeGenContext;
+namespace llvm { class ExecutionEngine; class Function; class Module; }
+
+typedef void (*PackedLauncher)(void **params);
+
+//Runs pipelines in-process. Small and cold ones go through the interpreter, which starts in no
+//time, hot ones are promoted to native code from the JIT as soon as that is ready
+class Executor {
+public:
+	Executor(NBlock *program, vector<string> &linkFiles, int mode, long promoteAfter, int optLevel, int sizeLevel, Profile *record);
+	~Executor();
+
+	//params as for Interpreter::Run
+	void Run(RuntimePlan *plan, void **params);
+	//Native launcher for plan with the scalar inputs in values folded in as constants. Cached per set
+	//of values. 0 with the interp backend or when kernels are built for the GPU, callers then Run the
+	//plan as usual with the values passed as ordinary scalar inputs
+	PackedLauncher Specialize(RuntimePlan *plan, map<string,Cell> &values);
+	//Whether the last Run of this plan used native code
+	bool Native(RuntimePlan *plan) { return pipes[plan].native.load() != 0; }
+
+private:
+	struct Pipeline {
+		Pipeline() : elements(0), native(0), promoting(false) {}
+		std::atomic<long> elements;
+		std::atomic<PackedLauncher> native;
+		bool promoting;
+	};
+
+	void Promote(RuntimePlan *plan, Pipeline *pipe);
+	void Generate();
+	CodeGenContext *Build(map<RuntimePlan*,llvm::Function*> &packed);
+	void Load(llvm::Module *mod);
+
+	NBlock *program;
+	vector<string> linkFiles;
+	int mode;
+	long promoteAfter;
+	int optLevel, sizeLevel;
+	Interpreter interp;
+	map<RuntimePlan*,Pipeline> pipes;
+
+	//Everything below belongs to whichever thread holds lock
+	std::mutex lock;
+	std::vector<std::thread> workers;
+	CodeGenContext *context;
+	llvm::ExecutionEngine *engine;
+	map<RuntimePlan*,llvm::Function*> wrappers;
+	map<string,PackedLauncher> specialized;
+};
+
+#endif
@@ -0,0 +1,496 @@
+/* 
+GPiler - fold.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "node.h"
+#include "interp.h"
+
+#include <sstream>
+#include <algorithm>
+
+using namespace std;
+
+//Statements one compile time call may run before it is left for run time, and how deep calls nest
+#define FOLD_STEPS	100000
+#define FOLD_DEPTH	64
+
+struct Folder {
+	map<string,NFunctionDeclaration*> functions; //scalar ones, the only ones that can be called
+	map<string,GTypeList> results; //what every function returns, calls have these types
+	long steps;
+	int depth;
+};
+
+//Variables of a function being evaluated. Only types are known while folding one
+struct Frame {
+	map<string,Cell> values;
+	map<string,GTypeList> locals;
+};
+
+static string text(Node *node){
+	ostringstream os;
+	os << *node;
+	return os.str();
+}
+
+//Value and type of a literal or a cast of one
+static bool constant(Node *node, Cell &val, GType &type){
+	NInteger *integer = dynamic_cast<NInteger*>(node);
+	NDouble *dbl = dynamic_cast<NDouble*>(node);
+	NCast *cast = dynamic_cast<NCast*>(node);
+	if(integer){
+		val.i = integer->value;
+		type = GType(INT_TYPE,32,0);
+		val = convert_cell(val, GType(INT_TYPE,64,0), type);
+		return true;
+	}
+	if(dbl){
+		val.d = dbl->value;
+		type = GType(FLOAT_TYPE,64,0);
+		return true;
+	}
+	if(cast && constant(cast->exp,val,type)){
+		GType to = *((Node*)cast)->GetType().begin();
+		val = convert_cell(val, type, to);
+		type = to;
+		return true;
+	}
+	return false;
+}
+
+//val as a literal of type. Types without literals of their own are a cast of one, integers that
+//don't fit the 32 bits of a literal have none
+static Node *literal(Cell val, GType type){
+	type.isArray = type.isPointer = 0;
+	Node *lit;
+	if(type.type == FLOAT_TYPE)
+		lit = new NDouble(val.d);
+	else{
+		long long i = type.length <= 32 ? (int)val.i : val.i;
+		if(i != (int)i)
+			return 0;
+		lit = new NInteger(i);
+	}
+	if(type.type == FLOAT_TYPE ? type.length == 64 : type.type == INT_TYPE && type.length == 32)
+		return lit;
+	return new NCast(type.toNode(), lit);
+}
+
+//Whether the type of node is known in frame. Map parameters and functions that only get linked
+//in later are not
+static bool typed(Node *node, Frame &frame){
+	NMethodCall *call = dynamic_cast<NMethodCall*>(node);
+	NIdentifier *id = dynamic_cast<NIdentifier*>(node);
+	if(call){
+		if(frame.locals.find(call->id->name) == frame.locals.end())
+			return false;
+		for(NodeList::iterator it = call->arguments->begin(); it != call->arguments->end(); it++)
+			if(!typed(*it,frame))
+				return false;
+		return true;
+	}
+	if(id && !dynamic_cast<NType*>(node))
+		return frame.locals.find(id->name) != frame.locals.end() && frame.locals[id->name].size();
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		if(!typed(*it,frame))
+			return false;
+	return true;
+}
+
+//Integer division by zero and shifts past the width have no value the generated code agrees on
+static bool defined(int op, Cell r, GType type){
+	if(type.type == FLOAT_TYPE)
+		return true;
+	if(op == TDIV)
+		return r.i != 0;
+	if(op == TLSL || op == TLSR)
+		return r.i >= 0 && r.i < type.length;
+	return true;
+}
+
+static bool run(NBlock *block, Frame &frame, Folder &folder);
+static bool evaluate(Node *node, Frame &frame, Folder &folder, Cell &val, GType &type);
+
+//Outputs of a call to a function of the program, as long as everything it does is known now
+static bool invoke(NMethodCall *call, Frame &frame, Folder &folder, vector<Cell> &outs, vector<GType> &types){
+	if(folder.functions.find(call->id->name) == folder.functions.end() || folder.depth >= FOLD_DEPTH)
+		return false;
+	NFunctionDeclaration *decl = folder.functions[call->id->name];
+	if(call->arguments->size() != decl->arguments->size())
+		return false;
+
+	Frame callee;
+	callee.locals = folder.results;
+	NodeList::iterator arg = call->arguments->begin();
+	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++, arg++){
+		Cell val;
+		GType type;
+		if(!evaluate(*arg,frame,folder,val,type))
+			return false;
+		string name = (*it)->id->name;
+		callee.locals[name] = ((Node*)*it)->GetType();
+		callee.values[name] = convert_cell(val, type, *callee.locals[name].begin());
+	}
+	for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++){
+		if(!(*it)->id)
+			return false;
+		callee.locals[(*it)->id->name] = ((Node*)*it)->GetType();
+	}
+
+	folder.depth++;
+	bool ok = run(decl->block,callee,folder);
+	folder.depth--;
+	if(!ok)
+		return false;
+	for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++){
+		string name = (*it)->id->name;
+		if(callee.values.find(name) == callee.values.end())
+			return false;
+		outs.push_back(callee.values[name]);
+		types.push_back(*callee.locals[name].begin());
+	}
+	return true;
+}
+
+//Value of an expression in frame, false when it depends on anything only known at run time
+static bool evaluate(Node *node, Frame &frame, Folder &folder, Cell &val, GType &type){
+	NIdentifier *id = dynamic_cast<NIdentifier*>(node);
+	NBinaryOperator *binary = dynamic_cast<NBinaryOperator*>(node);
+	NUnaryOperator *unary = dynamic_cast<NUnaryOperator*>(node);
+	NSelect *select = dynamic_cast<NSelect*>(node);
+	NCast *cast = dynamic_cast<NCast*>(node);
+	NMethodCall *call = dynamic_cast<NMethodCall*>(node);
+	if(constant(node,val,type))
+		return true;
+	if(id){
+		if(dynamic_cast<NArrayRef*>(node) || frame.values.find(id->name) == frame.values.end())
+			return false;
+		val = frame.values[id->name];
+		type = *frame.locals[id->name].begin();
+		return true;
+	}
+	if(binary){
+		Cell l, r;
+		GType ltype, rtype;
+		if(!evaluate(binary->lhs,frame,folder,l,ltype) || !evaluate(binary->rhs,frame,folder,r,rtype))
+			return false;
+		GType common = *promoteType(GTypeList{ltype},GTypeList{rtype}).begin();
+		if(!defined(binary->op, convert_cell(r, rtype, common), common))
+			return false;
+		type = isCmp(binary->op) ? GType(BOOL_TYPE,1,0) : common;
+		val = binary_cell(binary->op, type, l, ltype, r, rtype);
+		return true;
+	}
+	if(unary){
+		Cell v;
+		GType vtype;
+		if(!evaluate(unary->exp,frame,folder,v,vtype))
+			return false;
+		type = *promoteType(GTypeList{vtype},GTypeList{vtype}).begin();
+		val = unary_cell(unary->op, type, v, vtype);
+		return true;
+	}
+	if(select){
+		Cell pred, arm;
+		GType ptype, atype;
+		if(!typed(select,frame) || !evaluate(select->pred,frame,folder,pred,ptype))
+			return false;
+		Node *pick = convert_cell(pred, ptype, GType(BOOL_TYPE,1,0)).i ? select->yes : select->no;
+		if(!evaluate(pick,frame,folder,arm,atype))
+			return false;
+		type = *select->GetType(frame.locals).begin();
+		val = convert_cell(arm, atype, type);
+		return true;
+	}
+	if(cast){
+		Cell v;
+		GType vtype;
+		if(!evaluate(cast->exp,frame,folder,v,vtype))
+			return false;
+		type = *((Node*)cast)->GetType().begin();
+		val = convert_cell(v, vtype, type);
+		return true;
+	}
+	if(call){
+		vector<Cell> outs;
+		vector<GType> types;
+		if(!invoke(call,frame,folder,outs,types) || outs.size() != 1)
+			return false;
+		val = outs[0];
+		type = types[0];
+		return true;
+	}
+	return false;
+}
+
+//Stores val into a variable of frame, converted like an assignment
+static bool assign(Frame &frame, string name, Cell val, GType type){
+	if(frame.locals.find(name) == frame.locals.end() || frame.locals[name].size() != 1)
+		return false;
+	frame.values[name] = convert_cell(val, type, *frame.locals[name].begin());
+	return true;
+}
+
+static bool execute(Node *stmt, Frame &frame, Folder &folder){
+	if(++folder.steps > FOLD_STEPS)
+		return false;
+	NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(stmt);
+	NAssignment *assn = dynamic_cast<NAssignment*>(stmt);
+	NIf *branch = dynamic_cast<NIf*>(stmt);
+	NLoop *loop = dynamic_cast<NLoop*>(stmt);
+	Cell val;
+	GType type;
+	if(vdec){
+		frame.locals[vdec->id->name] = vdec->GetType(frame.locals);
+		if(!vdec->assignmentExpr)
+			return true;
+		return evaluate(vdec->assignmentExpr,frame,folder,val,type) && assign(frame,vdec->id->name,val,type);
+	}
+	if(assn){
+		if(!assn->lhs || assn->array || assn->index)
+			return false;
+		if(assn->lhs->size() == 1)
+			return evaluate(assn->rhs,frame,folder,val,type) && assign(frame,assn->lhs->front()->name,val,type);
+		NMethodCall *call = dynamic_cast<NMethodCall*>(assn->rhs);
+		vector<Cell> outs;
+		vector<GType> types;
+		if(!call || !invoke(call,frame,folder,outs,types) || outs.size() != assn->lhs->size())
+			return false;
+		int i=0;
+		for(IdList::iterator it = assn->lhs->begin(); it != assn->lhs->end(); it++, i++)
+			if(!assign(frame,(*it)->name,outs[i],types[i]))
+				return false;
+		return true;
+	}
+	if(branch){
+		if(!evaluate(branch->cond,frame,folder,val,type))
+			return false;
+		if(convert_cell(val, type, GType(BOOL_TYPE,1,0)).i)
+			return run(branch->then,frame,folder);
+		return !branch->otherwise || run(branch->otherwise,frame,folder);
+	}
+	if(loop){
+		if(!execute(loop->init,frame,folder))
+			return false;
+		while(true){
+			if(!evaluate(loop->cond,frame,folder,val,type))
+				return false;
+			if(!convert_cell(val, type, GType(BOOL_TYPE,1,0)).i)
+				return true;
+			if(!run(loop->block,frame,folder) || !execute(loop->step,frame,folder))
+				return false;
+		}
+	}
+	//Builtins and anything writing arrays
+	return false;
+}
+
+static bool run(NBlock *block, Frame &frame, Folder &folder){
+	for(NodeList::iterator it = block->children.begin(); it != block->children.end(); it++)
+		if(!execute(*it,frame,folder))
+			return false;
+	return true;
+}
+
+//Puts node where old is in parent. False when parent holds no expression there
+static bool replace(Node *parent, Node *old, Node *node){
+	NBinaryOperator *binary = dynamic_cast<NBinaryOperator*>(parent);
+	NUnaryOperator *unary = dynamic_cast<NUnaryOperator*>(parent);
+	NSelect *select = dynamic_cast<NSelect*>(parent);
+	NCast *cast = dynamic_cast<NCast*>(parent);
+	NMethodCall *call = dynamic_cast<NMethodCall*>(parent);
+	NAssignment *assn = dynamic_cast<NAssignment*>(parent);
+	NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(parent);
+	NIf *branch = dynamic_cast<NIf*>(parent);
+	NLoop *loop = dynamic_cast<NLoop*>(parent);
+	if(binary)
+		binary->ReplaceOperand(old,node);
+	else if(unary)
+		unary->ReplaceOperand(old,node);
+	else if(select)
+		select->ReplaceOperand(old,node);
+	else if(cast)
+		cast->ReplaceOperand(old,node);
+	else if(call){
+		NodeList::iterator it = find(call->arguments->begin(), call->arguments->end(), old);
+		if(it == call->arguments->end())
+			return false;
+		call->ReplaceArgument(it,node);
+	}else if(assn && assn->rhs == old)
+		assn->SetExpr(node);
+	else if(vdec && vdec->assignmentExpr == old)
+		vdec->SetExpr(node);
+	else if(branch && branch->cond == old)
+		branch->SetCond(node);
+	else if(loop && loop->cond == old)
+		loop->SetCond(node);
+	else
+		return false;
+	return true;
+}
+
+//Every expression under node that only depends on literals becomes one. A select with a literal
+//predicate becomes the arm it picks
+static void fold(Node *node, Node *parent, Frame &frame, Folder &folder, int *count){
+	NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(node);
+	NAssignment *assn = dynamic_cast<NAssignment*>(node);
+	NSelect *select = dynamic_cast<NSelect*>(node);
+	if(vdec && vdec->id)
+		frame.locals[vdec->id->name] = vdec->GetType(frame.locals);
+
+	Cell val;
+	GType type;
+	folder.steps = 0;
+	if(evaluate(node,frame,folder,val,type)){
+		Node *lit = literal(val,type);
+		if(lit && text(lit) != text(node) && replace(parent,node,lit))
+			(*count)++;
+		return;
+	}
+
+	//Calls with several outputs are statements, each output gets an assignment of its own
+	NMethodCall *call = assn && assn->lhs && assn->lhs->size() > 1 ? dynamic_cast<NMethodCall*>(assn->rhs) : 0;
+	NBlock *block = dynamic_cast<NBlock*>(parent);
+	vector<Cell> outs;
+	vector<GType> types;
+	folder.steps = 0;
+	if(call && block && invoke(call,frame,folder,outs,types) && outs.size() == assn->lhs->size()){
+		vector<Node*> lits;
+		for(unsigned i=0; i < outs.size(); i++)
+			if(literal(outs[i],types[i]))
+				lits.push_back(literal(outs[i],types[i]));
+		if(lits.size() == outs.size()){
+			NodeList::iterator at = find(block->children.begin(), block->children.end(), node);
+			int i=0;
+			for(IdList::iterator it = assn->lhs->begin(); it != assn->lhs->end(); it++, i++)
+				block->add_child(at, new NAssignment(new IdList{(NIdentifier*)(*it)->clone()}, lits[i]));
+			block->children.erase(at);
+			(*count)++;
+			return;
+		}
+	}
+
+	NodeList children = node->children;
+	for(NodeList::iterator it = children.begin(); it != children.end(); it++)
+		fold(*it,node,frame,folder,count);
+
+	if(select && constant(select->pred,val,type) && typed(select,frame)){
+		Node *pick = convert_cell(val, type, GType(BOOL_TYPE,1,0)).i ? select->yes : select->no;
+		GType to = *select->GetType(frame.locals).begin();
+		GType from = *pick->GetType(frame.locals).begin();
+		if(from.type != to.type || from.length != to.length)
+			pick = new NCast(to.toNode(), pick);
+		if(replace(parent,select,pick))
+			(*count)++;
+	}
+}
+
+//Statements inserted by earlier passes don't always know their parent
+static void parents(Node *node, map<Node*,Node*> &found){
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++){
+		found[*it] = node;
+		parents(*it,found);
+	}
+}
+
+//Locals assigned a literal once, and nowhere else, become that literal wherever they are read
+static bool propagate(NFunctionDeclaration *decl, int *count){
+	set<string> mutated;
+	mutated_names(decl->block,mutated);
+	map<string,NVariableDeclaration*> decls;
+	map<string,int> assigned;
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it);
+		NAssignment *assn = dynamic_cast<NAssignment*>(*it);
+		if(vdec && vdec->id && !vdec->assignmentExpr && !mutated.count(vdec->id->name))
+			decls[vdec->id->name] = vdec;
+		if(assn && assn->lhs){
+			for(IdList::iterator it2 = assn->lhs->begin(); it2 != assn->lhs->end(); it2++)
+				assigned[(*it2)->name]++;
+		}
+	}
+
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++){
+		NAssignment *assn = dynamic_cast<NAssignment*>(*it);
+		Cell val;
+		GType type;
+		if(!assn || !assn->lhs || assn->lhs->size() != 1 || assn->array || assn->index || !constant(assn->rhs,val,type))
+			continue;
+		string name = assn->lhs->front()->name;
+		if(decls.find(name) == decls.end() || assigned[name] != 1)
+			continue;
+		GType to = *((Node*)decls[name])->GetType().begin();
+		val = convert_cell(val, type, to);
+		if(!literal(val,to))
+			continue;
+
+		IdList refs;
+		decl->block->GetIdRefs(refs);
+		map<Node*,Node*> parent;
+		parents(decl->block,parent);
+		bool all = true;
+		for(IdList::iterator it2 = refs.begin(); it2 != refs.end(); it2++){
+			if((*it2)->name != name || dynamic_cast<NArrayRef*>(*it2))
+				continue;
+			if(replace(parent[*it2],*it2,literal(val,to)))
+				(*count)++;
+			else
+				all = false;
+		}
+		if(!all)
+			continue;
+		decl->block->children.remove(decls[name]);
+		decl->block->children.erase(it);
+		return true;
+	}
+	return false;
+}
+
+//Constant folding over the SSA form. Whatever only depends on literals is computed now, calls to
+//functions of the program included, and locals that end up holding a literal are replaced by it
+void fold_constants(NBlock *pb){
+	Folder folder;
+	folder.depth = 0;
+	for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); it++){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(!decl || !decl->returns)
+			continue;
+		map<string,GTypeList> locals;
+		folder.results[decl->id->name] = decl->GetType(locals);
+		if(decl->isScalar())
+			folder.functions[decl->id->name] = decl;
+	}
+
+	int count=0;
+	for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); it++){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(!decl || !decl->returns)
+			continue;
+		do{
+			Frame frame;
+			frame.locals = folder.results;
+			for(VariableList::iterator it2 = decl->arguments->begin(); it2 != decl->arguments->end(); it2++)
+				frame.locals[(*it2)->id->name] = ((Node*)*it2)->GetType();
+			for(VariableList::iterator it2 = decl->returns->begin(); it2 != decl->returns->end(); it2++)
+				frame.locals[(*it2)->id->name] = ((Node*)*it2)->GetType();
+			fold(decl->block,decl,frame,folder,&count);
+			//Pipeline stage bodies skip to_ssa, their expressions are folded but locals aren't propagated
+		}while(decl->isScalar() && !decl->isGenerated && propagate(decl,&count));
+	}
+	cout << "Folded " << count << " constant expressions\n";
+}
@@ -0,0 +1,185 @@
+/* 
+GPiler - generic.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "node.h"
+
+using namespace std;
+
+//Generic functions, taken out of the program since nothing can be typed until they are instantiated
+static map<string,NFunctionDeclaration*> generics;
+//Every instance made so far, by the name calls to it use
+static map<string,NFunctionDeclaration*> instances;
+
+static void instantiate(NBlock *pb, Node *node, map<string,GTypeList> &locals);
+
+//Return types of every function in the program, calls have these types
+static void function_types(NBlock *pb, map<string,GTypeList> &locals){
+	for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); it++){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(decl && decl->returns)
+			locals[decl->id->name] = decl->GetType(locals);
+	}
+}
+
+static void add_variables(VariableList *vars, map<string,GTypeList> &locals){
+	if(!vars)
+		return;
+	for(VariableList::iterator it = vars->begin(); it != vars->end(); it++){
+		if((*it)->id)
+			locals[(*it)->id->name] = ((Node*)*it)->GetType();
+	}
+}
+
+static void instantiate_function(NBlock *pb, NFunctionDeclaration *decl){
+	map<string,GTypeList> locals;
+	function_types(pb, locals);
+	add_variables(decl->arguments, locals);
+	add_variables(decl->returns, locals);
+	instantiate(pb, decl->block, locals);
+}
+
+//Each type parameter becomes the type its arguments meet at, the same way operands of a binary
+//operator do. Parameters given a concrete type leave the argument to be converted by the call
+static map<string,GType> bind(NFunctionDeclaration *generic, NMethodCall *call, map<string,GTypeList> &locals){
+	map<string,GType> bound;
+	if(generic->arguments->size() != call->arguments->size()){
+		cout << "Wrong number of arguments to generic function " << generic->id->name << "\n";
+		exit(-1);
+	}
+	NodeList::iterator arg = call->arguments->begin();
+	for(VariableList::iterator it = generic->arguments->begin(); it != generic->arguments->end(); it++, arg++){
+		string name = (*it)->types->front()->name;
+		int param = 0;
+		for(IdList::iterator it2 = generic->typeParams->begin(); it2 != generic->typeParams->end(); it2++)
+			param |= (*it2)->name == name;
+		if(!param)
+			continue;
+		GTypeList types = (*arg)->GetType(locals);
+		if(types.size() != 1){
+			cout << "Argument " << *(*it)->id << " of generic function " << generic->id->name << " needs a single value\n";
+			exit(-1);
+		}
+		GType type = types.front();
+		type.isArray = 0;
+		type.isPointer = 0;
+		if(bound.find(name) != bound.end())
+			type = promoteType(GTypeList{bound[name]}, GTypeList{type}).front();
+		bound[name] = type;
+	}
+	for(IdList::iterator it = generic->typeParams->begin(); it != generic->typeParams->end(); it++){
+		if(bound.find((*it)->name) == bound.end()){
+			cout << "Type " << (*it)->name << " of generic function " << generic->id->name << " is not given by any argument\n";
+			exit(-1);
+		}
+	}
+	return bound;
+}
+
+static void substitute(Node *node, map<string,GType> &bound){
+	NType *type = dynamic_cast<NType*>(node);
+	NCast *cast = dynamic_cast<NCast*>(node);
+	if(type && bound.find(type->name) != bound.end())
+		type->name = bound[type->name].toNode()->name;
+	//The type of a cast is not one of its children
+	if(cast)
+		substitute(cast->type, bound);
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		substitute(*it, bound);
+}
+
+//The instance of generic for the types bound, made the first time it is asked for
+static NFunctionDeclaration *instance(NBlock *pb, NFunctionDeclaration *generic, map<string,GType> &bound){
+	string name = generic->id->name;
+	for(IdList::iterator it = generic->typeParams->begin(); it != generic->typeParams->end(); it++)
+		name += "_" + bound[(*it)->name].toNode()->name;
+	if(instances.find(name) != instances.end())
+		return instances[name];
+
+	for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); it++){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(decl && decl->id->name == name){
+			cout << "Function " << name << " clashes with an instance of generic function " << generic->id->name << "\n";
+			exit(-1);
+		}
+	}
+
+	NFunctionDeclaration *decl = (NFunctionDeclaration*)generic->clone();
+	delete decl->typeParams;
+	decl->typeParams = 0;
+	decl->id->name = name;
+	substitute(decl, bound);
+	//Cached before its body is looked at so a generic function can call itself
+	instances[name] = decl;
+	pb->add_child(decl);
+	instantiate_function(pb, decl);
+	cout << "Instantiated " << name << "\n";
+	return decl;
+}
+
+//Calls to generic functions are pointed at the instance for the types of their arguments. Pipelines
+//are left alone, every map stage is instantiated as its function is extracted
+static void instantiate(NBlock *pb, Node *node, map<string,GTypeList> &locals){
+	if(dynamic_cast<NPipeLine*>(node) || dynamic_cast<NMap*>(node))
+		return;
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		instantiate(pb, *it, locals);
+
+	NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(node);
+	if(vdec && vdec->id)
+		locals[vdec->id->name] = vdec->GetType(locals);
+
+	NMethodCall *call = dynamic_cast<NMethodCall*>(node);
+	if(call && generics.find(call->id->name) != generics.end()){
+		map<string,GType> bound = bind(generics[call->id->name], call, locals);
+		NFunctionDeclaration *decl = instance(pb, generics[call->id->name], bound);
+		call->id->name = decl->id->name;
+		locals[decl->id->name] = decl->GetType(locals);
+	}
+}
+
+void instantiate_calls(NBlock *pb, Node *node, VariableList *vars){
+	map<string,GTypeList> locals;
+	function_types(pb, locals);
+	add_variables(vars, locals);
+	instantiate(pb, node, locals);
+}
+
+void instantiate_generics(NBlock *pb){
+	for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); ){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(decl && decl->typeParams){
+			for(IdList::iterator it2 = decl->typeParams->begin(); it2 != decl->typeParams->end(); it2++){
+				if(isTypeName((*it2)->name)){
+					cout << "Type parameter " << (*it2)->name << " of " << decl->id->name << " names a type\n";
+					exit(-1);
+				}
+			}
+			generics[decl->id->name] = decl;
+			it = pb->children.erase(it);
+		}else
+			it++;
+	}
+
+	//Instances are added to the end of the program as they are made, so they get visited too
+	for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); it++){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(decl)
+			instantiate_function(pb, decl);
+	}
+}
@@ -0,0 +1,712 @@
+/* 
+GPiler - interp.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "interp.h"
+#include "parser.hpp"
+#include "cpu/launch.h"
+
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+using namespace std;
+
+#define EXPR_CONST	0
+#define EXPR_LOAD	1	//variable, through the pointer if it is one
+#define EXPR_ELEM	2	//array element
+#define EXPR_BINARY	3
+#define EXPR_SELECT	4
+#define EXPR_ADDR	5	//&var, only as a call argument
+#define EXPR_CAST	6
+#define EXPR_UNARY	7
+
+#define STMT_ASSIGN	0
+#define STMT_STORE	1	//array element
+#define STMT_CALL	2
+#define STMT_IF		3
+#define STMT_LOOP	4	//while value holds
+
+//Frames live on one stack so pointer arguments stay valid, this bounds the call depth
+#define STACK_CELLS	65536
+#define MAX_ARGS	64
+
+struct Expr {
+	int kind;
+	GType type;
+	int slot, op;
+	bool pointer;
+	Cell value;
+	Expr *a, *b, *c;
+	SelectCount *count; //where a select's outcomes are recorded, if anywhere
+	int bound; //slot of the length a gathered element's index is checked against, -1 for none
+	string array;
+};
+
+struct Stmt {
+	int kind;
+	GType type; //of the destination
+	int slot;
+	bool pointer;
+	Expr *value, *index;
+	int bound; //as for an element
+	string array;
+	Proc *callee;
+	vector<Expr*> args;
+	vector<Stmt*> body, other; //of an if or loop, other is the else
+};
+
+static GType first(GTypeList types){
+	if(types.empty()){
+		cout << "Interpreter found an expression without a type\n";
+		exit(-1);
+	}
+	return *types.begin();
+}
+
+//Integers wrap at their own width, like the generated code
+static long long wrap(long long val, GType type){
+	if(type.type == BOOL_TYPE)
+		return val != 0;
+	if(type.type == UINT_TYPE){
+		switch(type.length){
+			case 8: return (uint8_t)val;
+			case 16: return (uint16_t)val;
+			case 32: return (uint32_t)val;
+		}
+		return val;
+	}
+	switch(type.length){
+		case 8: return (int8_t)val;
+		case 16: return (int16_t)val;
+		case 32: return (int32_t)val;
+	}
+	return val;
+}
+
+//IEEE half precision, only ever the storage format. Rounds to nearest, flushes what is too small
+static uint16_t toHalf(float val){
+	uint32_t bits;
+	memcpy(&bits, &val, 4);
+	uint16_t sign = (bits >> 16) & 0x8000;
+	int exp = ((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mant = bits & 0x7fffff;
+	if(((bits >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	if(exp >= 31)
+		return sign | 0x7c00;
+	if(exp <= 0){
+		if(exp < -10)
+			return sign;
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		uint32_t half = mant >> shift, rest = mant & ((1 << shift) - 1), mid = 1 << (shift - 1);
+		if(rest > mid || (rest == mid && (half & 1)))
+			half++;
+		return sign | half;
+	}
+	uint32_t half = (exp << 10) | (mant >> 13), rest = mant & 0x1fff;
+	if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;
+	return sign | half;
+}
+
+static float fromHalf(uint16_t half){
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	int exp = (half >> 10) & 0x1f;
+	uint32_t mant = half & 0x3ff, bits;
+	if(exp == 0x1f)
+		bits = sign | 0x7f800000 | (mant << 13);
+	else if(exp == 0){
+		float val = ldexpf(mant, -24);
+		return sign ? -val : val;
+	}else
+		bits = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+	float ret;
+	memcpy(&ret, &bits, 4);
+	return ret;
+}
+
+//Floats are carried as doubles and rounded to their own width after every operation
+static double narrow(double val, GType type){
+	if(type.length == 32)
+		return (float)val;
+	if(type.length == 16)
+		return fromHalf(toHalf(val));
+	return val;
+}
+
+Cell convert_cell(Cell val, GType from, GType to){
+	Cell ret;
+	if(to.type == BOOL_TYPE)
+		ret.i = from.type == FLOAT_TYPE ? val.d != 0 : val.i != 0;
+	else if(to.type == FLOAT_TYPE){
+		if(from.type == FLOAT_TYPE)
+			ret.d = val.d;
+		else
+			ret.d = from.type == INT_TYPE ? (double)val.i : (double)(unsigned long long)val.i;
+		ret.d = narrow(ret.d, to);
+	}else if(from.type == FLOAT_TYPE)
+		ret.i = wrap(to.type == UINT_TYPE ? (long long)(unsigned long long)val.d : (long long)val.d, to);
+	else
+		ret.i = wrap(val.i, to);
+	return ret;
+}
+
+static int elemSize(GType type){
+	return type.length < 8 ? 1 : type.length / 8;
+}
+
+static Cell load(void *base, long long idx, GType type){
+	char *ptr = (char*)base + idx * elemSize(type);
+	Cell ret;
+	if(type.type == FLOAT_TYPE){
+		switch(type.length){
+			case 16: ret.d = fromHalf(*(uint16_t*)ptr); break;
+			case 32: ret.d = *(float*)ptr; break;
+			default: ret.d = *(double*)ptr; break;
+		}
+		return ret;
+	}
+	switch(elemSize(type)){
+		case 1: ret.i = type.type == BOOL_TYPE ? (*(uint8_t*)ptr != 0) : *(int8_t*)ptr; break;
+		case 2: ret.i = *(int16_t*)ptr; break;
+		case 4: ret.i = *(int32_t*)ptr; break;
+		default: ret.i = *(int64_t*)ptr; break;
+	}
+	ret.i = wrap(ret.i, type);
+	return ret;
+}
+
+void store_cell(void *base, long long idx, GType type, Cell val){
+	char *ptr = (char*)base + idx * elemSize(type);
+	if(type.type == FLOAT_TYPE){
+		switch(type.length){
+			case 16: *(uint16_t*)ptr = toHalf(val.d); break;
+			case 32: *(float*)ptr = val.d; break;
+			default: *(double*)ptr = val.d; break;
+		}
+		return;
+	}
+	switch(elemSize(type)){
+		case 1: *(int8_t*)ptr = val.i; break;
+		case 2: *(int16_t*)ptr = val.i; break;
+		case 4: *(int32_t*)ptr = val.i; break;
+		default: *(int64_t*)ptr = val.i; break;
+	}
+}
+
+long long load_size(void *ptr){
+	return indexBits == 64 ? *(int64_t*)ptr : *(int32_t*)ptr;
+}
+
+void store_size(void *ptr, long long n){
+	if(indexBits == 64)
+		*(int64_t*)ptr = n;
+	else
+		*(int32_t*)ptr = n;
+}
+
+static bool truth(Cell val, GType type){
+	return type.type == FLOAT_TYPE ? val.d != 0 : val.i != 0;
+}
+
+Interpreter::Interpreter(NBlock *program, Profile *record) : record(record), stack(STACK_CELLS), top(0) {
+	//Every function gets its Proc first so calls can be resolved in any order
+	for(NodeList::iterator it = program->children.begin(); it != program->children.end(); it++){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(decl){
+			procs[decl->id->name] = new Proc();
+			procs[decl->id->name]->name = decl->id->name;
+		}
+	}
+	for(NodeList::iterator it = program->children.begin(); it != program->children.end(); it++){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(decl)
+			compile(decl);
+	}
+}
+
+static int slotOf(Proc *proc, map<string,int> &slots, string name){
+	if(slots.find(name) == slots.end()){
+		cout << "Interpreter: undeclared variable " << name << " in " << proc->name << "\n";
+		exit(-1);
+	}
+	return slots[name];
+}
+
+//Slot of the length add_bounds passes for an array gathered from or scattered to, -1 if ref is at idx
+static int bound(NArrayRef *ref, map<string,int> &slots){
+	if(ref->index->name == "idx" || slots.find(ref->name + ".size") == slots.end())
+		return -1;
+	return slots[ref->name + ".size"];
+}
+
+Expr *Interpreter::compileExpr(Proc *proc, Node *node, map<string,int> &slots, map<string,GTypeList> &locals){
+	Expr *ret = new Expr();
+	ret->a = ret->b = ret->c = 0;
+	ret->pointer = false;
+	ret->count = 0;
+	ret->bound = -1;
+
+	NInteger *integer = dynamic_cast<NInteger*>(node);
+	NDouble *dbl = dynamic_cast<NDouble*>(node);
+	NArrayRef *ref = dynamic_cast<NArrayRef*>(node);
+	NIdentifier *id = dynamic_cast<NIdentifier*>(node);
+	NBinaryOperator *binary = dynamic_cast<NBinaryOperator*>(node);
+	NUnaryOperator *unary = dynamic_cast<NUnaryOperator*>(node);
+	NSelect *select = dynamic_cast<NSelect*>(node);
+	NRef *addr = dynamic_cast<NRef*>(node);
+	NCast *cast = dynamic_cast<NCast*>(node);
+	if(integer){
+		ret->kind = EXPR_CONST;
+		ret->type = GType(INT_TYPE,32,0);
+		ret->value.i = wrap(integer->value, ret->type);
+	}else if(dbl){
+		ret->kind = EXPR_CONST;
+		ret->type = GType(FLOAT_TYPE,64,0);
+		ret->value.d = dbl->value;
+	}else if(ref){
+		ret->kind = EXPR_ELEM;
+		ret->type = first(ref->GetType(locals));
+		ret->slot = slotOf(proc,slots,ref->name);
+		ret->a = compileExpr(proc,ref->index,slots,locals);
+		ret->bound = bound(ref,slots);
+		ret->array = ref->name;
+	}else if(id){
+		GType type = first(locals[id->name]);
+		ret->kind = EXPR_LOAD;
+		ret->slot = slotOf(proc,slots,id->name);
+		ret->pointer = type.isPointer;
+		ret->type = type;
+		ret->type.isPointer = 0;
+	}else if(binary){
+		ret->kind = EXPR_BINARY;
+		ret->op = binary->op;
+		ret->type = first(binary->GetType(locals));
+		ret->a = compileExpr(proc,binary->lhs,slots,locals);
+		ret->b = compileExpr(proc,binary->rhs,slots,locals);
+	}else if(unary){
+		ret->kind = EXPR_UNARY;
+		ret->op = unary->op;
+		ret->type = first(unary->GetType(locals));
+		ret->a = compileExpr(proc,unary->exp,slots,locals);
+	}else if(select){
+		ret->kind = EXPR_SELECT;
+		ret->type = first(select->GetType(locals));
+		ret->a = compileExpr(proc,select->pred,slots,locals);
+		ret->b = compileExpr(proc,select->yes,slots,locals);
+		ret->c = compileExpr(proc,select->no,slots,locals);
+		if(record)
+			ret->count = &record->selects[selectIds[select]];
+	}else if(addr){
+		ret->kind = EXPR_ADDR;
+		ret->slot = slotOf(proc,slots,addr->exp->name);
+		ret->pointer = first(locals[addr->exp->name]).isPointer;
+	}else if(cast){
+		ret->kind = EXPR_CAST;
+		ret->type = first(cast->GetType(locals));
+		ret->a = compileExpr(proc,cast->exp,slots,locals);
+	}else{
+		cout << "Interpreter can't evaluate " << typeid(*node).name() << "\n";
+		exit(-1);
+	}
+	return ret;
+}
+
+//Compiles node onto the end of out. Names are unique within a function, so nested blocks share
+//the slots of the function
+void Interpreter::compileStmt(Proc *proc, Node *node, map<string,int> &slots, map<string,GTypeList> &locals, vector<Stmt*> &out){
+	NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(node);
+	NAssignment *assn = dynamic_cast<NAssignment*>(node);
+	NMethodCall *call = dynamic_cast<NMethodCall*>(node);
+	NIf *branch = dynamic_cast<NIf*>(node);
+	NLoop *loop = dynamic_cast<NLoop*>(node);
+
+	Stmt *stmt = new Stmt();
+	stmt->value = stmt->index = 0;
+	stmt->bound = -1;
+	stmt->pointer = false;
+	if(vdec){
+		string name = vdec->id->name;
+		locals[name] = vdec->GetType(locals);
+		if(slots.find(name) == slots.end()){
+			int slot = slots.size();
+			slots[name] = slot;
+		}
+		if(!vdec->assignmentExpr){
+			delete stmt;
+			return;
+		}
+		stmt->kind = STMT_ASSIGN;
+		stmt->slot = slots[name];
+		stmt->type = first(locals[name]);
+		stmt->value = compileExpr(proc,vdec->assignmentExpr,slots,locals);
+	}else if(assn && assn->array){
+		stmt->kind = STMT_STORE;
+		stmt->slot = slotOf(proc,slots,assn->array->name);
+		stmt->type = first(assn->array->GetType(locals));
+		stmt->index = compileExpr(proc,assn->array->index,slots,locals);
+		stmt->bound = bound(assn->array,slots);
+		stmt->array = assn->array->name;
+		stmt->value = compileExpr(proc,assn->rhs,slots,locals);
+	}else if(assn){
+		if(assn->lhs->size() != 1){
+			cout << "Interpreter: assignment to " << assn->lhs->size() << " values left after rewrite_triads\n";
+			exit(-1);
+		}
+		string name = (*assn->lhs->begin())->name;
+		stmt->kind = STMT_ASSIGN;
+		stmt->slot = slotOf(proc,slots,name);
+		stmt->type = first(locals[name]);
+		stmt->pointer = stmt->type.isPointer;
+		stmt->value = compileExpr(proc,assn->rhs,slots,locals);
+	}else if(call){
+		stmt->kind = STMT_CALL;
+		if(procs.find(call->id->name) == procs.end()){
+			cout << "Interpreter: no such function " << call->id->name << "\n";
+			exit(-1);
+		}
+		stmt->callee = procs[call->id->name];
+		if(call->arguments->size() > MAX_ARGS){
+			cout << "Interpreter: too many arguments to " << call->id->name << "\n";
+			exit(-1);
+		}
+		for(NodeList::iterator it2 = call->arguments->begin(); it2 != call->arguments->end(); it2++)
+			stmt->args.push_back(compileExpr(proc,*it2,slots,locals));
+	}else if(branch){
+		stmt->kind = STMT_IF;
+		stmt->value = compileExpr(proc,branch->cond,slots,locals);
+		for(NodeList::iterator it = branch->then->children.begin(); it != branch->then->children.end(); it++)
+			compileStmt(proc,*it,slots,locals,stmt->body);
+		if(branch->otherwise){
+			for(NodeList::iterator it = branch->otherwise->children.begin(); it != branch->otherwise->children.end(); it++)
+				compileStmt(proc,*it,slots,locals,stmt->other);
+		}
+	}else if(loop){
+		//The counter is set up ahead of the loop, the step runs at the end of every trip
+		compileStmt(proc,loop->init,slots,locals,out);
+		stmt->kind = STMT_LOOP;
+		stmt->value = compileExpr(proc,loop->cond,slots,locals);
+		for(NodeList::iterator it = loop->block->children.begin(); it != loop->block->children.end(); it++)
+			compileStmt(proc,*it,slots,locals,stmt->body);
+		compileStmt(proc,loop->step,slots,locals,stmt->body);
+	}else{
+		cout << "Interpreter can't run " << typeid(*node).name() << "\n";
+		exit(-1);
+	}
+	out.push_back(stmt);
+}
+
+Proc *Interpreter::compile(NFunctionDeclaration *decl){
+	Proc *proc = procs[decl->id->name];
+	map<string,int> slots;
+	map<string,GTypeList> locals;
+	selectIds.clear();
+	number_selects(decl->block,decl->id->name,selectIds);
+
+	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++){
+		string name = (*it)->id->name;
+		locals[name] = (*it)->GetType(locals);
+		int slot = slots.size();
+		slots[name] = slot;
+		proc->params.push_back(slot);
+		proc->paramTypes.push_back(first(locals[name]));
+	}
+
+	for(NodeList::iterator it = decl->block->children.begin(); it != decl->block->children.end(); it++)
+		compileStmt(proc,*it,slots,locals,proc->body);
+	proc->nslots = slots.size();
+	return proc;
+}
+
+//Value of an element's index, stopping the program when it is outside the array
+long long Interpreter::index(Expr *expr, int bound, const string &array, Cell *frame){
+	long long i = eval(expr,frame).i;
+	if(bound >= 0 && (unsigned long long)i >= (unsigned long long)frame[bound].i)
+		gpl_index_error(array.c_str(), i, frame[bound].i);
+	return i;
+}
+
+Cell Interpreter::eval(Expr *expr, Cell *frame){
+	Cell ret;
+	switch(expr->kind){
+		case EXPR_CONST:
+			return expr->value;
+		case EXPR_LOAD:
+			return expr->pointer ? *frame[expr->slot].ref : frame[expr->slot];
+		case EXPR_ADDR:
+			ret.ref = expr->pointer ? frame[expr->slot].ref : &frame[expr->slot];
+			return ret;
+		case EXPR_ELEM:
+			return load(frame[expr->slot].p, index(expr->a, expr->bound, expr->array, frame), expr->type);
+		case EXPR_SELECT: {
+			bool pred = truth(eval(expr->a,frame), expr->a->type);
+			if(expr->count){
+				expr->count->total++;
+				expr->count->yes += pred;
+			}
+			Expr *pick = pred ? expr->b : expr->c;
+			return convert_cell(eval(pick,frame), pick->type, expr->type);
+		}
+		case EXPR_CAST:
+			return convert_cell(eval(expr->a,frame), expr->a->type, expr->type);
+		case EXPR_UNARY:
+			return unary_cell(expr->op, expr->type, eval(expr->a,frame), expr->a->type);
+		case EXPR_BINARY:
+			break;
+	}
+	return binary_cell(expr->op, expr->type, eval(expr->a,frame), expr->a->type, eval(expr->b,frame), expr->b->type);
+}
+
+Cell binary_cell(int op, GType type, Cell lval, GType ltype, Cell rval, GType rtype){
+	Cell ret;
+	//Same promotion as codegen, both sides are brought to the type they meet at first
+	GType common = *promoteType(GTypeList{ltype},GTypeList{rtype}).begin();
+	Cell l = convert_cell(lval, ltype, common);
+	Cell r = convert_cell(rval, rtype, common);
+	if(common.type == FLOAT_TYPE){
+		double a = l.d, b = r.d;
+		switch(op){
+			case TPLUS: ret.d = a + b; break;
+			case TMINUS: ret.d = a - b; break;
+			case TMUL: ret.d = a * b; break;
+			case TDIV: ret.d = a / b; break;
+			case TCGT: ret.i = a > b; return ret;
+			case TCLT: ret.i = a < b; return ret;
+			case TCGE: ret.i = a >= b; return ret;
+			case TCLE: ret.i = a <= b; return ret;
+			case TCEQ: ret.i = a == b; return ret;
+			case TCNE: ret.i = a < b || a > b; return ret;
+			default: cout << "Unknown FP op\n"; exit(-1);
+		}
+		ret.d = narrow(ret.d, type);
+		return ret;
+	}
+
+	long long a = l.i, b = r.i;
+	if(common.type == UINT_TYPE || common.type == BOOL_TYPE){
+		//Values are kept zero extended, so only division and the orderings care
+		unsigned long long ua = a, ub = b;
+		switch(op){
+			case TDIV: ret.i = wrap(ub ? ua / ub : 0, type); return ret;
+			case TCGT: ret.i = ua > ub; return ret;
+			case TCLT: ret.i = ua < ub; return ret;
+			case TCGE: ret.i = ua >= ub; return ret;
+			case TCLE: ret.i = ua <= ub; return ret;
+		}
+	}
+	switch(op){
+		case TPLUS: ret.i = a + b; break;
+		case TMINUS: ret.i = a - b; break;
+		case TMUL: ret.i = a * b; break;
+		case TDIV: ret.i = b ? a / b : 0; break;
+		case TOR: ret.i = a | b; break;
+		case TAND: ret.i = a & b; break;
+		case TLSL: ret.i = a << b; break;
+		case TLSR: ret.i = (long long)((unsigned long long)a & (type.length >= 64 ? ~0ULL : (1ULL << type.length) - 1)) >> b; break;
+		case TCGT: ret.i = a > b; return ret;
+		case TCLT: ret.i = a < b; return ret;
+		case TCGE: ret.i = a >= b; return ret;
+		case TCLE: ret.i = a <= b; return ret;
+		case TCEQ: ret.i = a == b; return ret;
+		case TCNE: ret.i = a != b; return ret;
+		default: cout << "Unknown op\n"; exit(-1);
+	}
+	ret.i = wrap(ret.i, type);
+	return ret;
+}
+
+Cell unary_cell(int op, GType type, Cell val, GType vtype){
+	Cell ret = convert_cell(val, vtype, type);
+	if(type.type == FLOAT_TYPE)
+		ret.d = -ret.d;
+	else
+		ret.i = wrap(-ret.i, type);
+	return ret;
+}
+
+void Interpreter::exec(Stmt *stmt, Cell *frame){
+	switch(stmt->kind){
+		case STMT_ASSIGN: {
+			Cell val = convert_cell(eval(stmt->value,frame), stmt->value->type, stmt->type);
+			if(stmt->pointer)
+				*frame[stmt->slot].ref = val;
+			else
+				frame[stmt->slot] = val;
+			break;
+		}
+		case STMT_STORE: {
+			Cell val = convert_cell(eval(stmt->value,frame), stmt->value->type, stmt->type);
+			store_cell(frame[stmt->slot].p, index(stmt->index, stmt->bound, stmt->array, frame), stmt->type, val);
+			break;
+		}
+		case STMT_IF:
+			run(truth(eval(stmt->value,frame), stmt->value->type) ? stmt->body : stmt->other, frame);
+			break;
+		case STMT_LOOP:
+			while(truth(eval(stmt->value,frame), stmt->value->type))
+				run(stmt->body, frame);
+			break;
+		case STMT_CALL: {
+			Proc *callee = stmt->callee;
+			Cell args[MAX_ARGS];
+			for(unsigned i=0; i < stmt->args.size(); i++){
+				Expr *arg = stmt->args[i];
+				args[i] = eval(arg,frame);
+				if(arg->kind != EXPR_ADDR && !callee->paramTypes[i].isArray)
+					args[i] = convert_cell(args[i], arg->type, callee->paramTypes[i]);
+			}
+			call(callee,args);
+			break;
+		}
+	}
+}
+
+void Interpreter::call(Proc *proc, Cell *args){
+	if(top + proc->nslots > stack.size()){
+		cout << "Interpreter stack overflow in " << proc->name << "\n";
+		exit(-1);
+	}
+	Cell *frame = &stack[top];
+	top += proc->nslots;
+	for(unsigned i=0; i < proc->params.size(); i++)
+		frame[proc->params[i]] = args[i];
+	run(proc->body,frame);
+	top -= proc->nslots;
+}
+
+void Interpreter::run(vector<Stmt*> &stmts, Cell *frame){
+	for(vector<Stmt*>::iterator it = stmts.begin(); it != stmts.end(); it++)
+		exec(*it,frame);
+}
+
+long long Interpreter::Elements(RuntimePlan *plan, void **params){
+	long long most=0;
+	int k=2*plan->outputs.size();
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++){
+		if((*(*it)->types->begin())->isArray){
+			long long n = load_size(params[k+1]);
+			most = MAX(most, n);
+			k += 2;
+		}else
+			k++;
+	}
+	return most;
+}
+
+//Walks the plan the same way the generated launcher does
+void Interpreter::Run(RuntimePlan *plan, void **params){
+	map<string,Cell> vals;
+	map<string,long long> sizes;
+	map<string,void*> sizeOut;
+	map<string,GType> scalarOut;
+
+	int k=0;
+	for(VariableList::iterator it = plan->outputs.begin(); it != plan->outputs.end(); it++){
+		string name = (*it)->id->name;
+		GType type = first(((Node*)*it)->GetType());
+		vals[name].p = *(void**)params[k++];
+		sizeOut[name] = *(void**)params[k++];
+		if(!type.isArray)
+			scalarOut[name] = type;
+	}
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++){
+		string name = (*it)->id->name;
+		GType type = first(((Node*)*it)->GetType());
+		if(type.isArray){
+			vals[name].p = *(void**)params[k++];
+			sizes[name] = load_size(params[k++]);
+		}else
+			vals[name] = load(params[k++],0,type);
+	}
+
+	map<string,NVariableDeclaration*> decls;
+	for(FunctionList::iterator it = plan->order.begin(); it != plan->order.end(); it++){
+		for(VariableList::iterator it2 = (*it)->arguments->begin(); it2 != (*it)->arguments->end(); it2++)
+			decls[(*it2)->id->name] = *it2;
+		for(VariableList::iterator it2 = (*it)->returns->begin(); it2 != (*it)->returns->end(); it2++)
+			decls[(*it2)->id->name] = *it2;
+	}
+
+	vector<void*> slots;
+	long long most = Elements(plan,params);
+	for(unsigned i=0; i < plan->pool.size(); i++)
+		slots.push_back(gpl_alloc((int64_t)most * plan->pool[i].elemBytes));
+	for(map<string,int>::iterator it = plan->slots.begin(); it != plan->slots.end(); it++)
+		vals[it->first].p = slots[it->second];
+
+	//Scalar outputs are written through a cell and copied out at the end
+	map<string,Cell> scalars;
+	for(map<string,GType>::iterator it = scalarOut.begin(); it != scalarOut.end(); it++)
+		scalars[it->first].i = 0;
+
+	for(FunctionList::iterator it = plan->order.begin(); it != plan->order.end(); it++){
+		NFunctionDeclaration *decl = *it;
+		string name = decl->id->name;
+		list<string> &writes = plan->writes[name];
+
+		if(plan->compactions.count(decl)){
+			VariableList::iterator arg = decl->arguments->begin();
+			string in = (*arg)->id->name, mask = (*++arg)->id->name, out = writes.front();
+			sizes[out] = gpl_compact(vals[out].p, vals[in].p, (bool*)vals[mask].p, sizes[in], elemBytes(decls[out]));
+			if(record){
+				record->filters[name].in += sizes[in];
+				record->filters[name].out += sizes[out];
+			}
+			continue;
+		}
+
+		long long n = sizes[plan->launchSize[name]];
+		for(list<string>::iterator it2 = writes.begin(); it2 != writes.end(); it2++)
+			sizes[*it2] = n;
+
+		Proc *proc = procs[name];
+		vector<Cell> args(proc->params.size());
+		VariableList::iterator arg = decl->arguments->begin();
+		for(int i=1; ++arg != decl->arguments->end(); i++){
+			string var = (*arg)->id->name, array = boundArray(decl,*arg);
+			if(array.size())
+				args[i].i = sizes[array];
+			else if(scalars.find(var) != scalars.end())
+				args[i].ref = &scalars[var];
+			else
+				args[i] = vals[var];
+		}
+
+		if(record){
+			record->kernels[name].calls++;
+			record->kernels[name].elements += n;
+		}
+		for(long long idx=0; idx < n; idx++){
+			args[0].i = idx;
+			call(proc,&args[0]);
+		}
+	}
+
+	for(VariableList::iterator it = plan->outputs.begin(); it != plan->outputs.end(); it++){
+		string name = (*it)->id->name;
+		if(scalarOut.find(name) != scalarOut.end()){
+			store_cell(vals[name].p, 0, scalarOut[name], scalars[name]);
+			store_size(sizeOut[name], 1);
+		}else
+			store_size(sizeOut[name], sizes[name]);
+	}
+	for(unsigned i=0; i < slots.size(); i++)
+		gpl_free(slots[i]);
+}
@@ -0,0 +1,93 @@
+/* 
+GPiler - interp.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef GPL_INTERP_H
+#define GPL_INTERP_H
+
+#include "node.h"
+#include "runtime.h"
+#include "profile.h"
+
+#include <vector>
+
+//One variable of an interpreted function. Integers of every width are kept sign extended in i,
+//float and double in d, arrays are a raw pointer and pointer arguments point at the caller's cell
+union Cell {
+	long long i;
+	double d;
+	void *p;
+	Cell *ref;
+};
+
+//What the generated code does to values, for anything that has to evaluate the program ahead of it.
+//type is the type of the result
+Cell convert_cell(Cell val, GType from, GType to);
+Cell binary_cell(int op, GType type, Cell l, GType ltype, Cell r, GType rtype);
+Cell unary_cell(int op, GType type, Cell val, GType vtype);
+
+//Writes val as element idx of an array of type
+void store_cell(void *base, long long idx, GType type, Cell val);
+//Element counts as launchers pass them, indexBits wide
+long long load_size(void *ptr);
+void store_size(void *ptr, long long n);
+
+struct Expr;
+struct Stmt;
+
+//A function of the final AST with every variable resolved to a slot in its frame
+struct Proc {
+	string name;
+	int nslots;
+	vector<int> params;
+	vector<GType> paramTypes;
+	vector<Stmt*> body;
+};
+
+//Runs the program as it looks after rewrite_arrays, without going anywhere near LLVM. Meant for
+//inputs so small that compiling them costs more than the work itself
+class Interpreter {
+public:
+	//Counts kernel launches, filter selectivity and select outcomes into record unless it is 0
+	Interpreter(NBlock *program, Profile *record);
+
+	//params follows the convention of the generated launchers: a pointer to each launcher argument,
+	//outputs first as data and size pointer, then inputs as data and size or the scalar itself
+	void Run(RuntimePlan *plan, void **params);
+
+	//Elements in the longest input of a call, what the adaptive policy counts
+	static long long Elements(RuntimePlan *plan, void **params);
+
+private:
+	Proc *compile(NFunctionDeclaration *decl);
+	void compileStmt(Proc *proc, Node *node, map<string,int> &slots, map<string,GTypeList> &locals, vector<Stmt*> &out);
+	Expr *compileExpr(Proc *proc, Node *node, map<string,int> &slots, map<string,GTypeList> &locals);
+	void call(Proc *proc, Cell *args);
+	Cell eval(Expr *expr, Cell *frame);
+	long long index(Expr *expr, int bound, const string &array, Cell *frame);
+	void exec(Stmt *stmt, Cell *frame);
+	void run(vector<Stmt*> &stmts, Cell *frame);
+
+	Profile *record;
+	map<NSelect*,string> selectIds; //of the function being compiled
+	map<string,Proc*> procs;
+	vector<Cell> stack;
+	unsigned top;
+};
+
+#endif
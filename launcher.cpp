@@ -0,0 +1,626 @@
+/* 
+GPiler - launcher.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "node.h"
+#include "codegen.h"
+#include "runtime.h"
+
+#include <llvm/IR/Intrinsics.h>
+
+#include <algorithm>
+
+using namespace std;
+
+//Every plan gets a host function <target>_launch that allocates the intermediates, runs the
+//modules while working out the size of every array, and frees the pool again. On the CPU the modules
+//go to the runtime as a task graph, on the GPU they are launched one after another in plan order.
+//Arrays come in as pointer plus element count, outputs as pointer plus a pointer to store the count
+//Output buffers must not overlap any input, kernels are compiled assuming no two arrays alias
+
+//idx and every count a launcher hands around
+static Type *sizeType(){
+	return Type::getIntNTy(getGlobalContext(), indexBits);
+}
+
+//Counts going to and from the runtime, which is built once for either width
+static Type *countType(){
+	return Type::getInt64Ty(getGlobalContext());
+}
+
+static Value *resize(Value *val, Type *type, BasicBlock *block){
+	unsigned have = val->getType()->getIntegerBitWidth(), want = type->getIntegerBitWidth();
+	if(have < want)
+		return new SExtInst(val, type, "", block);
+	if(have > want)
+		return new TruncInst(val, type, "", block);
+	return val;
+}
+
+//Memory the runtime hands out lives in the same address space as kernel arrays
+static Type *bytePtrType(){
+	return PointerType::get(Type::getInt8Ty(getGlobalContext()),1);
+}
+
+static Function *runtimeFunction(Module *mod, const char *name, Type *ret, vector<Type*> args){
+	Function *func = mod->getFunction(name);
+	if(func)
+		return func;
+	return Function::Create(FunctionType::get(ret, makeArrayRef(args), false), GlobalValue::ExternalLinkage, name, mod);
+}
+
+//Entry points are called from C and ptx, neither allows a . in a name
+static string exportName(string name){
+	for(unsigned i=0; i < name.size(); i++){
+		if(name[i] == '.')
+			name[i] = '_';
+	}
+	return name;
+}
+
+static Value *getInt(int val){
+	return ConstantInt::get(sizeType(), val, true);
+}
+
+static Value *getInt32(int val){
+	return ConstantInt::get(Type::getInt32Ty(getGlobalContext()), val, true);
+}
+
+//Struct fields can only be picked with i32 constants
+static vector<Value*> indices(int a, int b){
+	vector<Value*> ret;
+	ret.push_back(getInt32(a));
+	ret.push_back(getInt32(b));
+	return ret;
+}
+
+//The generated range functions loop over [begin,end) calling the kernel, on the GPU the range is a grid stride.
+//With order the kernel gets element order[i] for step i instead, unless order turns out to be null
+static void emitLoop(Function *func, BasicBlock *entry, Value *begin, Value *end, Value *stride, Function *kernel, vector<Value*> params,
+			Value *order = 0){
+	LLVMContext &ctx = getGlobalContext();
+	BasicBlock *loop = BasicBlock::Create(ctx, "loop", func);
+	BasicBlock *body = BasicBlock::Create(ctx, "body", func);
+	BasicBlock *done = BasicBlock::Create(ctx, "done", func);
+	BranchInst::Create(loop, entry);
+
+	PHINode *idx = PHINode::Create(sizeType(), 2, "idx", loop);
+	idx->addIncoming(begin, entry);
+	Value *more = new ICmpInst(*loop, CmpInst::Predicate::ICMP_SLT, idx, end, "");
+	BranchInst::Create(body, done, more, loop);
+
+	Value *elem = idx;
+	if(order){
+		BasicBlock *permuted = BasicBlock::Create(ctx, "permuted", func);
+		BasicBlock *call = BasicBlock::Create(ctx, "call", func);
+		Value *none = new ICmpInst(*body, CmpInst::Predicate::ICMP_EQ, order,
+					ConstantPointerNull::get(cast<PointerType>(order->getType())), "");
+		BranchInst::Create(call, permuted, none, body);
+		Value *slot = GetElementPtrInst::Create(order, ArrayRef<Value*>(idx), "", permuted);
+		Value *at = resize(new LoadInst(slot, "", false, permuted), sizeType(), permuted);
+		BranchInst::Create(call, permuted);
+		PHINode *phi = PHINode::Create(sizeType(), 2, "elem", call);
+		phi->addIncoming(idx, body);
+		phi->addIncoming(at, permuted);
+		elem = phi;
+		body = call;
+	}
+	params.insert(params.begin(), elem);
+	CallInst::Create(kernel, makeArrayRef(params), "", body);
+	Value *next = BinaryOperator::Create(Instruction::Add, idx, stride, "", body);
+	idx->addIncoming(next, body);
+	BranchInst::Create(loop, body);
+
+	ReturnInst::Create(ctx, done);
+}
+
+#ifdef FOR_NV
+static void addEntryMetadata(Function *func){
+	LLVMContext &ctx = func->getContext();
+	NamedMDNode *md = func->getParent()->getOrInsertNamedMetadata("nvvm.annotations");
+	Value *vals[] = {func, MDString::get(ctx, "kernel"), ConstantInt::get(Type::getInt32Ty(ctx), 1)};
+	md->addOperand(MDNode::get(ctx, vals));
+}
+
+static Value *readSreg(Module *mod, Intrinsic::ID id, BasicBlock *block){
+	return CallInst::Create(Intrinsic::getDeclaration(mod, id), "", block);
+}
+
+//<kernel>_entry(<idx> n, args...), a grid stride loop over the kernel. The host picks the geometry
+static Function *entryFunction(CodeGenContext& context, Module *mod, Function *kernel){
+	LLVMContext &ctx = getGlobalContext();
+	vector<Type*> types{sizeType()};
+	FunctionType *ktype = kernel->getFunctionType();
+	for(unsigned i=1; i < ktype->getNumParams(); i++)
+		types.push_back(ktype->getParamType(i));
+	Function *func = Function::Create(FunctionType::get(Type::getVoidTy(ctx), makeArrayRef(types), false),
+				GlobalValue::ExternalLinkage, exportName(kernel->getName().str() + "_entry"), mod);
+	addEntryMetadata(func);
+	context.entryPoints.push_back(func);
+
+	Function::arg_iterator AI = func->arg_begin();
+	Value *n = AI++;
+	vector<Value*> params;
+	for(; AI != func->arg_end(); AI++)
+		params.push_back(AI);
+
+	BasicBlock *entry = BasicBlock::Create(ctx, "entry", func);
+	Value *tid = readSreg(mod, Intrinsic::nvvm_read_ptx_sreg_tid_x, entry);
+	Value *ntid = readSreg(mod, Intrinsic::nvvm_read_ptx_sreg_ntid_x, entry);
+	Value *ctaid = readSreg(mod, Intrinsic::nvvm_read_ptx_sreg_ctaid_x, entry);
+	Value *nctaid = readSreg(mod, Intrinsic::nvvm_read_ptx_sreg_nctaid_x, entry);
+	Value *first = BinaryOperator::Create(Instruction::Add,
+			BinaryOperator::Create(Instruction::Mul, ctaid, ntid, "", entry), tid, "", entry);
+	Value *stride = BinaryOperator::Create(Instruction::Mul, ntid, nctaid, "", entry);
+	first = resize(first, sizeType(), entry);
+	stride = resize(stride, sizeType(), entry);
+	emitLoop(func, entry, first, n, stride, kernel, params);
+	return func;
+}
+
+static Value *stringConstant(Module *mod, string str, BasicBlock *block){
+	Constant *data = ConstantDataArray::getString(getGlobalContext(), str);
+	GlobalVariable *var = new GlobalVariable(*mod, data->getType(), true, GlobalValue::PrivateLinkage, data, ".str");
+	return GetElementPtrInst::Create(var, indices(0,0), "", block);
+}
+
+//Runs one kernel over n elements, the arguments after idx are in params
+static void launchKernel(CodeGenContext& context, Function *kernel, vector<Value*> params, Value *n, BasicBlock *block){
+	LLVMContext &ctx = getGlobalContext();
+	Module *host = context.hostModule;
+	Type *i8p = Type::getInt8PtrTy(ctx);
+
+	//cuLaunchKernel wants a pointer to every argument, n goes first
+	Function *entry = entryFunction(context, context.module, kernel);
+	params.insert(params.begin(), n);
+	ArrayType *arrayTy = ArrayType::get(i8p, params.size());
+	Value *array = new AllocaInst(arrayTy, "params", block);
+	for(unsigned i=0; i < params.size(); i++){
+		Value *slot = new AllocaInst(params[i]->getType(), "", block);
+		new StoreInst(params[i], slot, false, block);
+		Value *gep = GetElementPtrInst::Create(array, indices(0,i), "", block);
+		new StoreInst(new BitCastInst(slot, i8p, "", block), gep, false, block);
+	}
+	Function *launch = runtimeFunction(host, "gpl_launch_device", Type::getVoidTy(ctx),
+				vector<Type*>{i8p, PointerType::get(i8p,0), Type::getInt32Ty(ctx), countType()});
+	Value *first = GetElementPtrInst::Create(array, indices(0,0), "", block);
+	vector<Value*> args{stringConstant(host, entry->getName(), block), first, getInt32(params.size()), resize(n, countType(), block)};
+	CallInst::Create(launch, makeArrayRef(args), "", block);
+}
+#else
+//void <kernel>.range(i64 begin, i64 end, i8* args), what the thread pool calls. A bucketed kernel has
+//its element order packed after the arguments
+static Function *rangeFunction(Module *mod, Function *kernel, StructType *packed, bool ordered){
+	LLVMContext &ctx = getGlobalContext();
+	vector<Type*> types{countType(), countType(), Type::getInt8PtrTy(ctx)};
+	Function *func = Function::Create(FunctionType::get(Type::getVoidTy(ctx), makeArrayRef(types), false),
+				GlobalValue::InternalLinkage, kernel->getName() + ".range", mod);
+	Function::arg_iterator AI = func->arg_begin();
+	Value *begin = AI++, *end = AI++, *user = AI++;
+
+	BasicBlock *entry = BasicBlock::Create(ctx, "entry", func);
+	Value *args = new BitCastInst(user, PointerType::get(packed,0), "", entry);
+	vector<Value*> params;
+	FunctionType *ktype = kernel->getFunctionType();
+	unsigned count = packed->getNumElements() - (ordered ? 1 : 0);
+	for(unsigned i=0; i < count; i++){
+		Value *gep = GetElementPtrInst::Create(args, indices(0,i), "", entry);
+		Value *param = new LoadInst(gep, "", false, entry);
+		//Lengths are packed as the count they are in, a compaction may only fill it in after queueing
+		if(param->getType() != ktype->getParamType(i+1))
+			param = resize(new LoadInst(param, "", false, entry), ktype->getParamType(i+1), entry);
+		params.push_back(param);
+	}
+	Value *order = 0;
+	if(ordered)
+		order = new LoadInst(GetElementPtrInst::Create(args, indices(0,count), "", entry), "order", false, entry);
+	begin = resize(begin, sizeType(), entry);
+	end = resize(end, sizeType(), entry);
+	emitLoop(func, entry, begin, end, getInt(1), kernel, params, order);
+	return func;
+}
+
+//Queues one kernel on graph over the count n points at, the arguments after idx are in params.
+//order, when there is one, is the element order gpl_graph_bucket worked out. Returns the task number
+static Value *queueKernel(CodeGenContext& context, Function *kernel, vector<Value*> params, Value *graph, Value *n, Value *order,
+			BasicBlock *block){
+	LLVMContext &ctx = getGlobalContext();
+	Module *host = context.hostModule;
+	Type *i8p = Type::getInt8PtrTy(ctx);
+
+	if(order)
+		params.push_back(order);
+	vector<Type*> types;
+	for(unsigned i=0; i < params.size(); i++)
+		types.push_back(params[i]->getType());
+	StructType *packed = StructType::get(ctx, makeArrayRef(types));
+	Function *range = rangeFunction(host, kernel, packed, order != 0);
+
+	//Every kernel gets its own, they are all read while the graph runs
+	Value *args = new AllocaInst(packed, "args", block);
+	for(unsigned i=0; i < params.size(); i++){
+		Value *gep = GetElementPtrInst::Create(args, indices(0,i), "", block);
+		new StoreInst(params[i], gep, false, block);
+	}
+	Function *queue = runtimeFunction(host, "gpl_graph_kernel", Type::getInt32Ty(ctx),
+				vector<Type*>{i8p, range->getType(), i8p, PointerType::get(countType(),0)});
+	vector<Value*> call{graph, range, new BitCastInst(args, i8p, "", block), n};
+	return CallInst::Create(queue, makeArrayRef(call), "", block);
+}
+#endif
+
+static Value *lookup(map<string,Value*> &vals, string name, RuntimePlan *plan){
+	if(vals.find(name) == vals.end()){
+		cout << "Launcher for " << plan->target->id->name << " has no value for " << name << "\n";
+		exit(-1);
+	}
+	return vals[name];
+}
+
+//True when every access node makes to name is element idx, chunk i of it then only touches chunk i
+static bool elementwise(Node *node, string name){
+	NArrayRef *ref = dynamic_cast<NArrayRef*>(node);
+	NIdentifier *id = dynamic_cast<NIdentifier*>(node);
+	if(ref && ref->name == name)
+		return ref->index->name == "idx";
+	if(id && id->name == name)
+		return false;
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++){
+		if(!elementwise(*it, name))
+			return false;
+	}
+	return true;
+}
+
+#ifndef FOR_NV
+//Arrays node gathers from or scatters to, with what it indexes them with
+static void indexed(Node *node, list<NArrayRef*> &refs){
+	NArrayRef *ref = dynamic_cast<NArrayRef*>(node);
+	if(ref && ref->index->name != "idx")
+		refs.push_back(ref);
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		indexed(*it, refs);
+}
+
+//An input column a gather or scatter of decl takes its index from as is, read at idx. The launcher
+//already has those, so it can sort the kernel's elements by the page they touch before it runs and
+//each worker stays within a few pages of the array. array is set to the array indexed. Indices worked
+//out inside the kernel are never seen by the launcher, those kernels run in idx order
+static string bucketColumn(NFunctionDeclaration *decl, RuntimePlan *plan, string *array){
+	set<string> columns;
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++){
+		if((*(*it)->types->begin())->isArray)
+			columns.insert((*it)->id->name);
+	}
+	list<NArrayRef*> refs;
+	indexed(decl->block, refs);
+	for(list<NArrayRef*>::iterator it = refs.begin(); it != refs.end(); it++){
+		for(NodeList::iterator it2 = decl->block->children.begin(); it2 != decl->block->children.end(); it2++){
+			NAssignment *assn = dynamic_cast<NAssignment*>(*it2);
+			if(!assn || !assn->lhs || assn->lhs->size() != 1 || assn->lhs->front()->name != (*it)->index->name)
+				continue;
+			NArrayRef *src = dynamic_cast<NArrayRef*>(assn->rhs);
+			if(src && src->index->name == "idx" && columns.count(src->name)){
+				*array = (*it)->name;
+				return src->name;
+			}
+		}
+	}
+	return "";
+}
+#endif
+
+//What a task has to wait for, by task number. Waiting on all of a task beats waiting on its chunks
+static void addDep(map<int,bool> &deps, int before, bool full){
+	deps[before] = deps.count(before) ? deps[before] || full : full;
+}
+
+static void generate_launcher(CodeGenContext& context, RuntimePlan *plan){
+	LLVMContext &ctx = getGlobalContext();
+	Module *host = context.hostModule;
+
+	vector<Type*> types;
+	for(VariableList::iterator it = plan->outputs.begin(); it != plan->outputs.end(); it++){
+		types.push_back((*(*it)->types->begin())->isArray ? typeOf(*it) : PointerType::get(typeOf(*it),0));
+		types.push_back(PointerType::get(sizeType(),0));
+	}
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++){
+		types.push_back(typeOf(*it));
+		if((*(*it)->types->begin())->isArray)
+			types.push_back(sizeType());
+	}
+	Function *func = Function::Create(FunctionType::get(Type::getVoidTy(ctx), makeArrayRef(types), false),
+				GlobalValue::ExternalLinkage, exportName(plan->target->id->name + "_launch"), host);
+	context.entryPoints.push_back(func);
+	context.launchers[plan] = func;
+	BasicBlock *block = BasicBlock::Create(ctx, "entry", func);
+
+	//Name the arguments and remember what they hold. Sizes are kept in memory as the runtime's counts,
+	//a kernel's count is only known once whatever compaction produces it has run
+	Type *i64 = Type::getInt64Ty(ctx);
+	map<string,Value*> vals, sizes, sizeOut;
+	Function::arg_iterator AI = func->arg_begin();
+	for(VariableList::iterator it = plan->outputs.begin(); it != plan->outputs.end(); it++){
+		string name = (*it)->id->name;
+		AI->setName(name);
+		vals[name] = AI++;
+		AI->setName(name + ".size");
+		sizeOut[name] = AI++;
+	}
+	Value *most = getInt(0);
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++){
+		string name = (*it)->id->name;
+		AI->setName(name);
+		vals[name] = AI++;
+		if((*(*it)->types->begin())->isArray){
+			AI->setName(name + ".size");
+			sizes[name] = new AllocaInst(countType(), name + ".count", block);
+			new StoreInst(resize(AI, countType(), block), sizes[name], false, block);
+			Value *bigger = new ICmpInst(*block, CmpInst::Predicate::ICMP_SGT, AI, most, "");
+			most = SelectInst::Create(bigger, AI, most, "", block);
+			AI++;
+		}
+	}
+
+	//Nothing grows past the biggest input, so that is what every pool slot is sized for
+	map<string,NVariableDeclaration*> decls;
+	for(FunctionList::iterator it = plan->order.begin(); it != plan->order.end(); it++){
+		for(VariableList::iterator it2 = (*it)->arguments->begin(); it2 != (*it)->arguments->end(); it2++)
+			decls[(*it2)->id->name] = *it2;
+		for(VariableList::iterator it2 = (*it)->returns->begin(); it2 != (*it)->returns->end(); it2++)
+			decls[(*it2)->id->name] = *it2;
+	}
+	Function *alloc = runtimeFunction(host, "gpl_alloc", bytePtrType(), vector<Type*>{i64});
+	Function *release = runtimeFunction(host, "gpl_free", Type::getVoidTy(ctx), vector<Type*>{bytePtrType()});
+	vector<Value*> slots;
+	Value *elems = resize(most, i64, block);
+	for(unsigned i=0; i < plan->pool.size(); i++){
+		Value *bytes = BinaryOperator::Create(Instruction::Mul, elems, ConstantInt::get(i64, plan->pool[i].elemBytes), "", block);
+		slots.push_back(CallInst::Create(alloc, ArrayRef<Value*>(bytes), "pool", block));
+	}
+	for(map<string,int>::iterator it = plan->slots.begin(); it != plan->slots.end(); it++)
+		vals[it->first] = new BitCastInst(slots[it->second], typeOf(decls[it->first]), it->first, block);
+
+#ifndef FOR_NV
+	//Every module is queued with what it waits for, then they all run at once. Modules of independent
+	//pipelines run side by side, a kernel reading another's output at idx follows it chunk by chunk
+	Type *i8p = Type::getInt8PtrTy(ctx);
+	Function *newGraph = runtimeFunction(host, "gpl_graph", i8p, vector<Type*>{countType()});
+	Value *graph = CallInst::Create(newGraph, ArrayRef<Value*>(elems), "graph", block);
+	vector<Value*> tasks;
+	vector<NFunctionDeclaration*> queued; //module behind each task
+	map<string,int> producer; //task writing each array
+	map<Value*,int> counter; //compaction filling each count
+	set<int> bucketed; //tasks running their elements out of idx order
+	vector<set<int> > slotUsers(plan->pool.size());
+#endif
+
+	for(FunctionList::iterator it = plan->order.begin(); it != plan->order.end(); it++){
+		NFunctionDeclaration *decl = *it;
+		string name = decl->id->name;
+		list<string> &writes = plan->writes[name];
+		bool compaction = plan->compactions.count(decl);
+
+		Value *n;
+		list<string> reads;
+		if(compaction){
+			//Arguments are the array and its mask, the count that survived is the new size
+			VariableList::iterator arg = decl->arguments->begin();
+			string in = (*arg)->id->name, mask = (*++arg)->id->name, out = writes.front();
+			reads.push_back(in);
+			reads.push_back(mask);
+			n = lookup(sizes,in,plan);
+			sizes[out] = new AllocaInst(countType(), out + ".count", block);
+
+			vector<Value*> args;
+			args.push_back(new BitCastInst(lookup(vals,out,plan), bytePtrType(), "", block));
+			args.push_back(new BitCastInst(lookup(vals,in,plan), bytePtrType(), "", block));
+			args.push_back(new BitCastInst(lookup(vals,mask,plan), bytePtrType(), "", block));
+#ifdef FOR_NV
+			Function *compact = runtimeFunction(host, "gpl_compact", countType(),
+						vector<Type*>{bytePtrType(), bytePtrType(), bytePtrType(), countType(), Type::getInt32Ty(ctx)});
+			args.push_back(new LoadInst(n, "", false, block));
+			args.push_back(getInt32(elemBytes(decls[out])));
+			new StoreInst(CallInst::Create(compact, makeArrayRef(args), "", block), sizes[out], false, block);
+			continue;
+#else
+			Function *compact = runtimeFunction(host, "gpl_graph_compact", Type::getInt32Ty(ctx),
+						vector<Type*>{i8p, bytePtrType(), bytePtrType(), bytePtrType(), PointerType::get(countType(),0),
+						Type::getInt32Ty(ctx), PointerType::get(countType(),0)});
+			args.insert(args.begin(), graph);
+			args.push_back(n);
+			args.push_back(getInt32(elemBytes(decls[out])));
+			args.push_back(sizes[out]);
+			tasks.push_back(CallInst::Create(compact, makeArrayRef(args), "", block));
+			counter[sizes[out]] = tasks.size() - 1;
+#endif
+		}else{
+			Function *kernel = context.module->getFunction(name);
+			if(!kernel){
+				cout << "No kernel " << name << " to launch\n";
+				exit(-1);
+			}
+			n = lookup(sizes,plan->launchSize[name],plan);
+			for(list<string>::iterator it2 = writes.begin(); it2 != writes.end(); it2++)
+				sizes[*it2] = n;
+
+			//rewrite_arrays has put idx and then the outputs in front of the inputs, add_bounds the
+			//lengths of gathered and scattered arrays after them
+			vector<Value*> params;
+			VariableList::iterator arg = decl->arguments->begin();
+			for(arg++; arg != decl->arguments->end(); arg++){
+				string array = boundArray(decl,*arg);
+				if(array.size()){
+#ifdef FOR_NV
+					params.push_back(resize(new LoadInst(lookup(sizes,array,plan), "", false, block), sizeType(), block));
+#else
+					params.push_back(lookup(sizes,array,plan));
+#endif
+					continue;
+				}
+				params.push_back(lookup(vals,(*arg)->id->name,plan));
+				if(find(writes.begin(), writes.end(), (*arg)->id->name) == writes.end())
+					reads.push_back((*arg)->id->name);
+			}
+#ifdef FOR_NV
+			launchKernel(context, kernel, params, new LoadInst(n, "", false, block), block);
+			continue;
+#else
+			Value *order = 0;
+			string array, column = bucketColumn(decl, plan, &array);
+			if(column.size()){
+				NVariableDeclaration *index = decls[column];
+				GType type = *((Node*)index)->GetType().begin();
+				bool isUnsigned = type.type == UINT_TYPE || type.type == BOOL_TYPE;
+				Function *bucket = runtimeFunction(host, "gpl_graph_bucket", PointerType::get(countType(),0),
+							vector<Type*>{i8p, bytePtrType(), Type::getInt32Ty(ctx), Type::getInt32Ty(ctx), countType(),
+							Type::getInt32Ty(ctx)});
+				vector<Value*> args{graph, new BitCastInst(lookup(vals,column,plan), bytePtrType(), "", block),
+							getInt32(elemBytes(index)), getInt32(isUnsigned), new LoadInst(lookup(sizes,column,plan), "", false, block),
+							getInt32(elemBytes(decls[array]))};
+				order = CallInst::Create(bucket, makeArrayRef(args), column + ".order", block);
+				bucketed.insert(tasks.size());
+			}
+			tasks.push_back(queueKernel(context, kernel, params, graph, n, order, block));
+#endif
+		}
+
+#ifndef FOR_NV
+		int task = tasks.size() - 1;
+		queued.push_back(decl);
+		map<int,bool> deps;
+		if(counter.find(n) != counter.end())
+			addDep(deps, counter[n], true);
+		for(list<string>::iterator it2 = reads.begin(); it2 != reads.end(); it2++){
+			if(producer.find(*it2) == producer.end())
+				continue;
+			int before = producer[*it2];
+			NFunctionDeclaration *writer = queued[before];
+			bool chunked = !compaction && !plan->compactions.count(writer) && sizes[*it2] == n &&
+					!bucketed.count(task) && !bucketed.count(before) &&
+					elementwise(decl->block, *it2) && elementwise(writer->block, *it2);
+			addDep(deps, before, !chunked);
+		}
+		//A pool slot is only handed to the next array once everything on the last one is done with it
+		for(list<string>::iterator it2 = reads.begin(); it2 != reads.end(); it2++){
+			if(plan->slots.find(*it2) != plan->slots.end())
+				slotUsers[plan->slots[*it2]].insert(task);
+		}
+		for(list<string>::iterator it2 = writes.begin(); it2 != writes.end(); it2++){
+			producer[*it2] = task;
+			if(plan->slots.find(*it2) == plan->slots.end())
+				continue;
+			set<int> &users = slotUsers[plan->slots[*it2]];
+			for(set<int>::iterator it3 = users.begin(); it3 != users.end(); it3++){
+				if(*it3 != task)
+					addDep(deps, *it3, true);
+			}
+			users.insert(task);
+		}
+		for(map<int,bool>::iterator it2 = deps.begin(); it2 != deps.end(); it2++){
+			Function *dep = runtimeFunction(host, it2->second ? "gpl_graph_dep" : "gpl_graph_chunk_dep", Type::getVoidTy(ctx),
+						vector<Type*>{i8p, Type::getInt32Ty(ctx), Type::getInt32Ty(ctx)});
+			vector<Value*> args{graph, tasks[task], tasks[it2->first]};
+			CallInst::Create(dep, makeArrayRef(args), "", block);
+		}
+#endif
+	}
+
+#ifndef FOR_NV
+	Function *run = runtimeFunction(host, "gpl_graph_run", Type::getVoidTy(ctx), vector<Type*>{i8p});
+	CallInst::Create(run, ArrayRef<Value*>(graph), "", block);
+#endif
+
+	//A scalar output is a single element
+	for(VariableList::iterator it = plan->outputs.begin(); it != plan->outputs.end(); it++){
+		string name = (*it)->id->name;
+		Value *size = getInt(1);
+		if((*(*it)->types->begin())->isArray)
+			size = resize(new LoadInst(lookup(sizes,name,plan), "", false, block), sizeType(), block);
+		new StoreInst(size, sizeOut[name], false, block);
+	}
+	for(unsigned i=0; i < slots.size(); i++)
+		CallInst::Create(release, ArrayRef<Value*>(slots[i]), "", block);
+	ReturnInst::Create(ctx, block);
+}
+
+//Loads slot i of an array of i8*, as the type the pointer in it points at
+static Value *loadSlot(Value *array, int i, Type *type, BasicBlock *block){
+	Value *gep = GetElementPtrInst::Create(array, ArrayRef<Value*>(getInt32(i)), "", block);
+	Value *ptr = new BitCastInst(new LoadInst(gep, "", false, block), PointerType::get(type,0), "", block);
+	return new LoadInst(ptr, "", false, block);
+}
+
+//i64 <target>_chunk(i8** outs, i8** ins, i64 n, i8* user), the ChunkKernel StreamRunner and ArrowBatch
+//drive. ins has one column of n elements per array input and outs one buffer of n per output, both in
+//declaration order. user holds a pointer to each scalar input, also in order. Returns the length of
+//the outputs, which all have to agree
+static void generate_chunk(CodeGenContext& context, RuntimePlan *plan, Function *launcher){
+	LLVMContext &ctx = getGlobalContext();
+	Module *host = context.hostModule;
+	Type *i8p = Type::getInt8PtrTy(ctx);
+	Type *i8pp = PointerType::get(i8p,0);
+
+	vector<Type*> types{i8pp, i8pp, countType(), i8p};
+	Function *func = Function::Create(FunctionType::get(countType(), makeArrayRef(types), false),
+				GlobalValue::ExternalLinkage, exportName(plan->target->id->name + "_chunk"), host);
+	context.entryPoints.push_back(func);
+	Function::arg_iterator AI = func->arg_begin();
+	Value *outs = AI++, *ins = AI++, *n = AI++, *user = AI++;
+	BasicBlock *block = BasicBlock::Create(ctx, "entry", func);
+	Value *scalars = new BitCastInst(user, i8pp, "", block);
+
+	vector<Value*> args, sizes;
+	Function::arg_iterator LI = launcher->arg_begin();
+	int i=0;
+	for(VariableList::iterator it = plan->outputs.begin(); it != plan->outputs.end(); it++, i++){
+		args.push_back(loadSlot(outs, i, (LI++)->getType(), block));
+		LI++;
+		Value *size = new AllocaInst(sizeType(), (*it)->id->name + ".size", block);
+		if((*(*it)->types->begin())->isArray)
+			sizes.push_back(size);
+		args.push_back(size);
+	}
+	int columns=0, values=0;
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++){
+		if((*(*it)->types->begin())->isArray){
+			args.push_back(loadSlot(ins, columns++, (LI++)->getType(), block));
+			args.push_back(resize(n, (LI++)->getType(), block));
+		}else
+			args.push_back(loadSlot(scalars, values++, (LI++)->getType(), block));
+	}
+	CallInst::Create(launcher, makeArrayRef(args), "", block);
+
+	ArrayType *countsTy = ArrayType::get(countType(), sizes.size());
+	Value *counts = new AllocaInst(countsTy, "counts", block);
+	for(unsigned j=0; j < sizes.size(); j++){
+		Value *gep = GetElementPtrInst::Create(counts, indices(0,j), "", block);
+		new StoreInst(resize(new LoadInst(sizes[j], "", false, block), countType(), block), gep, false, block);
+	}
+	Function *agree = runtimeFunction(host, "gpl_chunk_count", countType(),
+				vector<Type*>{PointerType::get(countType(),0), Type::getInt32Ty(ctx)});
+	vector<Value*> call{GetElementPtrInst::Create(counts, indices(0,0), "", block), getInt32(sizes.size())};
+	ReturnInst::Create(ctx, CallInst::Create(agree, makeArrayRef(call), "", block), block);
+}
+
+void generate_launchers(CodeGenContext& context){
+	for(list<RuntimePlan*>::iterator it = runtimePlans.begin(); it != runtimePlans.end(); it++){
+		generate_launcher(context, *it);
+		generate_chunk(context, *it, context.launchers[*it]);
+	}
+}
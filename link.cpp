@@ -0,0 +1,76 @@
+/* 
+GPiler - link.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "node.h"
+#include "codegen.h"
+
+#include <set>
+
+#include <llvm/Linker.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/SourceMgr.h>
+
+using namespace std;
+
+//Anything meant for nvptx is device code, the rest runs next to the launchers
+static bool isDevice(Module *mod){
+	return mod->getTargetTriple().compare(0,5,"nvptx") == 0;
+}
+
+//Links hand written IR (runtime helpers, a main that calls the launchers, ...) into the modules the
+//compiler generated. Calls to a kernel or launcher are resolved by name, so the result is one module
+//per target with nothing left to patch up afterwards
+void link_modules(CodeGenContext& context, vector<string>& files){
+	set<Function*> generated;
+	for(Module::iterator it = context.module->begin(); it != context.module->end(); it++){
+		if(!it->isDeclaration())
+			generated.insert(it);
+	}
+
+	for(vector<string>::iterator it = files.begin(); it != files.end(); it++){
+		SMDiagnostic diag;
+		Module *src = ParseIRFile(*it, diag, getGlobalContext());
+		if(!src){
+			diag.print(it->c_str(), errs());
+			exit(-1);
+		}
+
+		Module *dest = context.module;
+#ifdef FOR_NV
+		if(!isDevice(src))
+			dest = context.hostModule;
+#endif
+		string error;
+		if(Linker::LinkModules(dest, src, Linker::DestroySource, &error)){
+			cout << "Can't link " << *it << ": " << error << "\n";
+			exit(-1);
+		}
+		delete src;
+		cout << "Linked " << *it << "\n";
+	}
+
+	//Only the entry points are called from outside. Everything else becomes internal, which lets
+	//the inliner fold each kernel into the loop that calls it for every element
+	set<Function*> keep(context.entryPoints.begin(), context.entryPoints.end());
+	for(set<Function*>::iterator it = generated.begin(); it != generated.end(); it++){
+		if(keep.count(*it) || (*it)->getName() == "main")
+			continue;
+		(*it)->setLinkage(GlobalValue::InternalLinkage);
+	}
+}
@@ -21,9 +21,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include <iostream>
 #include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/time.h>
 #include "codegen.h"
 #include "node.h"
 #include "runtime.h"
+#include "exec.h"
+#include "profile.h"
+#include "cpu/column.h"
 
 using namespace std;
 
@@ -34,12 +40,18 @@ extern FILE* yyin;
 extern NBlock* programBlock;
 
 void createCoreFunctions(CodeGenContext& context);
-void compile(Module &mod);
+void compile(Module &mod, int optLevel, int sizeLevel);
 void split_unnatural(NBlock *pb);
+void split_independent(NBlock *pb);
+void merge_independent();
+void value_number(NBlock *pb);
+void fold_constants(NBlock *pb);
+void instantiate_generics(NBlock *pb);
+void instantiate_calls(NBlock *pb, Node *node, VariableList *vars);
 
 
-//This converts all array return types into function arguments. 
-//TODO: fuctions with multiple scalar returns must be modified somehow
+//This converts all array return types into function arguments. Scalar returns become pointers here,
+//codegen turns those back into return values for scalar functions so they stay in registers
 void rewrite_arrays(NFunctionDeclaration *decl){
 	VariableList::iterator it;
 	decl->returns->reverse();
@@ -56,11 +68,33 @@ void rewrite_arrays(NFunctionDeclaration *decl){
 	decl->SetType(vlist);	
      
 	if(!decl->isScalar()){
-		NVariableDeclaration *idxvar = new NVariableDeclaration(new TypeList{new NType("int32",0)},new NIdentifier("idx"),0);
+		NVariableDeclaration *idxvar = new NVariableDeclaration(new TypeList{new NType(indexBits == 64 ? "int64" : "int32",0)},new NIdentifier("idx"),0);
 		decl->InsertArgument(decl->arguments->begin(),idxvar);
 	}
 }
 
+//Arrays node indexes with anything but idx
+static void gathered_arrays(Node *node, set<string> &names){
+	NArrayRef *ref = dynamic_cast<NArrayRef*>(node);
+	if(ref && ref->index->name != "idx")
+		names.insert(ref->name);
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		gathered_arrays(*it,names);
+}
+
+//A kernel that gathers from or scatters to an array gets its length as an extra argument <array>.size,
+//codegen checks the index against it. Launchers and the interpreter fill it in, see boundArray
+static void add_bounds(NFunctionDeclaration *decl){
+	if(decl->isScalar())
+		return;
+	set<string> names;
+	gathered_arrays(decl->block,names);
+	for(set<string>::iterator it = names.begin(); it != names.end(); it++){
+		NVariableDeclaration *size = new NVariableDeclaration(new TypeList{new NType(indexBits == 64 ? "int64" : "int32",0)},new NIdentifier(*it + ".size"),0);
+		decl->AddArgument(size);
+	}
+}
+
 std::string create_anon_name(void) {
 	static unsigned idx = 0;
 	char buf[16];
@@ -90,6 +124,10 @@ NFunctionDeclaration *extract_func(NBlock* pb, NMap* map,TypeList* types) {
 			exit(-1);
 		}
 	}	
+	//Generic calls take the types of the stage's input
+	for(NodeList::iterator it=map->exprs->begin(); it!= map->exprs->end(); it++)
+		instantiate_calls(pb, *it, var_list);
+
 	NBlock *func_block = new NBlock();
 	VariableList *retlist = new VariableList();
 
@@ -170,20 +208,10 @@ void rewrite_arrays(NBlock* programBlock){
 		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*> (*it);
 		if(decl){
 			rewrite_arrays(decl);
+			add_bounds(decl);
 		}
 	}
 }
-/*
-void generate_runtime(NBlock* programBlock, Runtime* runtime){
-	NodeList::iterator it;
-	for(it = programBlock->children.begin(); it != programBlock->children.end(); it++){
-		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*> (*it);
-		if(decl){
-			if(!decl->isGenerated)
-			runtime->AddFunction(decl);
-		}
-	}
-}*/
 
 //Array temps become scalars
 void remove_array_temps(NBlock* programBlock){
@@ -232,11 +260,54 @@ void rewrite_pipelines(NBlock *pb){
 					NVariableDeclaration *dec = new NVariableDeclaration(types, new NIdentifier(temp_name),new NZip(copyIdList(pipe->src)));
 					decl->block->children.insert(it2,dec);
 
+					NIdentifier *scatter_index = 0;
 					MapList::iterator it3;
 					for(it3 = pipe->chain->begin(); it3!= pipe->chain->end(); it3++){
 						NMap* map = *it3;
 						string new_name = create_temp_name();
 
+						NIndexMap *imap = dynamic_cast<NIndexMap*>(map);
+						if(imap){
+							if(!imap->isGather() && !imap->isScatter()){
+								cout << "Unknown indexed stage: " << imap->name->name << "\n";
+								exit(-1);
+							}
+							NIdentifier *index;
+							TypeList *index_types;
+							if(imap->isGather()){
+								//The stream is the index, element type comes from the source array
+								index = new NIdentifier(temp_name);
+								index_types = types;
+								types = new TypeList(typeOf(decl,imap->array,0));
+							}else{
+								//Index array is read at idx, the stream itself passes through to the store
+								MapList::iterator next = it3;
+								if(++next != pipe->chain->end()){
+									cout << "scatter must be the last stage of a pipeline\n";
+									exit(-1);
+								}
+								index_types = new TypeList(typeOf(decl,imap->array,0));
+							}
+							int index_type = index_types->size() == 1 ? (*((Node*)index_types->front())->GetType().begin()).type : 0;
+							if(index_type != INT_TYPE && index_type != UINT_TYPE){
+								cout << "Index of " << imap->name->name << " must be a single integer stream\n";
+								exit(-1);
+							}
+
+							NVariableDeclaration *map_dec;
+							if(imap->isGather()){
+								map_dec = new NVariableDeclaration(types,new NIdentifier(new_name),
+									new NArrayRef((NIdentifier*)imap->array->clone(),index));
+								temp_name = new_name;
+							}else{
+								map_dec = new NVariableDeclaration(index_types,new NIdentifier(new_name),
+									(NIdentifier*)imap->array->clone());
+								scatter_index = new NIdentifier(new_name);
+							}
+							decl->block->children.insert(it2,map_dec);
+							continue;
+						}
+
 						{
 							NFunctionDeclaration *anon_func = extract_func(pb,*it3, types);
 							//TODO: this kind of conditionally deals with types as a special case
@@ -253,7 +324,8 @@ void rewrite_pipelines(NBlock *pb){
 						temp_name = new_name;
 					}
 
-					Node* store = new NAssignment(pipe->dest,new NIdentifier(temp_name));
+					NAssignment* store = new NAssignment(pipe->dest,new NIdentifier(temp_name));
+					store->SetIndex(scatter_index);
 					decl->block->add_child(it2,store);
 
 					//TODO: delete the pipeline now that it is dangling
@@ -266,6 +338,16 @@ void rewrite_pipelines(NBlock *pb){
 	}
 }
 
+//split_unnatural can leave a module whose statement is a bare call, a map stage with a temp of the
+//pipeline as its input. The call takes one element, so whole arrays are indexed at idx like any other read
+static void rewrite_call_access(NFunctionDeclaration *decl, NMethodCall *mc){
+	for(NodeList::iterator it = mc->arguments->begin(); it != mc->arguments->end(); it++){
+		NIdentifier *arg = dynamic_cast<NIdentifier*>(*it);
+		if(arg && !dynamic_cast<NArrayRef*>(arg) && (*typeOf(decl,arg,1).begin())->isArray)
+			mc->ReplaceArgument(it, new NArrayRef(arg,new NIdentifier("idx")));
+	}
+}
+
 //Go ahead and fix codes to deal with any pointers that may be present
 void rewrite_argument_access(NBlock *pb){
 	NodeList::iterator it;
@@ -279,24 +361,30 @@ void rewrite_argument_access(NBlock *pb){
 					if(assn->lhs){
 						NType* type = *typeOf(decl,*assn->lhs->begin(),1).begin();
 						if(type->isArray){
-							assn->SetArray(new NArrayRef(*assn->lhs->begin(),new NIdentifier("idx")));
+							NIdentifier *index = assn->index?(NIdentifier*)assn->index->clone():new NIdentifier("idx");
+							assn->SetArray(new NArrayRef(*assn->lhs->begin(),index));
 						}
 					}
 					NIdentifier* id= dynamic_cast<NIdentifier*>(assn->rhs);
-					if(id){
+					//Gathers are already indexed
+					if(id && !dynamic_cast<NArrayRef*>(id)){
 						NType* type = *typeOf(decl,id,1).begin();
 						if(type->isArray){
 							assn->SetExpr(new NArrayRef(id,new NIdentifier("idx")));
 						}
 					}
 				}
+				NMethodCall *mc = dynamic_cast<NMethodCall*>(*it2);
+				if(mc)
+					rewrite_call_access(decl,mc);
 			}
 		}
 	}
 }
 
 
-//Assumes all declaration have an expression
+//Assumes all declaration have an expression. Variables assigned inside if and for keep their name,
+//they have to be the same variable on every path
 void to_ssa(NBlock *pb){
 	NodeList::iterator it;
 	for(it = programBlock->children.begin(); it != programBlock->children.end(); it++){
@@ -304,6 +392,12 @@ void to_ssa(NBlock *pb){
 		if(decl && !decl->isGenerated){
 			map<string,int> vars;
 			map<string,TypeList*> types;
+			set<string> mutated;
+			mutated_names(decl->block,mutated);
+			if(mutated.size() && !decl->isScalar()){
+				cout << "if and for are only allowed in scalar functions, not in " << decl->id->name << "\n";
+				exit(-1);
+			}
 			for(NodeList::iterator it2 = decl->block->children.begin(); it2 != decl->block->children.end(); it2++){
 
 				IdList ids;
@@ -319,6 +413,8 @@ void to_ssa(NBlock *pb){
 					}
 				}
 				NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it2);
+				if(vdec && mutated.count(vdec->id->name))
+					continue;
 				if(vdec){
 					vars[vdec->id->name] = -1; //One assignment for free
 					types[vdec->id->name] = vdec->types;
@@ -401,89 +497,121 @@ void map_to_args(NIdentifier *dest, NodeList *list, NMap *map, NBlock* pb){
 	}
 }
 
-void rewrite_triads(NBlock *pb){
-        NodeList::iterator it;
-        for(it = programBlock->children.begin(); it != programBlock->children.end(); it++){
-                NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*> (*it);
-                if(decl){
-                        NodeList::iterator it2;
-                        for(it2 = decl->block->children.begin(); it2 != decl->block->children.end();){
-                                NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it2);
-                                if(vdec){
-					if(vdec->types->size() > 1){
-						int count=0;
-						for(TypeList::iterator it3=vdec->types->begin(); it3!=vdec->types->end(); it3++){
-							char new_name[64];
-							sprintf(new_name,"%s.%d",vdec->id->name.c_str(),count++);
-							NVariableDeclaration *new_dec = new NVariableDeclaration(new TypeList{*it3},new NIdentifier(new_name),0);
-							decl->block->add_child(it2,new_dec);
-						}
-						it2 = decl->block->children.erase(it2);
-						continue;
-					}
+//Statements of block, and of every if and for inside it
+static void rewrite_triads(NBlock *block, NBlock *pb){
+	NodeList::iterator it2;
+	for(it2 = block->children.begin(); it2 != block->children.end();){
+		NIf *branch = dynamic_cast<NIf*>(*it2);
+		NLoop *loop = dynamic_cast<NLoop*>(*it2);
+		if(branch){
+			rewrite_triads(branch->then,pb);
+			if(branch->otherwise)
+				rewrite_triads(branch->otherwise,pb);
+		}
+		if(loop){
+			NAssignment *init = dynamic_cast<NAssignment*>(loop->init);
+			NVariableDeclaration *counter = dynamic_cast<NVariableDeclaration*>(loop->init);
+			if(dynamic_cast<NMethodCall*>(loop->step->rhs) || (init && dynamic_cast<NMethodCall*>(init->rhs)) ||
+					(counter && dynamic_cast<NMethodCall*>(counter->assignmentExpr))){
+				cout << "Calls can't be made from a for header\n";
+				exit(-1);
+			}
+			rewrite_triads(loop->block,pb);
+		}
+
+		NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(*it2);
+		if(vdec){
+			//to_ssa split these off everywhere but inside if and for
+			if(dynamic_cast<NMethodCall*>(vdec->assignmentExpr)){
+				NAssignment *assn = new NAssignment(new IdList{(NIdentifier*)vdec->id->clone()}, vdec->assignmentExpr);
+				vdec->SetExpr(0);
+				it2++;
+				block->add_child(it2,assn);
+				it2--;
+			}
+			if(vdec->types->size() > 1){
+				int count=0;
+				for(TypeList::iterator it3=vdec->types->begin(); it3!=vdec->types->end(); it3++){
+					char new_name[64];
+					sprintf(new_name,"%s.%d",vdec->id->name.c_str(),count++);
+					NVariableDeclaration *new_dec = new NVariableDeclaration(new TypeList{*it3},new NIdentifier(new_name),0);
+					block->add_child(it2,new_dec);
 				}
+				it2 = block->children.erase(it2);
+				continue;
+			}
+		}
 
-				NAssignment *assn = dynamic_cast<NAssignment*>(*it2);
-				if(assn){
-					NMap* map = dynamic_cast<NMap*>(assn->rhs);
-					if(map){
-                                                NodeList *args = new NodeList();
-						map_to_args(*assn->lhs->begin(),args,map,pb);
+		NAssignment *assn = dynamic_cast<NAssignment*>(*it2);
+		if(assn){
+			NMap* map = dynamic_cast<NMap*>(assn->rhs);
+			if(map){
+				NodeList *args = new NodeList();
+				map_to_args(*assn->lhs->begin(),args,map,pb);
 
-						NMethodCall *mc = new NMethodCall(new NIdentifier(map->anon_name),args);
-						decl->block->add_child(it2,mc);
+				NMethodCall *mc = new NMethodCall(new NIdentifier(map->anon_name),args);
+				block->add_child(it2,mc);
 
-						it2 = decl->block->children.erase(it2);
-						continue;
-					}
+				it2 = block->children.erase(it2);
+				continue;
+			}
 
-					NZip* zip = dynamic_cast<NZip*>(assn->rhs);
-					if(zip){
-						if(zip->src->size() == 1){
-							assn->SetExpr(*zip->src->begin());
-						}else{
-							int count=0;
-							for(IdList::iterator it3 = zip->src->begin(); it3!= zip->src->end(); it3++){
-								char new_name[64];
-								sprintf(new_name,"%s.%d",(*assn->lhs->begin())->name.c_str(),count++);
-
-								NAssignment *new_assn = new NAssignment(new IdList{new NIdentifier(new_name)}, *it3);
-								decl->block->add_child(it2,new_assn);
-							}
-							it2 = decl->block->children.erase(it2);
-							continue;
-						}
-					}
+			NZip* zip = dynamic_cast<NZip*>(assn->rhs);
+			if(zip){
+				if(zip->src->size() == 1){
+					assn->SetExpr(*zip->src->begin());
+				}else{
+					int count=0;
+					for(IdList::iterator it3 = zip->src->begin(); it3!= zip->src->end(); it3++){
+						char new_name[64];
+						sprintf(new_name,"%s.%d",(*assn->lhs->begin())->name.c_str(),count++);
 
-					NIdentifier *id = dynamic_cast<NIdentifier*>(assn->rhs);
-					if(id && assn->lhs->size() > 1){
-						int count=0;
-						for(IdList::iterator it3 = assn->lhs->begin(); it3!= assn->lhs->end(); it3++){
-							char new_name[64];
-							sprintf(new_name,"%s.%d",id->name.c_str(),count++);
-							NAssignment *new_assn = new NAssignment(new IdList{*it3},new NIdentifier(new_name));
-							decl->block->add_child(it2,new_assn);
-						}
-						it2 = decl->block->children.erase(it2);
-						continue;
+						NAssignment *new_assn = new NAssignment(new IdList{new NIdentifier(new_name)}, *it3);
+						block->add_child(it2,new_assn);
 					}
+					it2 = block->children.erase(it2);
+					continue;
+				}
+			}
 
-					NMethodCall* mc = dynamic_cast<NMethodCall*>(assn->rhs);
-					if(mc){
-						//TODO: fix me
-						assn->lhs->reverse();
-						for(IdList::iterator it3 = assn->lhs->begin(); it3!= assn->lhs->end(); it3++){
-							mc->AddArgumentFront(new NRef(*it3));
-						}
-						decl->block->add_child(it2,mc);
+			NIdentifier *id = dynamic_cast<NIdentifier*>(assn->rhs);
+			if(id && assn->lhs->size() > 1){
+				int count=0;
+				for(IdList::iterator it3 = assn->lhs->begin(); it3!= assn->lhs->end(); it3++){
+					char new_name[64];
+					sprintf(new_name,"%s.%d",id->name.c_str(),count++);
+					NAssignment *new_assn = new NAssignment(new IdList{*it3},new NIdentifier(new_name));
+					if(assn->index)
+						new_assn->SetIndex((NIdentifier*)assn->index->clone());
+					block->add_child(it2,new_assn);
+				}
+				it2 = block->children.erase(it2);
+				continue;
+			}
 
-						it2 = decl->block->children.erase(it2);
-						continue;
-					}
+			NMethodCall* mc = dynamic_cast<NMethodCall*>(assn->rhs);
+			if(mc){
+				//TODO: fix me
+				assn->lhs->reverse();
+				for(IdList::iterator it3 = assn->lhs->begin(); it3!= assn->lhs->end(); it3++){
+					mc->AddArgumentFront(new NRef(*it3));
 				}
-				it2++;
-                        }
-                }
+				block->add_child(it2,mc);
+
+				it2 = block->children.erase(it2);
+				continue;
+			}
+		}
+		it2++;
+	}
+}
+
+void rewrite_triads(NBlock *pb){
+        NodeList::iterator it;
+        for(it = programBlock->children.begin(); it != programBlock->children.end(); it++){
+                NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*> (*it);
+                if(decl)
+			rewrite_triads(decl->block,pb);
         }
 }
 
@@ -521,23 +649,245 @@ void auto_name_returns(NBlock *pb){
 }
 
 
+static double now(){
+	struct timeval tv;
+	gettimeofday(&tv,0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//Runs one pipeline in-process over mapped columns, repeat times so promotion can be watched
+//Scalar inputs come from -s name=value
+static Cell scalarValue(NVariableDeclaration *var, map<string,string> &scalars){
+	if(scalars.find(var->id->name) == scalars.end()){
+		cout << "Scalar input " << var->id->name << " needs -s " << var->id->name << "=value\n";
+		exit(-1);
+	}
+	Cell ret;
+	if((*((Node*)var)->GetType().begin()).type == FLOAT_TYPE)
+		ret.d = atof(scalars[var->id->name].c_str());
+	else
+		ret.i = atoll(scalars[var->id->name].c_str());
+	return ret;
+}
+
+void run_pipeline(NBlock *program, vector<string> &link_files, string target, vector<string> &ins, vector<string> &outs,
+			map<string,string> &scalars, bool specialize, int mode, long promote, int repeat, int optLevel, int sizeLevel,
+			const char *record){
+	RuntimePlan *plan=0;
+	for(list<RuntimePlan*>::iterator it = runtimePlans.begin(); it != runtimePlans.end(); it++){
+		if((*it)->target->id->name == target)
+			plan = *it;
+	}
+	if(!plan){
+		cout << "No pipeline named " << target << ", have:";
+		for(list<RuntimePlan*>::iterator it = runtimePlans.begin(); it != runtimePlans.end(); it++)
+			cout << " " << (*it)->target->id->name;
+		cout << "\n";
+		exit(-1);
+	}
+	unsigned arrays=0;
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++)
+		arrays += (*(*it)->types->begin())->isArray;
+	if(ins.size() != arrays || outs.size() != plan->outputs.size()){
+		cout << target << " takes " << arrays << " input columns and " << plan->outputs.size() << " outputs\n";
+		exit(-1);
+	}
+
+	vector<MappedColumn*> inCols, outCols;
+	map<string,Cell> values;
+	size_t count=0;
+	int i=0;
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++){
+		GType type = *((Node*)*it)->GetType().begin();
+		if(!type.isArray){
+			values[(*it)->id->name] = scalarValue(*it, scalars);
+			continue;
+		}
+		inCols.push_back(MappedColumn::Open(ins[i++].c_str(), type.type, elemBytes(*it)*8, COLUMN_SEQUENTIAL));
+		count = MAX(count, inCols.back()->Count());
+	}
+	i=0;
+	for(VariableList::iterator it = plan->outputs.begin(); it != plan->outputs.end(); it++, i++){
+		GType type = *((Node*)*it)->GetType().begin();
+		outCols.push_back(MappedColumn::Create(outs[i].c_str(), type.type, elemBytes(*it)*8, type.isArray ? count : 1, COLUMN_SEQUENTIAL));
+	}
+
+	//Launcher arguments live here, params points into it
+	vector<void*> data;
+	vector<int64_t> sizes(outCols.size() + inCols.size());
+	vector<int64_t*> sizePtrs;
+	for(unsigned j=0; j < outCols.size(); j++){
+		data.push_back(outCols[j]->Data());
+		sizePtrs.push_back(&sizes[j]);
+	}
+	for(unsigned j=0; j < inCols.size(); j++){
+		data.push_back(inCols[j]->Data());
+		if(indexBits == 32 && inCols[j]->Count() > INT32_MAX){
+			cout << ins[j] << " has more than 2^31 elements, compile with -w 64\n";
+			exit(-1);
+		}
+		store_size(&sizes[outCols.size()+j], inCols[j]->Count());
+	}
+	vector<void*> params;
+	for(unsigned j=0; j < outCols.size(); j++){
+		params.push_back(&data[j]);
+		params.push_back(&sizePtrs[j]);
+	}
+	vector<Cell> scalarArgs(plan->inputs.size());
+	i=0;
+	unsigned col = outCols.size();
+	for(VariableList::iterator it = plan->inputs.begin(); it != plan->inputs.end(); it++, i++){
+		GType type = *((Node*)*it)->GetType().begin();
+		if(type.isArray){
+			params.push_back(&data[col]);
+			params.push_back(&sizes[col]);
+			col++;
+		}else{
+			store_cell(&scalarArgs[i], 0, type, values[(*it)->id->name]);
+			params.push_back(&scalarArgs[i]);
+		}
+	}
+
+	//Counts only come from the interpreter
+	Profile *counts = 0;
+	if(record){
+		counts = new Profile();
+		counts->Load(record);
+		mode = EXEC_INTERP;
+	}
+
+	Executor executor(program, link_files, mode, promote, optLevel, sizeLevel, counts);
+	PackedLauncher special = specialize ? executor.Specialize(plan, values) : 0;
+	for(int j=0; j < repeat; j++){
+		double start = now();
+		if(special)
+			special(&params[0]);
+		else
+			executor.Run(plan, &params[0]);
+		cout << "Run " << j << ": " << (now()-start)*1000 << "ms " << (special ? "specialized" : executor.Native(plan) ? "native" : "interpreted") << "\n";
+	}
+
+	i=0;
+	for(VariableList::iterator it = plan->outputs.begin(); it != plan->outputs.end(); it++, i++){
+		if((*((Node*)*it)->GetType().begin()).isArray)
+			outCols[i]->Truncate(load_size(&sizes[i]));
+	}
+	if(counts)
+		counts->Save(record);
+
+	for(unsigned j=0; j < outCols.size(); j++)
+		delete outCols[j];
+	for(unsigned j=0; j < inCols.size(); j++)
+		delete inCols[j];
+}
+
+static void usage(){
+	cout << "Usage: parser [options] inputfile [module.ll|module.bc ...]\n";
+	cout << "  -r pipeline     run pipeline in-process instead of compiling\n";
+	cout << "  -i column       input column, once per array input in order\n";
+	cout << "  -o column       output column, once per output in order\n";
+	cout << "  -b backend      interp, jit or adaptive (default)\n";
+	cout << "  -t elements     elements interpreted before adaptive compiles a pipeline\n";
+	cout << "  -n count        times to run the pipeline\n";
+	cout << "  -O level        0, 1, 2, 3 (default) or s, see compile.cpp for what each costs\n";
+	cout << "  -s name=value   value of a scalar input\n";
+	cout << "  -S              compile the pipeline with the -s values folded in, needs a TARGET=cpu build\n";
+	cout << "  -P profile      with -r, interpret and add what the run saw to profile\n";
+	cout << "  -U profile      let profile guide code generation\n";
+	cout << "  -w bits         width of idx and element counts, 32 (default) or 64\n";
+	cout << "  -a bits         do float and half arithmetic in at least 32 or 64 bits, arrays keep their type\n";
+}
+
 int main(int argc, char **argv)
 {
-	if(argc!=2){
-		cout << "Usage: parser inputfile\n";
+	string target;
+	vector<string> ins, outs;
+	int mode = EXEC_ADAPTIVE, repeat = 1;
+	int optLevel = 3, sizeLevel = 0;
+	const char *record = 0;
+	map<string,string> scalars;
+	bool specialize = false;
+	long promote = DEFAULT_PROMOTE;
+
+	int opt;
+	while((opt = getopt(argc, argv, "r:i:o:b:t:n:O:P:U:s:Sw:a:")) != -1){
+		switch(opt){
+			case 'r': target = optarg; break;
+			case 'i': ins.push_back(optarg); break;
+			case 'o': outs.push_back(optarg); break;
+			case 'b':
+				if(string(optarg) == "interp")
+					mode = EXEC_INTERP;
+				else if(string(optarg) == "jit")
+					mode = EXEC_JIT;
+				else if(string(optarg) == "adaptive")
+					mode = EXEC_ADAPTIVE;
+				else{
+					usage();
+					return 0;
+				}
+				break;
+			case 't': promote = atol(optarg); break;
+			case 'n': repeat = atoi(optarg); break;
+			case 's': {
+				char *eq = strchr(optarg, '=');
+				if(!eq){
+					usage();
+					return 0;
+				}
+				scalars[string(optarg, eq - optarg)] = eq + 1;
+				break;
+			}
+			case 'S': specialize = true; break;
+			case 'P': record = optarg; break;
+			case 'U':
+				profile = new Profile();
+				profile->Load(optarg);
+				break;
+			case 'O':
+				if(string(optarg) == "s"){
+					optLevel = 2;
+					sizeLevel = 1;
+				}else if(strlen(optarg) == 1 && optarg[0] >= '0' && optarg[0] <= '3')
+					optLevel = optarg[0] - '0';
+				else{
+					usage();
+					return 0;
+				}
+				break;
+			case 'w':
+				indexBits = atoi(optarg);
+				if(indexBits != 32 && indexBits != 64){
+					usage();
+					return 0;
+				}
+				break;
+			case 'a':
+				accumulateBits = atoi(optarg);
+				if(accumulateBits != 32 && accumulateBits != 64){
+					usage();
+					return 0;
+				}
+				break;
+			default: usage(); return 0;
+		}
+	}
+	if(optind >= argc){
+		usage();
 		return 0;
 	}
+	//Anything after the input is IR to link with the generated code
+	vector<string> link_files(argv+optind+1, argv+argc);
 
-	FILE *infile = fopen(argv[1], "r");
+	FILE *infile = fopen(argv[optind], "r");
 	if (!infile) {
-		cout << "Can't open: " << argv[1] << endl;
+		cout << "Can't open: " << argv[optind] << endl;
 		return 0;
 	}
 	// set lex to read from it instead of defaulting to STDIN:
 	yyin = infile;
 
 	yyparse();
-//	Runtime *runtime = new Runtime();
 
 	cout << "Raw:\n";
 	std::cout << *programBlock << endl;
@@ -546,6 +896,10 @@ int main(int argc, char **argv)
 	cout << "Pass1:\n";
 	std::cout << *programBlock << endl;
 
+	instantiate_generics(programBlock);
+	cout << "Pass1a:\n";
+	std::cout << *programBlock << endl;
+
 	rewrite_pipelines(programBlock);
 	cout << "Pass2:\n";
 	cout << *programBlock;
@@ -556,9 +910,22 @@ int main(int argc, char **argv)
 	cout << "Pass3:\n";
 	cout << *programBlock;
 
-//	split_unnatural(programBlock);
+	fold_constants(programBlock);
+	cout << "Pass3f:\n";
+	cout << *programBlock;
+
+	value_number(programBlock);
+	cout << "Pass3a:\n";
+	cout << *programBlock;
+
+	split_independent(programBlock);
+	cout << "Pass3b:\n";
+	cout << *programBlock;
+
+	split_unnatural(programBlock);
+	merge_independent();
 	cout << "Pass4:\n";
-//	cout << *programBlock;
+	cout << *programBlock;
 
 	remove_array_temps(programBlock);
 	cout << "Pass5:\n";
@@ -572,21 +939,29 @@ int main(int argc, char **argv)
 	cout << "Pass7:\n";
 	cout << *programBlock;
 
-	/////////////////////////////////////////////////////////
-	// Passes below this point start losing too much context for building the runtime
-//	generate_runtime(programBlock,runtime);
-
 	rewrite_arrays(programBlock);
 	cout << "Pass8:\n";
 	cout << *programBlock;
 
+	if(target.size()){
+		run_pipeline(programBlock, link_files, target, ins, outs, scalars, specialize, mode, promote, repeat, optLevel, sizeLevel, record);
+		return 0;
+	}
+
 #if 1
 	CodeGenContext context;
 //	createCoreFunctions(context);
 	context.generateCode(*programBlock);
-	compile(*context.module);
+	link_modules(context, link_files);
+	compile(*context.module, optLevel, sizeLevel);
+	report_loop_hints(context);
+#ifdef FOR_NV
+	//The launchers run on the host, they are written out next to the ptx
+	std::string error;
+	raw_fd_ostream host("out.host.bc", error, sys::fs::F_Binary);
+	WriteBitcodeToFile(context.hostModule, host);
+#endif
 #endif
-//	runtime->print();
 
 	return 0;
 }
@@ -22,10 +22,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #undef NDEBUG
 #include <assert.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <list>
 #include <map>
+#include <set>
 #include <typeinfo>
 #include <llvm/IR/Value.h>
 
@@ -54,7 +58,7 @@ struct GType {
 	int isArray;
 	int isPointer;
 	GType(int type, int length, int array) : type(type), length(length), isArray(array), isPointer(0) {}
-	GType(){}
+	GType() : type(0), length(0), isArray(0), isPointer(0) {}
 
 	void print();
 	NType* toNode();
@@ -73,8 +77,12 @@ typedef list<GType> GTypeList;
 #define FLOAT_TYPE 2
 #define BOOL_TYPE 3
 #define VOID_TYPE 4
+#define UINT_TYPE 5
 
 GTypeList promoteType(GTypeList ltype, GTypeList rtype);
+extern int accumulateBits;
+int isTypeName(const std::string &name);
+void mutated_names(NBlock *block, std::set<std::string> &names);
 int isCmp(int op);
 
 class Node {
@@ -186,7 +194,19 @@ public:
 	double value;
 	NDouble(double value) : value(value) { }
 	virtual llvm::Value* codeGen(CodeGenContext& context);
-	void print(ostream& os) { os << value; }
+	//As many digits as it takes to read back the same value, and always looking like a double.
+	//Value numbering tells expressions apart by their text
+	void print(ostream& os) {
+		char text[32];
+		for(int digits=6; digits <= 17; digits++){
+			snprintf(text, sizeof(text), "%.*g", digits, value);
+			if(strtod(text, 0) == value)
+				break;
+		}
+		os << text;
+		if(!strpbrk(text, ".eni"))
+			os << ".0";
+	}
 	GTypeList GetType(map<std::string, GTypeList> &locals) { return GTypeList{GType(FLOAT_TYPE,64,0)};}
 
 	Node* clone() { return new NDouble(*this); }
@@ -292,7 +312,7 @@ public:
 	}
 
 	int isNatural(){
-		return !name->name.compare("map");
+		return !name->name.compare("map") || !name->name.compare("gather");
 	}
 
 	void GetIdRefs(IdList &list) { input->GetIdRefs(list); }
@@ -300,6 +320,44 @@ public:
 	Node* clone() { return new NMap(*this); }
 };
 
+//Indexed stages. gather(src) reads src[x] for every index x in the stream, scatter(dst_idx) writes
+//every element of the stream to dest[dst_idx[i]]. Neither has an anonymous function, the pipeline
+//rewrite turns them straight into array references
+class NIndexMap : public NMap {
+public:
+	NIdentifier *array;
+	NIndexMap(NIdentifier* name, NIdentifier *array) : NMap(name, new IdList(), new NodeList()), array(array) {
+		add_child(array);
+	}
+	//Copy constructor
+	NIndexMap(const NIndexMap &other) : NMap(other) {
+		array = (NIdentifier*)other.array->clone();
+		add_child(array);
+	}
+
+	int isGather(){
+		return !name->name.compare("gather");
+	}
+
+	int isScatter(){
+		return !name->name.compare("scatter");
+	}
+
+	void print(ostream& os) {
+		os << *name << "(" << *array << ")";
+		if(input)
+			os << " < " << *input;
+	}
+
+	void GetIdRefs(IdList &list) { 
+		if(input)
+			input->GetIdRefs(list); 
+		array->GetIdRefs(list);
+	}
+
+	Node* clone() { return new NIndexMap(*this); }
+};
+
 class NType: public NIdentifier {
 public:
 	int isArray;
@@ -331,6 +389,15 @@ public:
 	NMethodCall(NIdentifier *id) : id(id) {
 		add_child(id);
 	}
+	//Copy constructor
+	NMethodCall(const NMethodCall &other){
+		id = (NIdentifier*)other.id->clone();
+		add_child(id);
+		arguments = new NodeList();
+		for(NodeList::iterator it = other.arguments->begin(); it != other.arguments->end(); it++)
+			arguments->push_back((*it)->clone());
+		add_node_list(arguments);
+	}
 	~NMethodCall() {
 		delete arguments;
 	}
@@ -371,6 +438,12 @@ public:
 		arguments->push_front(node);
 	}
 
+	void ReplaceArgument(NodeList::iterator at, Node *node){
+		children.remove(*at);
+		add_child(node);
+		*at = node;
+	}
+
 	void print(ostream& os) { 
 //		os << "MethodCall:\n";
 //		sTabs++;
@@ -381,6 +454,8 @@ public:
 		os << ")";
 //		sTabs--;
 	}
+
+	Node* clone() { return new NMethodCall(*this); }
 };
 
 class NZip : public Node {
@@ -405,12 +480,19 @@ public:
 	NRef(NIdentifier* exp) : exp(exp) {
 		add_child(exp);
 	}
+	//Copy constructor
+	NRef(const NRef &other){
+		exp = (NIdentifier*)other.exp->clone();
+		add_child(exp);
+	}
 
 	void print(ostream& os){
 		os << "&" << *exp;
 	}
 
 	virtual llvm::Value* codeGen(CodeGenContext& context);
+
+	Node* clone() { return new NRef(*this); }
 };
 
 class NPipeLine : public Node {
@@ -512,9 +594,66 @@ public:
 
 	void GetIdRefs(IdList &list) { lhs->GetIdRefs(list); rhs->GetIdRefs(list); }
 
+	void ReplaceOperand(Node *old, Node *node){
+		children.remove(old);
+		add_child(node);
+		if(lhs == old)
+			lhs = node;
+		else
+			rhs = node;
+	}
+
 	Node* clone(){ return new NBinaryOperator(*this); }
 };
 
+//-exp, the only unary operator. +exp is just exp
+class NUnaryOperator : public Node {
+public:
+	int op;
+	Node *exp;
+	NUnaryOperator(int op, Node *exp) : op(op), exp(exp) {
+		add_child(exp);
+	}
+	//Copy constructor
+	NUnaryOperator(const NUnaryOperator &other){
+		op = other.op;
+		exp = other.exp->clone();
+		add_child(exp);
+	}
+
+	virtual llvm::Value* codeGen(CodeGenContext& context);
+
+	GTypeList GetType(map<std::string, GTypeList> &locals);
+
+	GTypeList GetType(map<std::string, GTypeList> &locals, GTypeList* ptype, int *found, Node* exp) { 
+		if(exp==this){
+			*ptype = GetType(locals);
+			*found=1;
+			return *ptype;
+		}
+
+		GTypeList ret = this->exp->GetType(locals,ptype,found,exp);
+		if(*found)
+			return ret;
+
+		return GetType(locals);	
+	}
+
+	void GetIdRefs(IdList &list) { exp->GetIdRefs(list); }
+
+	void ReplaceOperand(Node *old, Node *node){
+		children.remove(old);
+		add_child(node);
+		exp = node;
+	}
+
+	void print(ostream& os) { 
+		os << "(-" << *exp << ")";
+	}
+
+	Node* clone(){ return new NUnaryOperator(*this); }
+};
+
 class NSelect : public Node {
 public:
 	Node *pred, *yes, *no;
@@ -523,6 +662,15 @@ public:
 		add_child(yes);
 		add_child(no);
 	}
+	//Copy constructor
+	NSelect(const NSelect &other){
+		pred = other.pred->clone();
+		yes = other.yes->clone();
+		no = other.no->clone();
+		add_child(pred);
+		add_child(yes);
+		add_child(no);
+	}
 	virtual llvm::Value* codeGen(CodeGenContext& context);
 
 
@@ -554,6 +702,17 @@ public:
 		no->GetIdRefs(list); 
 	}
 
+	void ReplaceOperand(Node *old, Node *node){
+		children.remove(old);
+		add_child(node);
+		if(pred == old)
+			pred = node;
+		else if(yes == old)
+			yes = node;
+		else
+			no = node;
+	}
+
 	GTypeList GetType(map<std::string, GTypeList> &locals);
 
 	void print(ostream& os) { 
@@ -561,6 +720,58 @@ public:
 		os << *yes << ":";
 		os << *no;
 	}
+
+	Node* clone() { return new NSelect(*this); }
+};
+
+//type(exp), written like a call to a function named after the type
+class NCast : public Node {
+public:
+	NType *type;
+	Node *exp;
+	NCast(NType *type, Node *exp) : type(type), exp(exp) {
+		add_child(exp);
+	}
+	//Copy constructor
+	NCast(const NCast &other){
+		type = (NType*)other.type->clone();
+		exp = other.exp->clone();
+		add_child(exp);
+	}
+
+	virtual llvm::Value* codeGen(CodeGenContext& context);
+
+	GTypeList GetType(map<std::string, GTypeList> &locals){
+		return type->GetType(locals);
+	}
+
+	GTypeList GetType(map<std::string, GTypeList> &locals, GTypeList* ptype, int *found, Node* exp) { 
+		if(exp==this){
+			*ptype = GetType(locals);
+			*found=1;
+			return *ptype;
+		}
+
+		GTypeList ret = this->exp->GetType(locals,ptype,found,exp);
+		if(*found)
+			return ret;
+
+		return GetType(locals);	
+	}
+
+	void GetIdRefs(IdList &list) { exp->GetIdRefs(list); }
+
+	void ReplaceOperand(Node *old, Node *node){
+		children.remove(old);
+		add_child(node);
+		exp = node;
+	}
+
+	void print(ostream& os) { 
+		os << *type << "(" << *exp << ")";
+	}
+
+	Node* clone(){ return new NCast(*this); }
 };
 
 class NArrayRef : public NIdentifier {
@@ -571,7 +782,10 @@ public:
 	}
 	//Copy constructor
 	NArrayRef(const NArrayRef &other) : NIdentifier(other) {
+		//The copied child list still holds other's index
+		children.clear();
 		index = (NIdentifier*)other.index->clone();
+		add_child(index);
 	}
 
 	virtual llvm::Value* codeGen(CodeGenContext& context);
@@ -581,6 +795,16 @@ public:
 		os << name << "[" << *index << "]";
 	}
 
+	//The element of an array is never an array
+	GTypeList GetType(map<std::string, GTypeList> &locals) {
+		GTypeList ret = NIdentifier::GetType(locals);
+		for(GTypeList::iterator it = ret.begin(); it != ret.end(); it++)
+			(*it).isArray = 0;
+		return ret;
+	}
+
+	void GetIdRefs(IdList &list) { list.push_back(this); index->GetIdRefs(list); }
+
 	Node* clone(){
 		return new NArrayRef(*this);
 	}
@@ -591,12 +815,13 @@ public:
 	IdList *lhs;
 	Node *rhs;
 	NArrayRef *array;
+	NIdentifier *index; //Scattered store, destination element comes from here instead of idx
 	int isReturn;
-	NAssignment(IdList *lhs, Node *rhs) : lhs(lhs), rhs(rhs), array(0), isReturn(0) {add_all_children(); }
+	NAssignment(IdList *lhs, Node *rhs) : lhs(lhs), rhs(rhs), array(0), index(0), isReturn(0) {add_all_children(); }
 	//Copy constructor
 	NAssignment(const NAssignment &other){
 		isReturn = other.isReturn;
-		lhs = 0; rhs = 0;
+		lhs = 0; rhs = 0; array = 0; index = 0;
 		if(other.lhs){
 			lhs = new IdList();
 			for(IdList::iterator it = other.lhs->begin(); it != other.lhs->end(); it++){
@@ -605,6 +830,11 @@ public:
 		}
 		if(other.rhs)
 			rhs = other.rhs->clone();
+		add_all_children();
+		if(other.array)
+			SetArray((NArrayRef*)other.array->clone());
+		if(other.index)
+			SetIndex((NIdentifier*)other.index->clone());
 	}
 	~NAssignment(){
 		delete lhs;
@@ -641,7 +871,11 @@ public:
 		return ret;	
 	}
 
-	void GetIdRefs(IdList &list) { rhs->GetIdRefs(list); }
+	void GetIdRefs(IdList &list) { 
+		rhs->GetIdRefs(list); 
+		if(index)
+			index->GetIdRefs(list);
+	}
 
 	void add_all_children(){
 		add_id_list(lhs);
@@ -649,6 +883,14 @@ public:
 			add_child(rhs);
 	}
 
+	void SetIndex(NIdentifier *in){
+		if(index)
+			children.remove(index);
+		index = in;
+		if(in)
+			add_child(in);
+	}
+
 	void SetExpr(Node *node){
 		children.remove(rhs);
 		add_child(node);
@@ -676,6 +918,8 @@ public:
 				os << **it << ", ";
 			}
 		}
+		if(index && !array)
+			os << "[" << *index << "]";
 		if(array)
 			os << *array << " ";
 		os << " = ";
@@ -710,6 +954,11 @@ public:
 		}
 //		sTabs--;
 	}
+	void GetIdRefs(IdList &list) {
+		for(NodeList::iterator it = children.begin(); it!= children.end(); it++)
+			(*it)->GetIdRefs(list);
+	}
+
 	GTypeList GetType(map<std::string, GTypeList> &locals, GTypeList* ptype, int *found, Node* exp) { 
 		NodeList::iterator it;
 		for(it = children.begin(); it!= children.end(); it++){
@@ -815,20 +1064,126 @@ public:
 	Node* clone() { return new NVariableDeclaration(*this); }
 };
 
+//if(cond){ then } else { otherwise }, otherwise may be missing. Only scalar functions have these
+class NIf : public Node {
+public:
+	Node *cond;
+	NBlock *then, *otherwise;
+	NIf(Node *cond, NBlock *then, NBlock *otherwise) : cond(cond), then(then), otherwise(otherwise) {
+		add_all_children();
+	}
+	//Copy constructor
+	NIf(const NIf &other){
+		cond = other.cond->clone();
+		then = (NBlock*)other.then->clone();
+		otherwise = other.otherwise ? (NBlock*)other.otherwise->clone() : 0;
+		add_all_children();
+	}
+
+	void add_all_children(){
+		add_child(cond);
+		add_child(then);
+		if(otherwise)
+			add_child(otherwise);
+	}
+
+	virtual llvm::Value* codeGen(CodeGenContext& context);
+
+	void SetCond(Node *node){
+		children.remove(cond);
+		add_child(node);
+		cond = node;
+	}
+
+	void GetIdRefs(IdList &list) {
+		cond->GetIdRefs(list);
+		then->GetIdRefs(list);
+		if(otherwise)
+			otherwise->GetIdRefs(list);
+	}
+
+	void print(ostream& os) { 
+		os << "if(" << *cond << "){\n";
+		sTabs++;
+		os << *then;
+		sTabs--;
+		for(int i=0; i < sTabs; i++)
+			os << "\t";
+		os << "}";
+		if(otherwise){
+			os << " else {\n";
+			sTabs++;
+			os << *otherwise;
+			sTabs--;
+			for(int i=0; i < sTabs; i++)
+				os << "\t";
+			os << "}";
+		}
+	}
+
+	Node* clone(){ return new NIf(*this); }
+};
+
+//for(init; cond; step){ block }. init declares or assigns the counter, the loop runs while cond holds
 class NLoop : public Node {
 public:
+	Node *init;
+	Node *cond;
+	NAssignment *step;
 	NBlock *block;
-	NLoop(NBlock *block) : block(block) {}		
+	int unroll, vectorize; //copies of the body per trip and vector width asked for, 0 when not given
+	NLoop(Node *init, Node *cond, NAssignment *step, NBlock *block, int unroll, int vectorize) : init(init), cond(cond), step(step), block(block), unroll(unroll), vectorize(vectorize) {
+		add_all_children();
+	}
+	//Copy constructor
+	NLoop(const NLoop &other){
+		init = other.init->clone();
+		cond = other.cond->clone();
+		step = (NAssignment*)other.step->clone();
+		block = (NBlock*)other.block->clone();
+		unroll = other.unroll;
+		vectorize = other.vectorize;
+		add_all_children();
+	}
+
+	void add_all_children(){
+		add_child(init);
+		add_child(cond);
+		add_child(step);
+		add_child(block);
+	}
+
+	virtual llvm::Value* codeGen(CodeGenContext& context);
+
+	void SetCond(Node *node){
+		children.remove(cond);
+		add_child(node);
+		cond = node;
+	}
+
+	void GetIdRefs(IdList &list) {
+		init->GetIdRefs(list);
+		cond->GetIdRefs(list);
+		step->GetIdRefs(list);
+		block->GetIdRefs(list);
+	}
+
 	void print(ostream& os) { 
-		os << "for(something){\n";
+		os << "for(" << *init << "; " << *cond << "; " << *step << ")";
+		if(unroll)
+			os << " unroll(" << unroll << ")";
+		if(vectorize)
+			os << " vectorize(" << vectorize << ")";
+		os << "{\n";
 		sTabs++;
-		if(block)
-			os << *block;
+		os << *block;
 		sTabs--;
 		for(int i=0; i < sTabs; i++)
 			os << "\t";
 		os << "}";
 	}
+
+	Node* clone(){ return new NLoop(*this); }
 };
 
 class NFunctionDeclaration : public Node {
@@ -837,13 +1192,16 @@ public:
 	VariableList *returns, *arguments;
 	NBlock *block;
 	int isGenerated;
+	//Names standing in for types in a generic function, 0 for an ordinary one
+	IdList *typeParams;
 	NFunctionDeclaration(VariableList* returns, NIdentifier* id, VariableList* arguments, NBlock *block) :
-			id(id), returns(returns), arguments(arguments), block(block), isGenerated(0) { 
+			id(id), returns(returns), arguments(arguments), block(block), isGenerated(0), typeParams(0) { 
 		add_all_children();
 	}
 	~NFunctionDeclaration(){
 		delete returns;
 		delete arguments;
+		delete typeParams;
 	}
 
 	void add_all_children(){
@@ -865,8 +1223,14 @@ public:
 		returns = 0;
 		arguments = 0;
 		block = 0;
+		typeParams = 0;
 		isGenerated = other.isGenerated;
 		id = (NIdentifier*)other.id->clone();
+		if(other.typeParams){
+			typeParams = new IdList();
+			for(IdList::iterator it = other.typeParams->begin(); it!= other.typeParams->end(); it++)
+				typeParams->push_back((NIdentifier*) (*it)->clone() );
+		}
 		if(other.block)
 			block = (NBlock*)other.block->clone();
 		if(other.returns){
@@ -888,6 +1252,12 @@ public:
 
 	void print(ostream& os) { 
 		VariableList::iterator it;
+		if(typeParams){
+			os << "generic(";
+			for(IdList::iterator it2 = typeParams->begin(); it2!=typeParams->end(); it2++)
+				os << **it2 << ", ";
+			os << ") ";
+		}
 		if(returns){
 			for(it = returns->begin(); it!=returns->end(); it++)
 				os << **it << ", ";
@@ -27,6 +27,35 @@ extern int yylex();
 extern int yylineno;
 extern char* yytext;
 void yyerror(const char *s) { std::printf("Error: %d: %s at %s\n", yylineno,s,yytext);std::exit(1); }
+
+//Splits the hints given to a for statement into its unroll count and vector width
+static void loop_hints(std::map<std::string,int> *hints, int &unroll, int &vectorize){
+	unroll = vectorize = 0;
+	for(std::map<std::string,int>::iterator it = hints->begin(); it != hints->end(); it++){
+		if(it->first == "unroll")
+			unroll = it->second;
+		else if(it->first == "vectorize")
+			vectorize = it->second;
+		else
+			yyerror("unknown loop hint");
+		if(it->second < 1)
+			yyerror("loop hint needs a count of at least 1");
+	}
+	if(vectorize & (vectorize - 1))
+		yyerror("vector width must be a power of two");
+	delete hints;
+}
+//Type parameters of the generic function being parsed
+static IdList *typeParams = 0;
+static int isTypeParam(const std::string &name){
+	if(!typeParams)
+		return 0;
+	for(IdList::iterator it = typeParams->begin(); it != typeParams->end(); it++){
+		if((*it)->name == name)
+			return 1;
+	}
+	return 0;
+}
 %}
 
 /* Represents the many different ways we can access our data */
@@ -42,6 +71,7 @@ void yyerror(const char *s) { std::printf("Error: %d: %s at %s\n", yylineno,s,yy
 	std::list<Node*> *nodevec;
 	std::list<NIdentifier*> *idvec;
 	std::string *string;
+	std::map<std::string,int> *hints;
 	int token;
 }
 
@@ -55,6 +85,7 @@ void yyerror(const char *s) { std::printf("Error: %d: %s at %s\n", yylineno,s,yy
 %token <token> TPLUS TMINUS TMUL TDIV 
 %token <token> TSEMI TLBRACK TRBRACK TCOLON TDCOLON TQUEST
 %token <token> TLSL TLSR TAND TOR
+%token <token> TIF TELSE TFOR TGENERIC
 
 /* Define the type of node our nonterminal symbols represent.
    The types refer to the %union declaration above. Ex: when
@@ -65,6 +96,7 @@ void yyerror(const char *s) { std::printf("Error: %d: %s at %s\n", yylineno,s,yy
 
 %type <type> type
 %type <node> numeric expr assignment func_call pipeline stmt var_decl func_decl_arg func_decl_ret
+%type <node> if_stmt for_stmt for_init
 %type <varvec> func_decl_args func_decl_rets
 %type <nodevec> expr_vec
 %type <pipevec> pipeline_chain
@@ -72,6 +104,7 @@ void yyerror(const char *s) { std::printf("Error: %d: %s at %s\n", yylineno,s,yy
 %type <block> program stmts block func_decls
 %type <node> func_decl 
 %type <map> map
+%type <hints> for_hints
 
 /* Operator precedence for mathematical operators */
 %left TCOLON TQUEST
@@ -79,6 +112,7 @@ void yyerror(const char *s) { std::printf("Error: %d: %s at %s\n", yylineno,s,yy
 %left TCEQ TCNE TCLT TCGT TCLE TCGE
 %left TMUL TDIV 
 %left TLSL TLSR TAND TOR
+%right UMINUS
 
 %start program
 
@@ -99,8 +133,26 @@ stmt : var_decl TSEMI
 	| assignment TSEMI 
 	| func_call TSEMI 
 	| pipeline TSEMI 
+	| if_stmt
+	| for_stmt
      	;
 
+if_stmt : TIF TLPAREN expr TRPAREN block { $$ = new NIf($3, $5, 0); }
+	| TIF TLPAREN expr TRPAREN block TELSE block { $$ = new NIf($3, $5, $7); }
+	| TIF TLPAREN expr TRPAREN block TELSE if_stmt { NBlock *other = new NBlock(); other->add_child($7); $$ = new NIf($3, $5, other); }
+	;
+
+for_stmt : TFOR TLPAREN for_init TSEMI expr TSEMI assignment TRPAREN for_hints block { int unroll, vectorize; loop_hints($9, unroll, vectorize); $$ = new NLoop($3, $5, (NAssignment*)$7, $10, unroll, vectorize); }
+	;
+
+for_hints : /*blank*/ { $$ = new std::map<std::string,int>(); }
+	| for_hints ident TLPAREN TINTEGER TRPAREN { (*$1)[$2->name] = atoi($4->c_str()); delete $2; delete $4; }
+	;
+
+for_init : var_decl
+	| assignment
+	;
+
 pipeline : id_vec TDCOLON pipeline_chain TCGT id_vec {$$ = new NPipeLine($1,$5,$3); }
 	;
 
@@ -113,6 +165,7 @@ id_vec: ident { $$ = new IdList(); $$->push_back($1); }
 	;
 	
 map : ident TLPAREN id_vec TCOLON expr_vec TRPAREN { $$ = new NMap($1,$3,$5); }
+	| ident TLPAREN ident TRPAREN { $$ = new NIndexMap($1,$3); }
 	;
 
 block : TLBRACE stmts TRBRACE { $$ = $2; }
@@ -132,6 +185,13 @@ func_decl_ret : type ident { $$ = new NVariableDeclaration(new TypeList{$1}, $2)
  
 func_decl : func_decl_rets TCOLON ident TLPAREN func_decl_args TRPAREN block
 	{ $$ = new NFunctionDeclaration($1, $3, $5, $7); }
+	| TGENERIC TLPAREN id_vec TRPAREN { typeParams = $3; } func_decl_rets TCOLON ident TLPAREN func_decl_args TRPAREN block
+	{
+		NFunctionDeclaration *decl = new NFunctionDeclaration($6, $8, $10, $12);
+		decl->typeParams = typeParams;
+		typeParams = 0;
+		$$ = decl;
+	}
 	;
 
 type : TIDENTIFIER { $$ = new NType(*$1,0); delete $1; }
@@ -173,12 +233,22 @@ expr :  ident { $<ident>$ = $1; }
   	| expr TLSL expr { $$ = new NBinaryOperator($1, $2, $3); }
   	| expr TLSR expr { $$ = new NBinaryOperator($1, $2, $3); }
   	| expr TAND expr { $$ = new NBinaryOperator($1, $2, $3); }
+	| TMINUS expr %prec UMINUS { $$ = new NUnaryOperator($1, $2); }
+	| TPLUS expr %prec UMINUS { $$ = $2; }
 	| expr TQUEST expr TCOLON expr { $$ = new NSelect($1, $3, $5); }
      	| TLPAREN expr TRPAREN { $$ = $2; }
 	| func_call
 	;
 
-func_call : ident TLPAREN expr_vec TRPAREN { $$ = new NMethodCall($1, $3); }
+func_call : ident TLPAREN expr_vec TRPAREN {
+		//A call to a type is a cast
+		if((isTypeName($1->name) || isTypeParam($1->name)) && $3->size() == 1){
+			$$ = new NCast(new NType($1->name,0), $3->front());
+			delete $1;
+			delete $3;
+		}else
+			$$ = new NMethodCall($1, $3);
+	}
 	;
 
 expr_vec : /*blank*/ { $$ = new NodeList(); }
@@ -0,0 +1,101 @@
+/* 
+GPiler - profile.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "node.h"
+#include "profile.h"
+
+#include <cstdio>
+#include <fstream>
+
+using namespace std;
+
+Profile *profile=0;
+
+void Profile::Load(const char *path){
+	ifstream in(path);
+	string kind, name;
+	while(in >> kind >> name){
+		if(kind == "kernel"){
+			KernelCount &c = kernels[name];
+			in >> c.calls >> c.elements;
+		}else if(kind == "filter"){
+			FilterCount &c = filters[name];
+			in >> c.in >> c.out;
+		}else if(kind == "select"){
+			SelectCount &c = selects[name];
+			in >> c.yes >> c.total;
+		}else{
+			cout << "Bad profile entry " << kind << " in " << path << "\n";
+			exit(-1);
+		}
+	}
+}
+
+void Profile::Save(const char *path){
+	ofstream out(path);
+	if(!out){
+		cout << "Can't write profile " << path << "\n";
+		exit(-1);
+	}
+	for(map<string,KernelCount>::iterator it = kernels.begin(); it != kernels.end(); it++)
+		out << "kernel " << it->first << " " << it->second.calls << " " << it->second.elements << "\n";
+	for(map<string,FilterCount>::iterator it = filters.begin(); it != filters.end(); it++)
+		out << "filter " << it->first << " " << it->second.in << " " << it->second.out << "\n";
+	for(map<string,SelectCount>::iterator it = selects.begin(); it != selects.end(); it++)
+		out << "select " << it->first << " " << it->second.yes << " " << it->second.total << "\n";
+}
+
+double Profile::Selectivity(string compaction){
+	if(filters.find(compaction) == filters.end() || filters[compaction].in < PROFILE_MIN_SAMPLES)
+		return -1;
+	return (double)filters[compaction].out / filters[compaction].in;
+}
+
+double Profile::Bias(string select){
+	if(selects.find(select) == selects.end() || selects[select].total < PROFILE_MIN_SAMPLES)
+		return -1;
+	return (double)selects[select].yes / selects[select].total;
+}
+
+bool Profile::Hot(string kernel){
+	if(kernels.find(kernel) == kernels.end())
+		return false;
+	long long most=0;
+	for(map<string,KernelCount>::iterator it = kernels.begin(); it != kernels.end(); it++)
+		most = MAX(most, it->second.elements);
+	return most >= PROFILE_MIN_SAMPLES && kernels[kernel].elements >= most * PROFILE_HOT;
+}
+
+//Launched, but never had an element to work on
+bool Profile::Cold(string kernel){
+	if(kernels.find(kernel) == kernels.end())
+		return false;
+	return kernels[kernel].calls > 0 && kernels[kernel].elements == 0;
+}
+
+void number_selects(Node *node, string func, map<NSelect*,string> &ids){
+	NSelect *select = dynamic_cast<NSelect*>(node);
+	if(select){
+		char name[128];
+		sprintf(name,"%s#%d",func.c_str(),(int)ids.size());
+		ids[select] = name;
+	}
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		number_selects(*it,func,ids);
+}
@@ -0,0 +1,73 @@
+/* 
+GPiler - profile.h
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef GPL_PROFILE_H
+#define GPL_PROFILE_H
+
+#include "node.h"
+
+//Below this many samples a count says nothing
+#define PROFILE_MIN_SAMPLES	1000
+//A select that goes one way at least this often is lowered to a branch
+#define PROFILE_BIASED		0.9
+//Kernels doing at least this share of the busiest kernel's elements are hot
+#define PROFILE_HOT		0.1
+//A filter keeping at least this share of its input is applied as a mask to the results of the stages
+//after it rather than compacted in front of them
+#define PROFILE_MASKED		0.75
+
+struct KernelCount {
+	long long calls, elements;
+};
+
+struct FilterCount {
+	long long in, out;
+};
+
+struct SelectCount {
+	long long yes, total;
+};
+
+//What a run through the interpreter saw. Kernels and compactions are keyed by module name,
+//selects by the function they are in and their position in it, see number_selects
+class Profile {
+public:
+	//Missing files are an empty profile
+	void Load(const char *path);
+	void Save(const char *path);
+
+	//Fraction of elements a compaction keeps, -1 when unknown
+	double Selectivity(string compaction);
+	//Fraction of evaluations that took the yes arm, -1 when unknown
+	double Bias(string select);
+	bool Hot(string kernel);
+	bool Cold(string kernel);
+
+	map<string,KernelCount> kernels;
+	map<string,FilterCount> filters;
+	map<string,SelectCount> selects;
+};
+
+//Profile guiding this compile, 0 when there is none
+extern Profile *profile;
+
+//Names every select under node as func#n in preorder, ids starts out empty for each function
+void number_selects(Node *node, string func, map<NSelect*,string> &ids);
+
+#endif
@@ -21,10 +21,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "codegen.h"
 #include "parser.hpp"
 #include "runtime.h"
+#include "profile.h"
+
+#include <set>
 
 using namespace std;
 
-///////////////////////NEW PLAN/////////////////////////////
+list<RuntimePlan*> runtimePlans;
+int indexBits = 32;
+
+RuntimePlan::RuntimePlan(NFunctionDeclaration *target) : target(target), peak(0) {
+	for(VariableList::iterator it = target->arguments->begin(); it != target->arguments->end(); it++)
+		inputs.push_back((NVariableDeclaration*)(*it)->clone());
+	for(VariableList::iterator it = target->returns->begin(); it != target->returns->end(); it++)
+		outputs.push_back((NVariableDeclaration*)(*it)->clone());
+}
 
 //TODO: Maybe move this into function member, taking std::string as argument
 bool varPresent(NFunctionDeclaration *decl, NVariableDeclaration *var){
@@ -40,87 +51,259 @@ bool varPresent(NFunctionDeclaration *decl, NVariableDeclaration *var){
 	return false;
 }
 
-void generate_runtime(NFunctionDeclaration* target, FunctionList *modules){
-	//Fix up the arguments so we get enough memory to do this
-	//TODO: try to free and reuse memory from a void typed pool by paying attention to when memory goes
-	//out of scope. potentially find optimal order of modules to minimize memory consumption
-	target->block->children.clear();
+//Bytes per element of an array variable, the pool is sized in these units
+int elemBytes(NVariableDeclaration *var){
+	GType type = *((Node*)var)->GetType().begin();
+	return type.length < 8 ? 1 : type.length / 8;
+}
+
+//The array a length argument add_bounds gave decl is for, "" for any other argument
+string boundArray(NFunctionDeclaration *decl, NVariableDeclaration *arg){
+	string name = arg->id->name;
+	if(name.size() < 6 || name.compare(name.size() - 5, 5, ".size"))
+		return "";
+	string array = name.substr(0, name.size() - 5);
+	for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++){
+		if((*it)->id->name == array && (*(*it)->types->begin())->isArray)
+			return array;
+	}
+	return "";
+}
+
+struct ModuleInfo {
+	NFunctionDeclaration *decl;
+	list<string> defs, uses; //intermediates only
+	set<int> deps;
+};
+
+//Peak bytes per element when the modules run in this order. An intermediate is live from the module
+//that writes it until the last module that reads it has finished
+static int peak_of(vector<int> &order, vector<ModuleInfo> &mods, map<string,int> &bytes){
+	map<string,int> first, last;
+	for(unsigned step=0; step < order.size(); step++){
+		ModuleInfo &mod = mods[order[step]];
+		for(list<string>::iterator it = mod.defs.begin(); it != mod.defs.end(); it++){
+			first[*it] = step;
+			last[*it] = MAX(last[*it],(int)step);
+		}
+		for(list<string>::iterator it = mod.uses.begin(); it != mod.uses.end(); it++)
+			last[*it] = step;
+	}
+
+	int peak=0;
+	for(unsigned step=0; step < order.size(); step++){
+		int live=0;
+		for(map<string,int>::iterator it = first.begin(); it != first.end(); it++){
+			if(it->second <= (int)step && last[it->first] >= (int)step)
+				live += bytes[it->first];
+		}
+		peak = MAX(peak,live);
+	}
+	return peak;
+}
+
+//Try every order the dependencies allow, there are rarely more than a handful of modules
+static void search_order(vector<int> &cur, vector<bool> &done, vector<ModuleInfo> &mods, map<string,int> &bytes,
+			vector<int> &best, int *best_peak){
+	if(cur.size() == mods.size()){
+		int peak = peak_of(cur,mods,bytes);
+		if(*best_peak < 0 || peak < *best_peak){
+			*best_peak = peak;
+			best = cur;
+		}
+		return;
+	}
+	for(unsigned i=0; i < mods.size(); i++){
+		if(done[i])
+			continue;
+		bool ready = true;
+		for(set<int>::iterator it = mods[i].deps.begin(); it != mods[i].deps.end(); it++)
+			ready = ready && done[*it];
+		if(!ready)
+			continue;
+		done[i] = true;
+		cur.push_back(i);
+		search_order(cur,done,mods,bytes,best,best_peak);
+		cur.pop_back();
+		done[i] = false;
+	}
+}
+
+//Too many modules to search, run whichever ready module leaves the least memory allocated
+static void greedy_order(vector<ModuleInfo> &mods, map<string,int> &bytes, vector<int> &order){
+	map<string,int> readers;
+	for(unsigned i=0; i < mods.size(); i++){
+		for(list<string>::iterator it = mods[i].uses.begin(); it != mods[i].uses.end(); it++)
+			readers[*it]++;
+	}
+
+	vector<bool> done(mods.size(),false);
+	while(order.size() < mods.size()){
+		int pick=-1, pick_cost=0;
+		for(unsigned i=0; i < mods.size(); i++){
+			if(done[i])
+				continue;
+			bool ready = true;
+			for(set<int>::iterator it = mods[i].deps.begin(); it != mods[i].deps.end(); it++)
+				ready = ready && done[*it];
+			if(!ready)
+				continue;
+			int cost=0;
+			for(list<string>::iterator it = mods[i].defs.begin(); it != mods[i].defs.end(); it++)
+				cost += bytes[*it];
+			for(list<string>::iterator it = mods[i].uses.begin(); it != mods[i].uses.end(); it++){
+				if(readers[*it] == 1)
+					cost -= bytes[*it];
+			}
+			if(pick < 0 || cost < pick_cost){
+				pick = i;
+				pick_cost = cost;
+			}
+		}
+		assert(pick >= 0 && "Module dependencies are cyclic");
+		done[pick] = true;
+		order.push_back(pick);
+		for(list<string>::iterator it = mods[pick].uses.begin(); it != mods[pick].uses.end(); it++)
+			readers[*it]--;
+	}
+}
+
+#define MAX_SEARCH_MODULES 8
+
+RuntimePlan* generate_runtime(NFunctionDeclaration* target, FunctionList *modules){
+	RuntimePlan *plan = new RuntimePlan(target);
+
+	//Anything the modules produce that the caller didn't ask for is an intermediate. Outputs of target
+	//can be read by a later module too, so definer has every name a module writes
+	map<string,int> bytes;
+	map<string,NVariableDeclaration*> decls;
+	map<string,int> definer;
+	vector<ModuleInfo> mods;
 	for(FunctionList::iterator it = modules->begin(); it!=modules->end(); it++){
 		NFunctionDeclaration *decl = *it;
+		ModuleInfo mod;
+		mod.decl = decl;
 		for(VariableList::iterator it2 = decl->returns->begin(); it2 != decl->returns->end(); it2++){
 			NVariableDeclaration *var = *it2;
+			definer[var->id->name] = mods.size();
 			if(!varPresent(target,var)){
-				//Add it
-				NVariableDeclaration *new_var = (NVariableDeclaration*)var->clone();
-				//TODO: HACK!!
-				new_var->type->isArray = 1;
-				target->AddReturn(new_var);
+				bytes[var->id->name] = elemBytes(var);
+				decls[var->id->name] = var;
+				mod.defs.push_back(var->id->name);
 			}
 		}
+		mods.push_back(mod);
+	}
+	for(unsigned i=0; i < mods.size(); i++){
+		NFunctionDeclaration *decl = mods[i].decl;
+		for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++){
+			string name = (*it)->id->name;
+			if(definer.find(name) == definer.end())
+				continue;
+			if(definer[name] != (int)i)
+				mods[i].deps.insert(definer[name]);
+			if(bytes.find(name) != bytes.end())
+				mods[i].uses.push_back(name);
+		}
 	}
 
-	//Add the modules to the function body
-	for(FunctionList::iterator it = modules->begin(); it!=modules->end(); it++){
-		target->block->add_child(new NLoop(0));
-	}	
-}
+	//Pick the order with the smallest footprint
+	vector<int> order;
+	if(mods.size() <= MAX_SEARCH_MODULES){
+		vector<int> cur;
+		vector<bool> done(mods.size(),false);
+		int best_peak=-1;
+		search_order(cur,done,mods,bytes,order,&best_peak);
+	}else
+		greedy_order(mods,bytes,order);
+	plan->peak = peak_of(order,mods,bytes);
+
+	//Linear scan over the chosen order handing out pool slots
+	map<string,int> last;
+	for(unsigned step=0; step < order.size(); step++){
+		ModuleInfo &mod = mods[order[step]];
+		for(list<string>::iterator it = mod.defs.begin(); it != mod.defs.end(); it++)
+			last[*it] = MAX(last[*it],(int)step);
+		for(list<string>::iterator it = mod.uses.begin(); it != mod.uses.end(); it++)
+			last[*it] = step;
+	}
 
-////////////////////////OLD PLAN////////////////////////////////////
+	list<int> free_slots;
+	for(unsigned step=0; step < order.size(); step++){
+		ModuleInfo &mod = mods[order[step]];
+		for(list<string>::iterator it = mod.defs.begin(); it != mod.defs.end(); it++){
+			int need = bytes[*it];
+			//Smallest free slot that fits, otherwise widen the biggest one, otherwise a new one
+			list<int>::iterator pick = free_slots.end();
+			for(list<int>::iterator it2 = free_slots.begin(); it2 != free_slots.end(); it2++){
+				int have = plan->pool[*it2].elemBytes;
+				if(pick == free_slots.end())
+					pick = it2;
+				else{
+					int best = plan->pool[*pick].elemBytes;
+					if((have >= need && (best < need || have < best)) || (best < need && have > best))
+						pick = it2;
+				}
+			}
+			int slot;
+			if(pick != free_slots.end()){
+				slot = *pick;
+				free_slots.erase(pick);
+			}else{
+				slot = plan->pool.size();
+				plan->pool.push_back(PoolSlot());
+				plan->pool[slot].elemBytes = 0;
+			}
+			plan->pool[slot].elemBytes = MAX(plan->pool[slot].elemBytes,need);
+			plan->pool[slot].vars.push_back(decls[*it]->id);
+			plan->slots[*it] = slot;
+		}
 
-//TODO: this is real fugly for now. need a better way of defining input and output arrays
-RuntimeInst::RuntimeInst(NFunctionDeclaration* func){
-	name = func->id->name;
+		//Whatever was read for the last time here goes back to the pool once the module is done
+		for(map<string,int>::iterator it = last.begin(); it != last.end(); it++){
+			if(it->second == (int)step)
+				free_slots.push_back(plan->slots[it->first]);
+		}
+	}
 
-	VariableList::iterator it;
-	for(it = func->arguments->begin(); it!=func->arguments->end(); it++){
-			inputs.push_back(*it);
+	//Rebuild the body as declarations of the intermediates followed by the module calls
+	target->block->children.clear();
+	for(map<string,NVariableDeclaration*>::iterator it = decls.begin(); it != decls.end(); it++){
+		NVariableDeclaration *new_var = (NVariableDeclaration*)it->second->clone();
+		(*new_var->types->begin())->isArray = 1;
+		target->block->add_child(new_var);
 	}
+	for(unsigned step=0; step < order.size(); step++){
+		NFunctionDeclaration *decl = mods[order[step]].decl;
+		plan->order.push_back(decl);
+		for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++)
+			plan->writes[decl->id->name].push_back((*it)->id->name);
 
-	for(it = func->returns->begin(); it!=func->returns->end(); it++){
-			outputs.push_back(*it);
+		NodeList *args = new NodeList();
+		for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++)
+			args->push_back(new NIdentifier((*it)->id->name));
+		for(VariableList::iterator it = decl->arguments->begin(); it != decl->arguments->end(); it++)
+			args->push_back(new NIdentifier((*it)->id->name));
+		target->block->add_child(new NMethodCall(new NIdentifier(decl->id->name),args));
 	}
-}
 
-void RuntimeInst::print(){
-	cout << "__global__ void " << name << "_runtime(";
-	
-	bool first=true;
-	VariableList::iterator it;
-	for(it = inputs.begin(); it!= inputs.end(); it++){
-		if(first){
-			first=false;
-		}else
-			cout << ", ";
-		NVariableDeclaration *var = *it;
-		cout << var->type->name << " *" << var->id->name;
-		cout << ", int32 " << var->id->name << "_size";
-	}
-
-	for(it = outputs.begin(); it!= outputs.end(); it++){
-		if(first){
-			first=false;
-		}else
-			cout << ", ";
-		NVariableDeclaration *var = *it;
-		cout << var->type->name << " *" << var->id->name;
-		cout << ", int32 *" << var->id->name << "_size";
-	}
-
-	cout << "){\n";
-///////////// TODO: generate this moar
-	cout << "\tfor(int i=0; i<N; i+=blockDim.x*gridDim.x){\n";
-  	cout << "\t\tint idx = i + blockIdx.x * blockDim.x + threadIdx.x;\n";
-	cout << "\t\tif (idx<N)\n";
-	cout << "\t\t\t" << name << "(idx,return,input)\n";
-  	cout << "\t}\n";
-	cout << "\t*return_size = input_size;\n";
-////////////
-	cout << "}\n";
+	return plan;
 }
 
-void Runtime::print(){
-	auto it = runtimes.begin();
-	for(; it!=runtimes.end(); it++){
-		(*it).second->print();
+void RuntimePlan::print(){
+	cout << "Runtime for " << target->id->name << ", peak " << peak << " bytes per element\n";
+	for(unsigned i=0; i < pool.size(); i++){
+		cout << "\tpool " << i << " (" << pool[i].elemBytes << " bytes):";
+		for(IdList::iterator it = pool[i].vars.begin(); it != pool[i].vars.end(); it++)
+			cout << " " << **it;
+		cout << "\n";
+	}
+	for(FunctionList::iterator it = order.begin(); it != order.end(); it++){
+		cout << "\t" << (compactions.count(*it)?"compact ":"run ") << *(*it)->id;
+		if(launchSize.find((*it)->id->name) != launchSize.end())
+			cout << " over " << launchSize[(*it)->id->name];
+		if(profile && profile->Selectivity((*it)->id->name) >= 0)
+			cout << ", keeps " << (int)(profile->Selectivity((*it)->id->name) * 100) << "%";
+		cout << "\n";
 	}
-}	
+}
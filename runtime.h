@@ -17,25 +17,45 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
 #include "node.h"
 
-class RuntimeInst{
-public:
-	RuntimeInst(NFunctionDeclaration* func);
-	void print();
+#include <set>
 
-	string name;
-	VariableList inputs,outputs;
+//A buffer in the void typed pool. Intermediates whose lifetimes don't overlap share one,
+//it is sized for the widest element ever stored in it
+struct PoolSlot {
+	int elemBytes;
+	IdList vars;
 };
 
-
-class Runtime {
+//How the modules split out of target are run and where their intermediates live
+class RuntimePlan {
 public:
-	Runtime() {}
-	void AddFunction(NFunctionDeclaration *func) {runtimes[func->id->name] = new RuntimeInst(func);}
+	RuntimePlan(NFunctionDeclaration *target);
 	void print();
-	map<string,RuntimeInst*> runtimes;
+
+	NFunctionDeclaration *target;
+	VariableList inputs, outputs; //target's signature, later passes rewrite the declaration itself
+	map<string, list<string> > writes; //module name to the arrays it produces
+	FunctionList order;
+	set<NFunctionDeclaration*> compactions; //modules done by the runtime with a scan, not kernels
+	map<string,string> launchSize; //module name to the array whose length is its launch size
+	vector<PoolSlot> pool;
+	map<string,int> slots;
+	int peak; //bytes per element live at the worst point of order
 };
 
-void generate_runtime(NFunctionDeclaration* target, FunctionList *modules);
+extern list<RuntimePlan*> runtimePlans;
+//Width of idx and of the element counts launchers take, 32 unless -w 64 asks for more than 2^31 elements
+extern int indexBits;
+
+RuntimePlan* generate_runtime(NFunctionDeclaration* target, FunctionList *modules);
+int elemBytes(NVariableDeclaration *var);
+string boundArray(NFunctionDeclaration *decl, NVariableDeclaration *arg);
+
+extern map<string, list<string> > independentKernels;
 
+#endif
@@ -0,0 +1,199 @@
+/* 
+GPiler - schedule.cpp
+Copyright (C) 2013 Jon Pry and Charles Cooper
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "node.h"
+#include "codegen.h"
+#include "parser.hpp"
+#include "runtime.h"
+
+#include <cstdio>
+#include <set>
+
+using namespace std;
+
+static int find_group(vector<int> &groups, int i){
+	while(groups[i] != i){
+		groups[i] = groups[groups[i]];
+		i = groups[i];
+	}
+	return i;
+}
+
+static void join_groups(vector<int> &groups, int a, int b){
+	groups[find_group(groups,a)] = find_group(groups,b);
+}
+
+static VariableList *select_vars(VariableList *vars, set<string> &names){
+	VariableList *ret = new VariableList();
+	if(!vars)
+		return ret;
+	for(VariableList::iterator it = vars->begin(); it != vars->end(); it++){
+		if(names.find((*it)->id->name) != names.end())
+			ret->push_back((NVariableDeclaration*)(*it)->clone());
+	}
+	return ret;
+}
+
+//Splits the statements of decl into groups that share no data. Two statements are connected when one 
+//reads what the other writes, reading the same argument doesn't count
+static int dependency_groups(NFunctionDeclaration *decl, vector<NodeList> &out){
+	vector<Node*> stmts(decl->block->children.begin(), decl->block->children.end());
+	vector<int> groups;
+	map<string,int> definer;
+	for(unsigned i=0; i < stmts.size(); i++){
+		groups.push_back(i);
+		NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(stmts[i]);
+		if(vdec)
+			definer[vdec->id->name] = i;
+	}
+
+	for(unsigned i=0; i < stmts.size(); i++){
+		NAssignment *assn = dynamic_cast<NAssignment*>(stmts[i]);
+		if(assn && assn->lhs){
+			for(IdList::iterator it = assn->lhs->begin(); it != assn->lhs->end(); it++){
+				if(definer.find((*it)->name) != definer.end())
+					join_groups(groups,i,definer[(*it)->name]);
+				else
+					definer[(*it)->name] = i;
+			}
+		}
+	}
+
+	for(unsigned i=0; i < stmts.size(); i++){
+		IdList ids;
+		stmts[i]->GetIdRefs(ids);
+		for(IdList::iterator it = ids.begin(); it != ids.end(); it++){
+			if(definer.find((*it)->name) != definer.end())
+				join_groups(groups,i,definer[(*it)->name]);
+		}
+	}
+
+	//Groups that write none of the returns are dead, they ride along with the first live one
+	set<string> returns;
+	for(VariableList::iterator it = decl->returns->begin(); it != decl->returns->end(); it++)
+		returns.insert((*it)->id->name);
+	set<int> live;
+	for(unsigned i=0; i < stmts.size(); i++){
+		NAssignment *assn = dynamic_cast<NAssignment*>(stmts[i]);
+		if(assn && assn->lhs){
+			for(IdList::iterator it = assn->lhs->begin(); it != assn->lhs->end(); it++){
+				if(returns.find((*it)->name) != returns.end())
+					live.insert(find_group(groups,i));
+			}
+		}
+	}
+	if(live.empty())
+		return 1;
+
+	map<int,int> index;
+	for(unsigned i=0; i < stmts.size(); i++){
+		int g = find_group(groups,i);
+		if(live.find(g) != live.end() && index.find(g) == index.end()){
+			index[g] = out.size();
+			out.push_back(NodeList());
+		}
+	}
+	for(unsigned i=0; i < stmts.size(); i++){
+		int g = find_group(groups,i);
+		out[index.find(g) != index.end() ? index[g] : 0].push_back(stmts[i]);
+	}
+	return out.size();
+}
+
+//Kernels that came out of one function, the runtime is free to run them at the same time
+map<string, list<string> > independentKernels;
+//The functions they came out of, callers still see these
+static map<string, NFunctionDeclaration*> independentSources;
+
+//Every group becomes its own kernel so the runtime can hand them to different threads. Requires SSA,
+//otherwise reuse of a name would look like a dependency
+void split_independent(NBlock *pb){
+	for(NodeList::iterator it = pb->children.begin(); it != pb->children.end(); ){
+		NFunctionDeclaration *decl = dynamic_cast<NFunctionDeclaration*>(*it);
+		if(!decl || decl->isGenerated || decl->isScalar()){
+			it++;
+			continue;
+		}
+
+		vector<NodeList> groups;
+		if(dependency_groups(decl,groups) < 2){
+			it++;
+			continue;
+		}
+
+		cout << decl->id->name << " has " << groups.size() << " independent pipelines\n";
+		for(unsigned i=0; i < groups.size(); i++){
+			set<string> names;
+			NBlock *block = new NBlock();
+			for(NodeList::iterator it2 = groups[i].begin(); it2 != groups[i].end(); it2++){
+				IdList ids;
+				(*it2)->GetIdRefs(ids);
+				NAssignment *assn = dynamic_cast<NAssignment*>(*it2);
+				if(assn && assn->lhs)
+					ids.insert(ids.end(), assn->lhs->begin(), assn->lhs->end());
+				for(IdList::iterator it3 = ids.begin(); it3 != ids.end(); it3++)
+					names.insert((*it3)->name);
+				block->add_child(*it2);
+			}
+
+			char name[128];
+			sprintf(name,"%s.g%d",decl->id->name.c_str(),i);
+			NFunctionDeclaration *group = new NFunctionDeclaration(select_vars(decl->returns,names),new NIdentifier(name),
+									select_vars(decl->arguments,names),block);
+			pb->add_child(it,group);
+			independentKernels[decl->id->name].push_back(name);
+		}
+		independentSources[decl->id->name] = decl;
+		it = pb->children.erase(it);
+	}
+}
+
+static RuntimePlan *find_plan(string name){
+	for(list<RuntimePlan*>::iterator it = runtimePlans.begin(); it != runtimePlans.end(); it++){
+		if((*it)->target->id->name == name)
+			return *it;
+	}
+	cout << "No runtime for independent kernel " << name << "\n";
+	exit(-1);
+}
+
+//The groups were planned on their own, this puts them back under one plan for the function they came
+//from so it keeps its signature and its one launcher. Nothing connects the groups, the launcher is free
+//to run them side by side. Requires split_unnatural to have run
+void merge_independent(){
+	for(map<string, list<string> >::iterator it = independentKernels.begin(); it != independentKernels.end(); it++){
+		RuntimePlan *plan = new RuntimePlan(independentSources[it->first]);
+		for(list<string>::iterator it2 = it->second.begin(); it2 != it->second.end(); it2++){
+			RuntimePlan *group = find_plan(*it2);
+			int base = plan->pool.size();
+			plan->pool.insert(plan->pool.end(), group->pool.begin(), group->pool.end());
+			for(map<string,int>::iterator it3 = group->slots.begin(); it3 != group->slots.end(); it3++)
+				plan->slots[it3->first] = base + it3->second;
+			plan->order.insert(plan->order.end(), group->order.begin(), group->order.end());
+			plan->writes.insert(group->writes.begin(), group->writes.end());
+			plan->launchSize.insert(group->launchSize.begin(), group->launchSize.end());
+			plan->compactions.insert(group->compactions.begin(), group->compactions.end());
+			//Both groups may be at their worst at once
+			plan->peak += group->peak;
+			runtimePlans.remove(group);
+		}
+		runtimePlans.push_back(plan);
+		plan->print();
+	}
+}
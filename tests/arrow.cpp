@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <vector>
+
+#include "../cpu/arrow.h"
+
+//inputs/example3.gpl, compiled for the host and linked with cpu/libgplrt.a
+extern "C" size_t mapit_chunk(void **outs, void **ins, size_t n, void *user);
+
+//The batch owns its inputs once added, these count that it gave them back
+static int released = 0;
+
+static void release_array(ArrowArray *array){
+	released++;
+	array->release = 0;
+}
+
+static void release_schema(ArrowSchema *schema){
+	released++;
+	schema->release = 0;
+}
+
+//Every third row is null and gets dropped before the pipeline sees it
+static int dropped(){
+	int64_t n = 1000;
+	std::vector<double> vals(n);
+	std::vector<uint8_t> bits((n + 7) / 8, 0);
+	int64_t nulls = 0;
+	for(int64_t i=0; i < n; i++){
+		vals[i] = i;
+		if(i % 3)
+			bits[i >> 3] |= 1 << (i & 7);
+		else
+			nulls++;
+	}
+	const void *buffers[2] = {bits.data(), vals.data()};
+	ArrowArray in = {n, nulls, 0, 2, 0, buffers, 0, 0, release_array, 0};
+	ArrowSchema schema = {"g", "x", 0, ARROW_FLAG_NULLABLE, 0, 0, 0, release_schema, 0};
+
+	ArrowBatch *batch = new ArrowBatch();
+	batch->AddInput(&in, &schema);
+	batch->AddOutput("g");
+	size_t rows = batch->Run(mapit_chunk, 0, ARROW_DROP_NULLS);
+
+	ArrowArray out;
+	ArrowSchema outSchema;
+	batch->ExportOutput(0, &out, &outSchema);
+	int bad = in.release || schema.release || released;
+	delete batch;
+	bad |= released != 2;
+
+	const double *res = (const double*)out.buffers[1];
+	bad |= rows != (size_t)(n - nulls) || out.length != n - nulls || out.null_count;
+	for(int64_t i=1, k=0; !bad && i < n; i++){
+		if(i % 3)
+			bad = res[k++] != vals[i]*vals[i] + 1;
+	}
+	out.release(&out);
+	outSchema.release(&outSchema);
+	printf("%zu rows, %s\n", rows, bad ? "FAIL" : "ok");
+	return bad;
+}
+
+//An unknown null count without a bitmap means no nulls, every row is computed
+static int unknown(){
+	int64_t n = 100;
+	std::vector<double> vals(n);
+	for(int64_t i=0; i < n; i++)
+		vals[i] = i;
+	const void *buffers[2] = {0, vals.data()};
+	ArrowArray in = {n, -1, 0, 2, 0, buffers, 0, 0, release_array, 0};
+	ArrowSchema schema = {"g", "x", 0, ARROW_FLAG_NULLABLE, 0, 0, 0, release_schema, 0};
+
+	ArrowBatch batch;
+	batch.AddInput(&in, &schema);
+	batch.AddOutput("g");
+	size_t rows = batch.Run(mapit_chunk, 0, ARROW_KEEP_NULLS);
+
+	ArrowArray out;
+	ArrowSchema outSchema;
+	batch.ExportOutput(0, &out, &outSchema);
+	const double *res = (const double*)out.buffers[1];
+	int bad = rows != (size_t)n || out.buffers[0] || out.null_count;
+	for(int64_t i=0; !bad && i < n; i++)
+		bad = res[i] != vals[i]*vals[i] + 1;
+	out.release(&out);
+	outSchema.release(&outSchema);
+	printf("%zu rows, %s\n", rows, bad ? "FAIL" : "ok");
+	return bad;
+}
+
+int main(){
+	int bad = dropped();
+	bad |= unknown();
+	return bad;
+}
@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+//inputs/example14.gpl, compiled for the host and linked with cpu/libgplrt.a. value_number leaves
+//x + y, x * y and x - y computed once each, the results have to be what the source says. a / b stays
+//in its arm, the zeros in b would trap if it were computed for every element
+void mapit_launch(double *p, int *pSize, double *q, int *qSize, double *s, int *sSize, int *r, int *rSize,
+			double *x, int xSize, double *y, int ySize, int *a, int aSize, int *b, int bSize);
+
+static double poly(double x, double y){
+	return (x + y) * (x + y) + (x + y) * 2.0 + (x + y);
+}
+
+int main(){
+	double x[6] = {-2.5, -1.5, -0.5, 0.5, 1.5, 2.5};
+	double y[6] = {1, -2, 3, 0.5, -4, 6};
+	int a[6] = {7, -9, 4, 0, 12, 5};
+	int b[6] = {2, 0, -3, 5, 0, 1};
+	double p[6], q[6], s[6];
+	int r[6];
+	int pSize = 0, qSize = 0, sSize = 0, rSize = 0;
+
+	mapit_launch(p, &pSize, q, &qSize, s, &sSize, r, &rSize, x, 6, y, 6, a, 6, b, 6);
+
+	int bad = pSize != 6 || qSize != 6 || sSize != 6 || rSize != 6;
+	for(int i=0; !bad && i < 6; i++){
+		double d = (x[i] - y[i]) * (x[i] - y[i]) + (x[i] > y[i] ? (x[i] * y[i]) / (x[i] * y[i] + 1.0) : 0.0);
+		bad = p[i] != poly(x[i], y[i]) || q[i] != x[i] * y[i] - poly(x[i], y[i]) * (x[i] * y[i]) || s[i] != d ||
+			r[i] != (b[i] != 0 ? (a[i] / b[i]) * (a[i] / b[i]) : -1);
+	}
+	printf("%s\n", bad ? "FAIL" : "ok");
+	return bad;
+}
@@ -0,0 +1,33 @@
+#include <stdio.h>
+
+//inputs/example5.gpl, compiled for the host and linked with cpu/libgplrt.a
+void mapit_launch(double *ret1, int *ret1Size, double *ret2, int *ret2Size, int *input, int inputSize, int *input2, int input2Size);
+
+//What survives x * 2 > 0, as x * 2 + 2. Returns how many did
+static int expect(int *in, int n, double *out){
+	int k = 0;
+	for(int i=0; i < n; i++){
+		if(in[i] * 2 > 0)
+			out[k++] = in[i] * 2 + 2.0;
+	}
+	return k;
+}
+
+int main(){
+	int input[8] = {-3, 5, 0, 2, -1, 7, 4, -6};
+	int input2[8] = {1, -2, 3, 0, -4, 6, -8, 9};
+	double ret1[8], ret2[8], want1[8], want2[8];
+	int ret1Size = 0, ret2Size = 0;
+
+	mapit_launch(ret1, &ret1Size, ret2, &ret2Size, input, 8, input2, 8);
+
+	//Compacted outputs keep their order and report the surviving count
+	int n1 = expect(input, 8, want1), n2 = expect(input2, 8, want2);
+	int bad = ret1Size != n1 || ret2Size != n2;
+	for(int i=0; !bad && i < n1; i++)
+		bad = ret1[i] != want1[i];
+	for(int i=0; !bad && i < n2; i++)
+		bad = ret2[i] != want2[i];
+	printf("%d and %d of 8 kept, %s\n", ret1Size, ret2Size, bad ? "FAIL" : "ok");
+	return bad;
+}
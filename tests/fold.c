@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+//inputs/example12.gpl, compiled for the host and linked with cpu/libgplrt.a. scale is folded down to
+//x * -256.0 + 1.0 - 0.25 while compiling, power is never called. The second stage's generated function
+//is folded to x * 6.0 + 0.5
+void mapit_launch(double *out, int *outSize, double *x, int xSize);
+
+int main(){
+	double x[6] = {-2.5, -1, 0, 0.5, 3, 7};
+	double out[6];
+	int outSize = 0;
+
+	mapit_launch(out, &outSize, x, 6);
+
+	//-power(2.0, 10) / 4.0 and (3 > 2 ? 1.0 : 0.0) - power(0.5, 2) worked out by hand, then the stage
+	int bad = outSize != 6;
+	for(int i=0; !bad && i < 6; i++)
+		bad = out[i] != (x[i] * (-1024.0 / 4.0) + 1.0 - 0.25) * 6.0 + 0.5;
+	printf("%s\n", bad ? "FAIL" : "ok");
+	return bad;
+}
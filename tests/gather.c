@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+//inputs/example9.gpl, compiled for the host and linked with cpu/libgplrt.a
+void mapit_launch(double *px, int *pxSize, double *out, int *outSize, int *ids, int idsSize,
+			double *prices, int pricesSize, int *slots, int slotsSize);
+
+//From cpu/launch.h
+void *gpl_graph(int64_t most);
+const int64_t *gpl_graph_bucket(void *graph, const void *index, int32_t indexBytes, int32_t isUnsigned, int64_t n, int32_t elemBytes);
+void gpl_graph_run(void *graph);
+
+static int small(){
+	int ids[6] = {4, 0, 2, 5, 1, 3};
+	int slots[6] = {5, 3, 0, 1, 4, 2};
+	double prices[7] = {1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5};
+	double px[6], out[6];
+	int pxSize = 0, outSize = 0;
+
+	mapit_launch(px, &pxSize, out, &outSize, ids, 6, prices, 7, slots, 6);
+
+	//px gathers prices at ids + 1, out gets px * 2 scattered to slots
+	int bad = pxSize != 6 || outSize != 6;
+	for(int i=0; !bad && i < 6; i++)
+		bad = px[i] != prices[ids[i] + 1] || out[slots[i]] != px[i] * 2;
+	printf("%d gathered, %d scattered, %s\n", pxSize, outSize, bad ? "FAIL" : "ok");
+	return bad;
+}
+
+//slots is an input column, so the launcher runs the scatter bucketed by the page of out it lands on
+static int large(){
+	int n = 1 << 20;
+	int *ids = malloc(n * sizeof(int)), *slots = malloc(n * sizeof(int));
+	double *prices = malloc((n + 1) * sizeof(double)), *px = malloc(n * sizeof(double)), *out = malloc(n * sizeof(double));
+	srand(1);
+	for(int i=0; i < n; i++){
+		ids[i] = rand() % n;
+		slots[i] = i;
+		prices[i] = i * 0.5;
+	}
+	prices[n] = -1;
+	for(int i=n-1; i > 0; i--){
+		int j = rand() % (i + 1), t = slots[i];
+		slots[i] = slots[j];
+		slots[j] = t;
+	}
+	int pxSize = 0, outSize = 0;
+
+	mapit_launch(px, &pxSize, out, &outSize, ids, n, prices, n + 1, slots, n);
+
+	int bad = pxSize != n || outSize != n;
+	for(int i=0; !bad && i < n; i++)
+		bad = px[i] != prices[ids[i] + 1] || out[slots[i]] != px[i] * 2;
+
+	//The order itself, every element once, by page and in idx order within a page
+	void *graph = gpl_graph(n);
+	const int64_t *order = gpl_graph_bucket(graph, slots, sizeof(int), 0, n, sizeof(double));
+	char *seen = calloc(n, 1);
+	bad |= !order;
+	for(int i=0; !bad && i < n; i++){
+		bad = order[i] < 0 || order[i] >= n || seen[order[i]];
+		seen[order[i]] = 1;
+		if(!bad && i){
+			int64_t page = (int64_t)slots[order[i]] * sizeof(double) >> 12, last = (int64_t)slots[order[i-1]] * sizeof(double) >> 12;
+			bad = page < last || (page == last && order[i] < order[i-1]);
+		}
+	}
+	gpl_graph_run(graph);
+
+	printf("%d gathered, %d scattered, %s\n", pxSize, outSize, bad ? "FAIL" : "ok");
+	free(seen);
+	free(ids);
+	free(slots);
+	free(prices);
+	free(px);
+	free(out);
+	return bad;
+}
+
+int main(){
+	int bad = small();
+	bad |= large();
+	return bad;
+}
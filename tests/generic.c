@@ -0,0 +1,23 @@
+#include <stdio.h>
+
+//inputs/example13.gpl, compiled for the host and linked with cpu/libgplrt.a. abs is instantiated for
+//double and int32, dist and clamp for int32
+void mapit_launch(double *fo, int *foSize, int *io, int *ioSize, double *f, int fSize, int *i, int iSize);
+
+int main(){
+	double f[6] = {-2.5, -1, 0, 0.5, 3, -7.25};
+	int i[6] = {-3, -1, 0, 1, 2, 5};
+	double fo[6];
+	int io[6];
+	int foSize = 0, ioSize = 0;
+
+	mapit_launch(fo, &foSize, io, &ioSize, f, 6, i, 6);
+
+	int bad = foSize != 6 || ioSize != 6;
+	for(int k=0; !bad && k < 6; k++){
+		int d = i[k] > 1 ? i[k] - 1 : 1 - i[k];
+		bad = fo[k] != (f[k] > 0 ? f[k] : -f[k]) || io[k] != (d > 2 ? 2 : d);
+	}
+	printf("%s\n", bad ? "FAIL" : "ok");
+	return bad;
+}
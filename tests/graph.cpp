@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <vector>
+
+#include "../cpu/launch.h"
+
+//The runtime half of a CPU launcher, driven by hand. Linked with cpu/libgplrt.a
+
+struct Map {
+	const double *in;
+	double *out;
+};
+
+struct Mask {
+	const double *in;
+	bool *mask;
+};
+
+static void twice(int64_t begin, int64_t end, void *user){
+	Map *m = (Map*)user;
+	for(int64_t i=begin; i < end; i++)
+		m->out[i] = m->in[i] * 2;
+}
+
+static void inc(int64_t begin, int64_t end, void *user){
+	Map *m = (Map*)user;
+	for(int64_t i=begin; i < end; i++)
+		m->out[i] = m->in[i] + 1;
+}
+
+static void thirds(int64_t begin, int64_t end, void *user){
+	Mask *m = (Mask*)user;
+	for(int64_t i=begin; i < end; i++)
+		m->mask[i] = (int64_t)m->in[i] % 3 == 0;
+}
+
+//x * 2 + 1 chunk by chunk, filtered to multiples of 3, then + 1 over however many survived
+static int check(int64_t n){
+	std::vector<double> x(n), y(n), z(n), w(n), v(n);
+	bool *mask = new bool[n];
+	for(int64_t i=0; i < n; i++)
+		x[i] = i;
+
+	int64_t count = -1;
+	void *graph = gpl_graph(n);
+	Map a = {x.data(), y.data()}, b = {y.data(), z.data()}, c = {w.data(), v.data()};
+	Mask m = {z.data(), mask};
+	int32_t t1 = gpl_graph_kernel(graph, twice, &a, &n);
+	int32_t t2 = gpl_graph_kernel(graph, inc, &b, &n);
+	int32_t t3 = gpl_graph_kernel(graph, thirds, &m, &n);
+	int32_t t4 = gpl_graph_compact(graph, w.data(), z.data(), mask, &n, sizeof(double), &count);
+	//Queued before the compaction has worked out its count
+	int32_t t5 = gpl_graph_kernel(graph, inc, &c, &count);
+	gpl_graph_chunk_dep(graph, t2, t1);
+	gpl_graph_chunk_dep(graph, t3, t2);
+	gpl_graph_dep(graph, t4, t3);
+	gpl_graph_dep(graph, t5, t4);
+	gpl_graph_run(graph);
+
+	int64_t k = 0;
+	int bad = 0;
+	for(int64_t i=0; !bad && i < n; i++){
+		int64_t val = 2 * i + 1;
+		if(val % 3 == 0)
+			bad = v[k++] != val + 1;
+	}
+	bad |= count != k;
+	printf("%lld elements, %lld kept, %s\n", (long long)n, (long long)count, bad ? "FAIL" : "ok");
+	delete[] mask;
+	return bad;
+}
+
+int main(){
+	//Run in order on the calling thread, then over the pool
+	int bad = check(1000);
+	bad |= check(1000000);
+	return bad;
+}
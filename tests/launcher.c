@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+//inputs/example7.gpl, compiled for the host and linked with cpu/libgplrt.a. temp is an intermediate
+//in the pool read by two kernels, and reused for the second pipeline
+void mapit_launch(double *xp, int *xpSize, double *x1p, int *x1pSize, double *yp, int *ypSize, double *y1p, int *y1pSize,
+			double *x, int xSize, double *y, int ySize);
+
+static int check(int n){
+	double *x = malloc(n * sizeof(double)), *y = malloc(n * sizeof(double));
+	double *xp = malloc(n * sizeof(double)), *x1p = malloc(n * sizeof(double));
+	double *yp = malloc(n * sizeof(double)), *y1p = malloc(n * sizeof(double));
+	int sizes[4] = {0, 0, 0, 0};
+	for(int i=0; i < n; i++){
+		x[i] = i;
+		y[i] = n - i;
+	}
+
+	mapit_launch(xp, &sizes[0], x1p, &sizes[1], yp, &sizes[2], y1p, &sizes[3], x, n, y, n);
+
+	int bad = sizes[0] != n || sizes[1] != n || sizes[2] != n || sizes[3] != n;
+	for(int i=0; !bad && i < n; i++)
+		bad = xp[i] != (x[i] + 1) * 2 || x1p[i] != (x[i] + 1) * 3 || yp[i] != (y[i] + 3) * 4 || y1p[i] != (y[i] + 3) * 5;
+	printf("%d elements, %s\n", n, bad ? "FAIL" : "ok");
+	free(x); free(y); free(xp); free(x1p); free(yp); free(y1p);
+	return bad;
+}
+
+int main(){
+	//Small enough to run in order on the calling thread, then big enough for the task graph
+	int bad = check(100);
+	bad |= check(1000000);
+	return bad;
+}
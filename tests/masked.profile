@@ -0,0 +1,8 @@
+kernel mapit.g0.0 1 2000
+kernel mapit.g0.1 1 1812
+kernel mapit.g1.0 1 2000
+kernel mapit.g1.1 1 178
+kernel mapit.g1.2 1 178
+filter mapit.g0.compact0 2000 1812
+filter mapit.g1.compact0 2000 178
+filter mapit.g1.compact1 178 178
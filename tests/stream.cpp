@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <vector>
+
+#include "../cpu/stream.h"
+
+//inputs/example3.gpl, compiled for the host and linked with cpu/libgplrt.a
+extern "C" size_t mapit_chunk(void **outs, void **ins, size_t n, void *user);
+
+class VectorSink : public StreamSink {
+public:
+	VectorSink() : StreamSink(sizeof(double)) {}
+	void Write(const void *src, size_t n){
+		const double *vals = (const double*)src;
+		data.insert(data.end(), vals, vals + n);
+	}
+
+	std::vector<double> data;
+};
+
+int main(){
+	//Not a multiple of the chunk size, so the last chunk is a short one
+	size_t n = 10000;
+	std::vector<double> in(n);
+	for(size_t i=0; i < n; i++)
+		in[i] = i * 0.5;
+
+	MemorySource src(in.data(), n, sizeof(double));
+	VectorSink sink;
+	StreamRunner runner(4096);
+	runner.AddInput(&src);
+	runner.AddOutput(&sink);
+	size_t consumed = runner.Run(mapit_chunk, 0);
+
+	int bad = consumed != n || sink.data.size() != n;
+	for(size_t i=0; !bad && i < n; i++)
+		bad = sink.data[i] != in[i]*in[i] + 1;
+	printf("%zu in, %zu out, %s\n", consumed, sink.data.size(), bad ? "FAIL" : "ok");
+	return bad;
+}
@@ -139,10 +139,11 @@ TypeList typeOf(string name, NBlock* pb){
 NType* GType::toNode(){
 	string stype;
 	if(type==FLOAT_TYPE){
-		if(length==64)
-			stype = "double";
-		else
-			stype = "float";
+		switch(length){
+			case 64: stype = "double"; break;
+			case 32: stype = "float"; break;
+			case 16: stype = "half"; break;
+		}
 	}
 
 	if(type==INT_TYPE){
@@ -155,6 +156,15 @@ NType* GType::toNode(){
 		}
 	}
 
+	if(type==UINT_TYPE){
+		switch(length){
+			case 64: stype = "uint64"; break;
+			case 32: stype = "uint32"; break;
+			case 16: stype = "uint16"; break;
+			case 8: stype = "uint8"; break;
+		}
+	}
+
 	if(type==VOID_TYPE){
 		stype = "void";
 	}
@@ -175,10 +185,30 @@ GTypeList NBinaryOperator::GetType(map<std::string, GTypeList> &locals){
 	return promoteType(lhs->GetType(locals),rhs->GetType(locals));
 }
 
+//The type a binary operator on exp would have
+GTypeList NUnaryOperator::GetType(map<std::string, GTypeList> &locals){
+	GTypeList type = exp->GetType(locals);
+	return promoteType(type,type);
+}
+
 GTypeList NSelect::GetType(map<std::string, GTypeList> &locals){
 	return promoteType(yes->GetType(locals),no->GetType(locals));
 }
 
+//bool < int8 < int16 < int32 < int64 < half < float < double. An unsigned type ranks with the
+//signed one of its width
+static int typeRank(GType type){
+	if(type.type == FLOAT_TYPE)
+		return 128 + type.length;
+	return type.length;
+}
+
+//Width floating point arithmetic is done in at the least, set by -a. Arrays keep their declared
+//type, values are only narrowed again when they are stored
+int accumulateBits = 0;
+
+//The operands of a binary operator meet at the higher of their two types. Like C, unsigned wins
+//between integers of the same width
 GTypeList promoteType(GTypeList ltypel, GTypeList rtypel){
 	GType ltype = *ltypel.begin();
 	GType rtype = *rtypel.begin();
@@ -186,16 +216,13 @@ GTypeList promoteType(GTypeList ltypel, GTypeList rtypel){
 		cout << "Arithmetic on vectors found\n";
 		exit(-1);
 	}
-	GType ret;
-	if(ltype.type == FLOAT_TYPE || rtype.type == FLOAT_TYPE){
-		ret.type = FLOAT_TYPE;
-	}else{
-		//TODO: not sure if we support any other automatic promotions but we can at least check
-		//for argument type match and throw awesome error
-		ret.type = ltype.type;
-	}
-
-	ret.length = MAX(ltype.length,rtype.length);
+	GType ret = typeRank(ltype) >= typeRank(rtype) ? ltype : rtype;
+	if(ret.type != FLOAT_TYPE && ltype.length == rtype.length && (ltype.type == UINT_TYPE || rtype.type == UINT_TYPE))
+		ret.type = UINT_TYPE;
+	if(ret.type == FLOAT_TYPE && ret.length < accumulateBits)
+		ret.length = accumulateBits;
+	ret.isArray = 0;
+	ret.isPointer = 0;
 
 	return GTypeList{ret};
 }
@@ -204,6 +231,38 @@ GTypeList NIdentifier::GetType(map<std::string, GTypeList> &locals) {
 	return locals[name];
 }
 
+int isTypeName(const string &name){
+	return name == "int" || name == "int64" || name == "int32" || name == "int16" || name == "int8" ||
+		name == "uint" || name == "uint64" || name == "uint32" || name == "uint16" || name == "uint8" ||
+		name == "double" || name == "float" || name == "half" || name == "bool" || name == "void";
+}
+
+//Everything a statement declares or assigns, the outputs of calls included
+static void assigned_names(Node *node, set<string> &names){
+	NAssignment *assn = dynamic_cast<NAssignment*>(node);
+	NVariableDeclaration *vdec = dynamic_cast<NVariableDeclaration*>(node);
+	NRef *ref = dynamic_cast<NRef*>(node);
+	if(assn && assn->lhs){
+		for(IdList::iterator it = assn->lhs->begin(); it != assn->lhs->end(); it++)
+			names.insert((*it)->name);
+	}
+	if(vdec && vdec->id)
+		names.insert(vdec->id->name);
+	if(ref)
+		names.insert(ref->exp->name);
+	for(NodeList::iterator it = node->children.begin(); it != node->children.end(); it++)
+		assigned_names(*it, names);
+}
+
+//Names assigned inside the if and for statements of block. These keep one name for every value
+//they take, nothing that assumes single assignment may touch them
+void mutated_names(NBlock *block, set<string> &names){
+	for(NodeList::iterator it = block->children.begin(); it != block->children.end(); it++){
+		if(dynamic_cast<NIf*>(*it) || dynamic_cast<NLoop*>(*it))
+			assigned_names(*it, names);
+	}
+}
+
 GTypeList NType::GetType(map<std::string, GTypeList> &locals){
 	GType ret;
 	if (name.compare("int") == 0 || name.compare("int32") == 0) {
@@ -214,10 +273,20 @@ GTypeList NType::GetType(map<std::string, GTypeList> &locals){
 		ret.type = FLOAT_TYPE; ret.length = 64;
 	}else if (name.compare("float") == 0) {
 		ret.type = FLOAT_TYPE; ret.length = 32;
+	}else if (name.compare("half") == 0) {
+		ret.type = FLOAT_TYPE; ret.length = 16;
 	}else if (name.compare("int16") == 0) {
-		ret.type = INT_TYPE; ret.length = 32;
+		ret.type = INT_TYPE; ret.length = 16;
 	}else if (name.compare("int8") == 0) {
 		ret.type = INT_TYPE; ret.length = 8;
+	}else if (name.compare("uint") == 0 || name.compare("uint32") == 0) {
+		ret.type = UINT_TYPE; ret.length = 32;
+	}else if (name.compare("uint64") == 0) {
+		ret.type = UINT_TYPE; ret.length = 64;
+	}else if (name.compare("uint16") == 0) {
+		ret.type = UINT_TYPE; ret.length = 16;
+	}else if (name.compare("uint8") == 0) {
+		ret.type = UINT_TYPE; ret.length = 8;
 	}else if (name.compare("bool") == 0) {
 		ret.type = BOOL_TYPE; ret.length = 1;
 	}else if (name.compare("void") == 0) {